@@ -0,0 +1,871 @@
+#include "Bitstream.h"
+#include <cstring>
+#include <algorithm>
+#include <NVI/Codec.h>
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+}
+
+namespace bitstream
+{
+const uint8_t* FindStartCode(const uint8_t* data, const uint8_t* end)
+{
+    if (end - data < 3)
+    {
+        return end;
+    }
+    const uint8_t* p = data;
+    const uint8_t* last = end - 2;
+    while (p < last)
+    {
+        // 先用memchr跳到下一个可能的01，再回看前两个字节
+        const uint8_t* one = static_cast<const uint8_t*>(memchr(p + 2, 1, static_cast<size_t>(end - p - 2)));
+        if (one == nullptr)
+        {
+            return end;
+        }
+        if (one[-1] == 0 && one[-2] == 0)
+        {
+            return one - 2;
+        }
+        p = one - 1;
+    }
+    return end;
+}
+
+uint8_t NALType(uint32_t codec, const uint8_t* nal)
+{
+    return codec == NVICodec_HEVC ? static_cast<uint8_t>((nal[0] >> 1) & 0x3F) : static_cast<uint8_t>(nal[0] & 0x1F);
+}
+
+bool IsIDR(uint32_t codec, uint8_t type)
+{
+    if (codec == NVICodec_HEVC)
+    {
+        return type == HEVC_NAL_IDR_W_RADL || type == HEVC_NAL_IDR_N_LP;
+    }
+    return type == H264_NAL_IDR;
+}
+
+bool IsParameterSet(uint32_t codec, uint8_t type)
+{
+    if (codec == NVICodec_HEVC)
+    {
+        return type == HEVC_NAL_VPS || type == HEVC_NAL_SPS || type == HEVC_NAL_PPS;
+    }
+    return type == H264_NAL_SPS || type == H264_NAL_PPS;
+}
+
+bool IsSlice(uint32_t codec, uint8_t type)
+{
+    if (codec == NVICodec_HEVC)
+    {
+        return type < HEVC_NAL_VPS;
+    }
+    return type >= H264_NAL_SLICE && type <= H264_NAL_IDR;
+}
+
+bool HasIDR(uint32_t codec, const uint8_t* data, size_t size)
+{
+    bool bIDR = false;
+    ForEachNAL(data, size,
+               [codec, &bIDR](const uint8_t* nal, size_t) -> bool
+               {
+                   bIDR = IsIDR(codec, NALType(codec, nal));
+                   return !bIDR;
+               });
+    return bIDR;
+}
+
+bool IsFirstInAccessUnit(uint32_t codec, const uint8_t* nal, bool vcl)
+{
+    if (!vcl)
+    {
+        return false;
+    }
+    const uint8_t type = NALType(codec, nal);
+    if (codec == NVICodec_HEVC)
+    {
+        // 图像数据看first_slice_segment_in_pic_flag，参数集、AUD、前缀SEI和保留类型在图像数据之前
+        if (type < HEVC_NAL_VPS)
+        {
+            return (nal[2] & 0x80) != 0;
+        }
+        return (type >= HEVC_NAL_VPS && type <= HEVC_NAL_AUD) || type == HEVC_NAL_SEI_PREFIX || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+    }
+    // first_mb_in_slice为0时ue(v)编码的第一位为1
+    if (type >= H264_NAL_SLICE && type <= H264_NAL_IDR)
+    {
+        return (nal[1] & 0x80) != 0;
+    }
+    return (type >= H264_NAL_SEI && type <= H264_NAL_AUD) || (type >= 14 && type <= 18);
+}
+
+namespace
+{
+// RBSP的位读取，跳过防竞争字节；越界后读到0并置错误标志
+class BitReader final
+{
+public:
+    BitReader(const uint8_t* data, size_t size)
+        : m_pData(data)
+        , m_szSize(size)
+        , m_szPos(0)
+        , m_uZeros(0)
+        , m_uCache(0)
+        , m_nBits(0)
+        , m_bError(false)
+    {
+    }
+    uint32_t Bit()
+    {
+        if (m_nBits == 0)
+        {
+            if (m_szPos >= m_szSize)
+            {
+                m_bError = true;
+                return 0;
+            }
+            uint8_t uByte = m_pData[m_szPos++];
+            if (m_uZeros >= 2 && uByte == 3)
+            {
+                m_uZeros = 0;
+                if (m_szPos >= m_szSize)
+                {
+                    m_bError = true;
+                    return 0;
+                }
+                uByte = m_pData[m_szPos++];
+            }
+            m_uZeros = uByte == 0 ? m_uZeros + 1 : 0;
+            m_uCache = uByte;
+            m_nBits = 8;
+        }
+        --m_nBits;
+        return (m_uCache >> m_nBits) & 1;
+    }
+    uint32_t Bits(int32_t n)
+    {
+        uint32_t uValue = 0;
+        for (int32_t i = 0; i < n; ++i)
+        {
+            uValue = (uValue << 1) | Bit();
+        }
+        return uValue;
+    }
+    void Skip(int32_t n)
+    {
+        for (int32_t i = 0; i < n; ++i)
+        {
+            Bit();
+        }
+    }
+    // ue(v)，超过32位的前缀视为错误
+    uint32_t UE()
+    {
+        int32_t nZeros = 0;
+        while (Bit() == 0)
+        {
+            if (m_bError || ++nZeros > 31)
+            {
+                m_bError = true;
+                return 0;
+            }
+        }
+        return ((1u << nZeros) - 1) + Bits(nZeros);
+    }
+    int32_t SE()
+    {
+        const uint32_t uValue = UE();
+        return (uValue & 1) ? static_cast<int32_t>((uValue + 1) / 2) : -static_cast<int32_t>(uValue / 2);
+    }
+    bool Error() const
+    {
+        return m_bError;
+    }
+
+private:
+    const uint8_t* m_pData;
+    size_t m_szSize;
+    size_t m_szPos;
+    uint32_t m_uZeros;
+    uint32_t m_uCache;
+    int32_t m_nBits;
+    bool m_bError;
+};
+
+// H.264表A-1的MaxDpbMbs
+uint32_t MaxDpbMbs(uint32_t level)
+{
+    switch (level)
+    {
+    case 9:
+    case 10: return 396;
+    case 11: return 900;
+    case 12:
+    case 13:
+    case 20: return 2376;
+    case 21: return 4752;
+    case 22:
+    case 30: return 8100;
+    case 31: return 18000;
+    case 32: return 20480;
+    case 40:
+    case 41: return 32768;
+    case 42: return 34816;
+    case 50: return 110400;
+    case 51:
+    case 52: return 184320;
+    default: return 696320;  // 6.x
+    }
+}
+
+bool ParseAVCSPS(BitReader& reader, SequenceInfo& info)
+{
+    const uint32_t uProfile = reader.Bits(8);
+    reader.Skip(8);
+    const uint32_t uLevel = reader.Bits(8);
+    reader.UE();
+    info.chroma_format = 1;
+    info.bit_depth = 8;
+    bool bSeparate = false;
+    switch (uProfile)
+    {
+    case 100:
+    case 110:
+    case 122:
+    case 244:
+    case 44:
+    case 83:
+    case 86:
+    case 118:
+    case 128:
+    case 138:
+    case 139:
+    case 134:
+    case 135:
+    {
+        info.chroma_format = reader.UE();
+        if (info.chroma_format == 3)
+        {
+            bSeparate = reader.Bit() != 0;
+        }
+        info.bit_depth = reader.UE() + 8;
+        reader.UE();
+        reader.Skip(1);
+        if (reader.Bit())
+        {
+            // seq_scaling_matrix，只需跳过
+            const int32_t nLists = info.chroma_format != 3 ? 8 : 12;
+            for (int32_t i = 0; i < nLists; ++i)
+            {
+                if (reader.Bit() == 0)
+                {
+                    continue;
+                }
+                int32_t nLast = 8;
+                int32_t nNext = 8;
+                const int32_t nSize = i < 6 ? 16 : 64;
+                for (int32_t j = 0; j < nSize && nNext != 0; ++j)
+                {
+                    nNext = (nLast + reader.SE() + 256) % 256;
+                    nLast = nNext == 0 ? nLast : nNext;
+                }
+            }
+        }
+        break;
+    }
+    default: break;
+    }
+    reader.UE();
+    const uint32_t uPocType = reader.UE();
+    if (uPocType == 0)
+    {
+        reader.UE();
+    }
+    else if (uPocType == 1)
+    {
+        reader.Skip(1);
+        reader.SE();
+        reader.SE();
+        const uint32_t uCycle = reader.UE();
+        for (uint32_t i = 0; i < uCycle && !reader.Error(); ++i)
+        {
+            reader.SE();
+        }
+    }
+    const uint32_t uRefFrames = reader.UE();
+    reader.Skip(1);
+    const uint32_t uWidthMbs = reader.UE() + 1;
+    const uint32_t uHeightUnits = reader.UE() + 1;
+    const uint32_t uFrameMbsOnly = reader.Bit();
+    if (!uFrameMbsOnly)
+    {
+        reader.Skip(1);
+    }
+    reader.Skip(1);
+    const uint32_t uHeightMbs = uHeightUnits * (2 - uFrameMbsOnly);
+    info.coded_width = uWidthMbs * 16;
+    info.coded_height = uHeightMbs * 16;
+    info.width = info.coded_width;
+    info.height = info.coded_height;
+    if (reader.Bit())
+    {
+        const uint32_t uSubWidth = info.chroma_format == 1 || info.chroma_format == 2 ? 2 : 1;
+        const uint32_t uSubHeight = info.chroma_format == 1 ? 2 : 1;
+        const uint32_t uCropX = bSeparate || info.chroma_format == 0 ? 1 : uSubWidth;
+        const uint32_t uCropY = (bSeparate || info.chroma_format == 0 ? 1 : uSubHeight) * (2 - uFrameMbsOnly);
+        const uint32_t uLeft = reader.UE();
+        const uint32_t uRight = reader.UE();
+        const uint32_t uTop = reader.UE();
+        const uint32_t uBottom = reader.UE();
+        info.width -= std::min(info.width - 1, uCropX * (uLeft + uRight));
+        info.height -= std::min(info.height - 1, uCropY * (uTop + uBottom));
+    }
+    // VUI中的max_dec_frame_buffering通常缺省，按级别限制估计，不少于参考帧数
+    info.dpb_size = std::max(std::min(MaxDpbMbs(uLevel) / (uWidthMbs * uHeightMbs), 16u), std::min(uRefFrames, 16u));
+    return !reader.Error();
+}
+
+void SkipProfileTierLevel(BitReader& reader, uint32_t sub_layers)
+{
+    reader.Skip(96);
+    uint32_t arrPresent[8]{};
+    for (uint32_t i = 0; i < sub_layers; ++i)
+    {
+        arrPresent[i] = reader.Bits(2);
+    }
+    if (sub_layers > 0)
+    {
+        reader.Skip(static_cast<int32_t>(8 - sub_layers) * 2);
+    }
+    for (uint32_t i = 0; i < sub_layers; ++i)
+    {
+        reader.Skip((arrPresent[i] & 2) ? 88 : 0);
+        reader.Skip((arrPresent[i] & 1) ? 8 : 0);
+    }
+}
+
+bool ParseHEVCSPS(BitReader& reader, SequenceInfo& info)
+{
+    reader.Skip(4);
+    const uint32_t uSubLayers = reader.Bits(3);
+    reader.Skip(1);
+    SkipProfileTierLevel(reader, uSubLayers);
+    reader.UE();
+    info.chroma_format = reader.UE();
+    bool bSeparate = false;
+    if (info.chroma_format == 3)
+    {
+        bSeparate = reader.Bit() != 0;
+    }
+    info.coded_width = reader.UE();
+    info.coded_height = reader.UE();
+    info.width = info.coded_width;
+    info.height = info.coded_height;
+    if (reader.Bit())
+    {
+        // conformance_window按色度采样为单位
+        const uint32_t uSubWidth = !bSeparate && (info.chroma_format == 1 || info.chroma_format == 2) ? 2 : 1;
+        const uint32_t uSubHeight = !bSeparate && info.chroma_format == 1 ? 2 : 1;
+        const uint32_t uLeft = reader.UE();
+        const uint32_t uRight = reader.UE();
+        const uint32_t uTop = reader.UE();
+        const uint32_t uBottom = reader.UE();
+        info.width -= std::min(info.width - 1, uSubWidth * (uLeft + uRight));
+        info.height -= std::min(info.height - 1, uSubHeight * (uTop + uBottom));
+    }
+    info.bit_depth = reader.UE() + 8;
+    reader.UE();
+    reader.UE();
+    const bool bOrdering = reader.Bit() != 0;
+    info.dpb_size = 0;
+    for (uint32_t i = bOrdering ? 0 : uSubLayers; i <= uSubLayers; ++i)
+    {
+        // 取最高时域层的sps_max_dec_pic_buffering_minus1
+        info.dpb_size = reader.UE() + 1;
+        reader.UE();
+        reader.UE();
+    }
+    return !reader.Error() && info.coded_width > 0 && info.coded_height > 0;
+}
+}  // namespace
+
+bool ParseSPS(uint32_t codec, const uint8_t* nal, size_t size, SequenceInfo& info)
+{
+    const size_t szHeader = codec == NVICodec_HEVC ? 2 : 1;
+    if (nal == nullptr || size <= szHeader)
+    {
+        return false;
+    }
+    BitReader reader(nal + szHeader, size - szHeader);
+    info = SequenceInfo{};
+    return codec == NVICodec_HEVC ? ParseHEVCSPS(reader, info) : ParseAVCSPS(reader, info);
+}
+
+int32_t ParameterSetId(uint32_t codec, const uint8_t* nal, size_t size)
+{
+    const size_t szHeader = codec == NVICodec_HEVC ? 2 : 1;
+    if (nal == nullptr || size <= szHeader)
+    {
+        return -1;
+    }
+    BitReader reader(nal + szHeader, size - szHeader);
+    const uint8_t uType = NALType(codec, nal);
+    uint32_t uId = 0;
+    if (codec == NVICodec_HEVC && uType == HEVC_NAL_VPS)
+    {
+        uId = reader.Bits(4);
+    }
+    else if (codec == NVICodec_HEVC && uType == HEVC_NAL_SPS)
+    {
+        reader.Skip(4);
+        const uint32_t uSubLayers = reader.Bits(3);
+        reader.Skip(1);
+        SkipProfileTierLevel(reader, uSubLayers);
+        uId = reader.UE();
+    }
+    else if (codec != NVICodec_HEVC && uType == H264_NAL_SPS)
+    {
+        // profile_idc、constraint_set和level_idc之后
+        reader.Skip(24);
+        uId = reader.UE();
+    }
+    else if (uType == (codec == NVICodec_HEVC ? static_cast<uint8_t>(HEVC_NAL_PPS) : static_cast<uint8_t>(H264_NAL_PPS)))
+    {
+        uId = reader.UE();
+    }
+    else
+    {
+        return -1;
+    }
+    return reader.Error() ? -1 : static_cast<int32_t>(uId);
+}
+
+void StoreParameterSet(uint32_t codec, std::vector<std::vector<uint8_t>>& sets, const uint8_t* nal, size_t size)
+{
+    const uint8_t uType = NALType(codec, nal);
+    const int32_t nId = ParameterSetId(codec, nal, size);
+    auto it = sets.begin();
+    for (; it != sets.end(); ++it)
+    {
+        const uint8_t uStored = NALType(codec, it->data() + 4);
+        if (uStored == uType && ParameterSetId(codec, it->data() + 4, it->size() - 4) == nId)
+        {
+            it->resize(4);
+            it->insert(it->end(), nal, nal + size);
+            return;
+        }
+        // 类型值按VPS、SPS、PPS递增，被引用的参数集在前
+        if (uStored > uType)
+        {
+            break;
+        }
+    }
+    std::vector<uint8_t> vecNAL{0, 0, 0, 1};
+    vecNAL.insert(vecNAL.end(), nal, nal + size);
+    sets.insert(it, std::move(vecNAL));
+}
+
+bool IsRandomAccess(uint32_t codec, uint8_t type)
+{
+    if (codec == NVICodec_HEVC)
+    {
+        return type >= HEVC_NAL_BLA_W_LP && type <= HEVC_NAL_CRA;
+    }
+    return type == H264_NAL_IDR;
+}
+
+bool IsRecoveryPoint(uint32_t codec, const uint8_t* nal, size_t size)
+{
+    constexpr uint32_t kRecoveryPoint = 6;
+    if (codec != NVICodec_AVC || nal == nullptr || size < 2 || NALType(codec, nal) != H264_NAL_SEI)
+    {
+        return false;
+    }
+    BitReader reader(nal + 1, size - 1);
+    // 逐个跳过SEI消息，末尾的rbsp_trailing_bits读出越界
+    while (true)
+    {
+        uint32_t uType = 0;
+        uint32_t uSize = 0;
+        uint32_t uByte = 0;
+        do
+        {
+            uByte = reader.Bits(8);
+            uType += uByte;
+        } while (uByte == 0xFF && !reader.Error());
+        do
+        {
+            uByte = reader.Bits(8);
+            uSize += uByte;
+        } while (uByte == 0xFF && !reader.Error());
+        if (reader.Error() || uSize > size)
+        {
+            return false;
+        }
+        if (uType == kRecoveryPoint)
+        {
+            return true;
+        }
+        reader.Skip(static_cast<int32_t>(uSize * 8));
+    }
+}
+
+bool IsVP9Keyframe(const uint8_t* data, size_t size)
+{
+    if (data == nullptr || size == 0 || (data[0] >> 6) != 2)
+    {
+        return false;
+    }
+    // frame_marker(2) profile_low_bit profile_high_bit [reserved_zero] show_existing_frame frame_type
+    const uint32_t uProfile = ((data[0] >> 5) & 1) | (((data[0] >> 4) & 1) << 1);
+    const int32_t nShift = uProfile == 3 ? 2 : 3;
+    const bool bShowExisting = (data[0] >> nShift) & 1;
+    const bool bKey = ((data[0] >> (nShift - 1)) & 1) == 0;
+    return !bShowExisting && bKey;
+}
+
+bool IsAV1Keyframe(const uint8_t* data, size_t size)
+{
+    constexpr uint8_t kSequenceHeader = 1;
+    constexpr uint8_t kFrameHeader = 3;
+    constexpr uint8_t kFrame = 6;
+    if (data == nullptr)
+    {
+        return false;
+    }
+    bool bReduced = false;
+    size_t szPos = 0;
+    while (szPos < size)
+    {
+        const uint8_t uHeader = data[szPos++];
+        const uint8_t uType = (uHeader >> 3) & 0x0F;
+        if (uHeader & 0x80)
+        {
+            return false;
+        }
+        if (uHeader & 0x04)
+        {
+            ++szPos;  // obu_extension_header
+        }
+        size_t szPayload = size > szPos ? size - szPos : 0;
+        if (uHeader & 0x02)
+        {
+            // leb128
+            uint64_t uSize = 0;
+            for (int32_t i = 0; i < 8; ++i)
+            {
+                if (szPos >= size)
+                {
+                    return false;
+                }
+                const uint8_t uByte = data[szPos++];
+                uSize |= static_cast<uint64_t>(uByte & 0x7F) << (i * 7);
+                if ((uByte & 0x80) == 0)
+                {
+                    break;
+                }
+            }
+            szPayload = static_cast<size_t>(uSize);
+        }
+        if (szPos > size || szPayload > size - szPos)
+        {
+            return false;
+        }
+        if (szPayload > 0)
+        {
+            const uint8_t uByte = data[szPos];
+            if (uType == kSequenceHeader)
+            {
+                // seq_profile(3) still_picture reduced_still_picture_header
+                bReduced = (uByte >> 3) & 1;
+            }
+            else if (uType == kFrameHeader || uType == kFrame)
+            {
+                if (bReduced)
+                {
+                    return true;
+                }
+                // show_existing_frame frame_type(2) show_frame，KEY_FRAME为0
+                return (uByte & 0x80) == 0 && ((uByte >> 5) & 3) == 0 && (uByte & 0x10) != 0;
+            }
+        }
+        szPos += szPayload;
+    }
+    return false;
+}
+
+namespace
+{
+// 判断边界需要的字节数：起始码和NAL的前三个字节
+constexpr size_t kHeader = 6;
+// 缓存的最小容量
+constexpr size_t kMinReserve = 64 * 1024;
+}  // namespace
+
+AccessUnitSplitter::AccessUnitSplitter(uint32_t codec)
+    : m_uCodec(codec)
+    , m_bVCL(false)
+    , m_bNoMemory(false)
+    , m_uAligned(0)
+    , m_pPending(nullptr)
+    , m_szPending(0)
+    , m_szReserve(kMinReserve)
+    , m_nPendingPts(kNoPts)
+    , m_szCarry(0)
+    , m_uDirect(0)
+    , m_uCopied(0)
+{
+}
+
+AccessUnitSplitter::~AccessUnitSplitter()
+{
+    av_buffer_unref(&m_pPending);
+}
+
+void AccessUnitSplitter::Reset(uint32_t codec)
+{
+    m_uCodec = codec;
+    m_bVCL = false;
+    m_uAligned = 0;
+    m_szPending = 0;
+    m_nPendingPts = kNoPts;
+    m_szCarry = 0;
+}
+
+bool AccessUnitSplitter::Push(const uint8_t* data, size_t size, int64_t pts, bool end, const Emit& emit)
+{
+    m_bNoMemory = false;
+    if (data == nullptr || size == 0)
+    {
+        if (end)
+        {
+            Flush(emit);
+        }
+        return true;
+    }
+    // 块首（可能是四字节起始码）是否开始新的访问单元；m_bVCL在本块的扫描之前不变，与循环中的判断一致
+    const uint8_t* pHead = data[0] == 0 && size > 1 && data[1] == 0 && size > 2 && data[2] == 0 ? data + 1 : data;
+    const bool bHead = pHead + kHeader <= data + size && pHead[0] == 0 && pHead[1] == 0 && pHead[2] == 1 && IsFirstInAccessUnit(m_uCodec, pHead + 3, m_bVCL);
+    m_uAligned = bHead ? m_uAligned + 1 : 0;
+    // 之前的块都在边界结束，本块也按完整的访问单元处理
+    const bool bAligned = !end && bHead && m_uAligned > kAlignedChunks;
+    // 本块中第一个开始的访问单元取pts
+    int64_t nChunkPts = pts;
+    int64_t nAUPts = m_szPending > 0 ? m_nPendingPts : TakePts(nChunkPts);
+    if (m_szPending > 0 && size < kHeader && !end)
+    {
+        // 太短，拼到缓存中判断
+        Append(data, size);
+        m_szCarry += size;
+        ScanCarry(nullptr, 0, nAUPts, nChunkPts, emit);
+        m_nPendingPts = nAUPts;
+        return !m_bNoMemory;
+    }
+    if (m_szCarry > 0)
+    {
+        ScanCarry(data, std::min(size, kHeader), nAUPts, nChunkPts, emit);
+        m_szCarry = 0;
+    }
+    const uint8_t* pEnd = data + size;
+    const uint8_t* pAU = data;
+    const uint8_t* pScan = data;
+    const uint8_t* pStart = pEnd;
+    while (true)
+    {
+        pStart = FindStartCode(pScan, pEnd);
+        if (pStart >= pEnd || pStart + kHeader > pEnd)
+        {
+            break;
+        }
+        if (Boundary(pStart + 3))
+        {
+            // 四字节起始码的前导0归入新的访问单元
+            const uint8_t* pCut = pStart > pAU && pStart[-1] == 0 ? pStart - 1 : pStart;
+            if (m_szPending > 0)
+            {
+                // 起始码在块首时前导0可能在缓存末尾
+                Append(pAU, static_cast<size_t>(pCut - pAU));
+                const bool bZero = pStart == pAU && m_szPending > 0 && m_pPending->data[m_szPending - 1] == 0;
+                EmitPending(m_szPending - (bZero ? 1 : 0), nAUPts, emit);
+                nAUPts = TakePts(nChunkPts);
+            }
+            else if (pCut > pAU)
+            {
+                m_uDirect += static_cast<uint64_t>(pCut - pAU);
+                emit(pAU, static_cast<size_t>(pCut - pAU), nAUPts, nullptr);
+                nAUPts = TakePts(nChunkPts);
+            }
+            pAU = pCut;
+        }
+        pScan = pStart + 3;
+    }
+    if (end || bAligned)
+    {
+        // 调用者保证或者预测在边界结束，剩余部分即为完整的访问单元
+        if (m_szPending > 0)
+        {
+            Append(pAU, static_cast<size_t>(pEnd - pAU));
+            EmitPending(m_szPending, nAUPts, emit);
+        }
+        else if (pEnd > pAU)
+        {
+            m_uDirect += static_cast<uint64_t>(pEnd - pAU);
+            emit(pAU, static_cast<size_t>(pEnd - pAU), nAUPts, nullptr);
+        }
+        // 预测的边界保留图像数据的状态，下一块不从边界开始时能够发现
+        m_bVCL = m_bVCL && bAligned;
+        m_nPendingPts = kNoPts;
+        return !m_bNoMemory;
+    }
+    // 没有判断完的起始码和末尾可能的半个起始码留到下一块
+    const uint8_t* pCarry = pStart < pEnd ? pStart : std::max(pScan, pEnd - 2);
+    Append(pAU, static_cast<size_t>(pEnd - pAU));
+    m_nPendingPts = nAUPts;
+    m_szCarry = std::min(static_cast<size_t>(pEnd - std::max(pCarry, pAU)), m_szPending);
+    return !m_bNoMemory;
+}
+
+int64_t AccessUnitSplitter::TakePts(int64_t& pts)
+{
+    const int64_t nPts = pts;
+    pts = kNoPts;
+    return nPts;
+}
+
+void AccessUnitSplitter::ScanCarry(const uint8_t* head, size_t size, int64_t& au_pts, int64_t& chunk_pts, const Emit& emit)
+{
+    // 缓存末尾的起始码可能跨到本块，拼接本块开头后只判断从缓存中开始的起始码
+    m_vecJoint.assign(m_pPending->data + m_szPending - m_szCarry, m_pPending->data + m_szPending);
+    if (head)
+    {
+        m_vecJoint.insert(m_vecJoint.end(), head, head + size);
+    }
+    const uint8_t* pJoint = m_vecJoint.data();
+    const uint8_t* pEnd = pJoint + m_vecJoint.size();
+    const size_t szBase = m_szPending - m_szCarry;
+    const size_t szCarry = m_szCarry;
+    size_t szEmitted = 0;
+    size_t szResolved = 0;
+    const uint8_t* pScan = pJoint;
+    while (true)
+    {
+        const uint8_t* pStart = FindStartCode(pScan, pEnd);
+        const size_t szOffset = static_cast<size_t>(pStart - pJoint);
+        if (pStart >= pEnd || szOffset >= szCarry)
+        {
+            // 没有更多从缓存中开始的起始码，末尾两个字节可能是半个起始码
+            szResolved = std::max(szResolved, szCarry > 2 ? szCarry - 2 : 0);
+            break;
+        }
+        if (pStart + kHeader > pEnd)
+        {
+            szResolved = szOffset;
+            break;
+        }
+        if (Boundary(pStart + 3))
+        {
+            // 边界之前的部分已经完整，剩下的是新访问单元的开头
+            size_t szCut = szBase + szOffset - szEmitted;
+            if (szCut > 0 && m_pPending->data[szCut - 1] == 0)
+            {
+                --szCut;
+            }
+            EmitPending(szCut, au_pts, emit);
+            au_pts = TakePts(chunk_pts);
+            szEmitted += szCut;
+            if (m_bNoMemory)
+            {
+                return;
+            }
+        }
+        pScan = pStart + 3;
+        szResolved = szOffset + 3;
+    }
+    m_szCarry = szCarry - std::min(szResolved, szCarry);
+}
+
+void AccessUnitSplitter::Flush(const Emit& emit)
+{
+    if (m_szPending > 0)
+    {
+        EmitPending(m_szPending, m_nPendingPts, emit);
+    }
+    m_bVCL = false;
+    m_szCarry = 0;
+    m_nPendingPts = kNoPts;
+}
+
+bool AccessUnitSplitter::Boundary(const uint8_t* nal)
+{
+    const bool bFirst = IsFirstInAccessUnit(m_uCodec, nal, m_bVCL);
+    if (bFirst)
+    {
+        m_bVCL = false;
+    }
+    if (IsSlice(m_uCodec, NALType(m_uCodec, nal)))
+    {
+        m_bVCL = true;
+    }
+    return bFirst;
+}
+
+bool AccessUnitSplitter::Reserve(size_t size)
+{
+    const size_t szNeed = m_szPending + size + AV_INPUT_BUFFER_PADDING_SIZE;
+    if (m_pPending && m_pPending->size >= szNeed)
+    {
+        return true;
+    }
+    // 缓冲没有被回调持有，av_buffer_realloc可以原地扩展；按倍数增长，减少访问单元跨多块时的重新分配
+    m_szReserve = std::max(szNeed, m_pPending ? m_pPending->size * 2 : m_szReserve);
+    if (av_buffer_realloc(&m_pPending, m_szReserve) < 0)
+    {
+        av_buffer_unref(&m_pPending);
+        m_szPending = 0;
+        m_szCarry = 0;
+        m_bNoMemory = true;
+        return false;
+    }
+    return true;
+}
+
+void AccessUnitSplitter::Append(const uint8_t* data, size_t size)
+{
+    if (size == 0 || !Reserve(size))
+    {
+        return;
+    }
+    memcpy(m_pPending->data + m_szPending, data, size);
+    m_szPending += size;
+    m_uCopied += size;
+}
+
+void AccessUnitSplitter::EmitPending(size_t size, int64_t pts, const Emit& emit)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    // 之后的字节是下一个访问单元的开头，补零前先取出
+    uint8_t* pData = m_pPending->data;
+    m_vecRest.assign(pData + size, pData + m_szPending);
+    memset(pData + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    emit(pData, size, pts, m_pPending);
+    if (!av_buffer_is_writable(m_pPending))
+    {
+        // 解码器持有了引用，之后写到新的缓冲中
+        av_buffer_unref(&m_pPending);
+    }
+    m_szPending = 0;
+    if (!m_vecRest.empty() && Reserve(m_vecRest.size()))
+    {
+        memcpy(m_pPending->data, m_vecRest.data(), m_vecRest.size());
+        m_szPending = m_vecRest.size();
+    }
+}
+}  // namespace bitstream
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+struct AVBufferRef;
+
+// Annex-B码流的NAL单元扫描
+namespace bitstream
+{
+enum H264NALType : uint8_t
+{
+    H264_NAL_SLICE = 1,
+    H264_NAL_IDR = 5,
+    H264_NAL_SEI = 6,
+    H264_NAL_SPS = 7,
+    H264_NAL_PPS = 8,
+    H264_NAL_AUD = 9,
+};
+
+enum HEVCNALType : uint8_t
+{
+    HEVC_NAL_BLA_W_LP = 16,
+    HEVC_NAL_IDR_W_RADL = 19,
+    HEVC_NAL_IDR_N_LP = 20,
+    HEVC_NAL_CRA = 21,
+    HEVC_NAL_VPS = 32,
+    HEVC_NAL_SPS = 33,
+    HEVC_NAL_PPS = 34,
+    HEVC_NAL_AUD = 35,
+    HEVC_NAL_SEI_PREFIX = 39,
+};
+
+// 返回[data, end)中第一个00 00 01起始码的位置，找不到返回end
+const uint8_t* FindStartCode(const uint8_t* data, const uint8_t* end);
+
+// 依次回调每个NAL单元（不含起始码）
+template <typename F>
+void ForEachNAL(const uint8_t* data, size_t size, F&& func)
+{
+    const uint8_t* end = data + size;
+    const uint8_t* p = FindStartCode(data, end);
+    while (p < end)
+    {
+        const uint8_t* nal = p + 3;
+        const uint8_t* next = FindStartCode(nal, end);
+        const uint8_t* tail = next;
+        // 四字节起始码的前导0属于下一个起始码
+        while (tail > nal && tail[-1] == 0 && next < end)
+        {
+            --tail;
+        }
+        if (tail > nal && !func(nal, static_cast<size_t>(tail - nal)))
+        {
+            break;
+        }
+        p = next;
+    }
+}
+
+// codec为NVICodec_AVC或NVICodec_HEVC
+uint8_t NALType(uint32_t codec, const uint8_t* nal);
+bool IsIDR(uint32_t codec, uint8_t type);
+bool IsParameterSet(uint32_t codec, uint8_t type);
+// 是否为图像数据（VCL）NAL
+bool IsSlice(uint32_t codec, uint8_t type);
+// 访问单元是否包含IDR图像
+bool HasIDR(uint32_t codec, const uint8_t* data, size_t size);
+// 可以独立开始解码的图像：IDR，HEVC还包括BLA和CRA（其前导图像不可解）
+bool IsRandomAccess(uint32_t codec, uint8_t type);
+// H264的SEI是否带恢复点，从该访问单元开始解码在恢复后输出正确的图像
+bool IsRecoveryPoint(uint32_t codec, const uint8_t* nal, size_t size);
+// VP9帧（或超帧中的第一帧）是否为关键帧，由未压缩头的前几位判断
+bool IsVP9Keyframe(const uint8_t* data, size_t size);
+// AV1时间单元（低开销OBU格式）是否包含显示的关键帧
+bool IsAV1Keyframe(const uint8_t* data, size_t size);
+// vcl为当前访问单元是否已有图像数据，返回该NAL是否开始新的访问单元；nal至少3字节
+bool IsFirstInAccessUnit(uint32_t codec, const uint8_t* nal, bool vcl);
+
+// 从SPS解析出的序列信息
+struct SequenceInfo
+{
+    uint32_t width;          // 裁剪后的显示尺寸
+    uint32_t height;
+    uint32_t coded_width;    // 解码缓冲的尺寸，H264按宏块对齐
+    uint32_t coded_height;
+    uint32_t chroma_format;  // 0单色，1为4:2:0，2为4:2:2，3为4:4:4
+    uint32_t bit_depth;      // 亮度位深
+    uint32_t dpb_size;       // 解码图像缓冲的帧数
+};
+// nal为不含起始码的SPS，size包含NAL头
+bool ParseSPS(uint32_t codec, const uint8_t* nal, size_t size, SequenceInfo& info);
+// 参数集自身的id（H264的sps_id/pps_id，HEVC的vps_id/sps_id/pps_id），解析失败返回-1
+int32_t ParameterSetId(uint32_t codec, const uint8_t* nal, size_t size);
+// 记录一个参数集，sets中每项带4字节起始码；类型和id相同的就地替换，其余按VPS、SPS、PPS的顺序插入
+void StoreParameterSet(uint32_t codec, std::vector<std::vector<uint8_t>>& sets, const uint8_t* nal, size_t size);
+
+// 把任意分块的Annex-B字节流切分为访问单元
+// 完整落在一块数据中的访问单元直接引用输入，跨块的访问单元拼接在带填充的引用计数缓冲中，解码器引用而不再拷贝
+// 连续多块都从访问单元边界开始时认为调用者按访问单元分块，不带end的块也在块尾切分，不再等下一块
+class AccessUnitSplitter final
+{
+public:
+    // 同AV_NOPTS_VALUE
+    static constexpr int64_t kNoPts = INT64_MIN;
+    // 连续这么多块从访问单元边界开始后按块切分；之后某块不在边界开始时恢复缓存，预测错的访问单元被拆成两个包
+    static constexpr uint32_t kAlignedChunks = 8;
+    // buffer为空时au引用输入，只在回调期间有效；非空时au位于buffer中，其后有AV_INPUT_BUFFER_PADDING_SIZE个0，
+    // 可用av_buffer_ref持有，缓冲被持有后不再写入
+    typedef std::function<void(const uint8_t* au, size_t size, int64_t pts, AVBufferRef* buffer)> Emit;
+
+public:
+    explicit AccessUnitSplitter(uint32_t codec = 0);
+    ~AccessUnitSplitter();
+    AccessUnitSplitter(const AccessUnitSplitter&) = delete;
+    AccessUnitSplitter& operator=(const AccessUnitSplitter&) = delete;
+    void Reset(uint32_t codec);
+    // pts属于第一个在这块数据中开始的访问单元，其后的为kNoPts
+    // end表示这块数据在访问单元边界结束；分配缓冲失败时丢弃缓存的部分并返回false
+    bool Push(const uint8_t* data, size_t size, int64_t pts, bool end, const Emit& emit);
+    // 输出缓存的最后一个访问单元
+    void Flush(const Emit& emit);
+    // 直接引用输入输出的字节数
+    uint64_t DirectBytes() const
+    {
+        return m_uDirect;
+    }
+    uint64_t CopiedBytes() const
+    {
+        return m_uCopied;
+    }
+
+private:
+    bool Boundary(const uint8_t* nal);
+    static int64_t TakePts(int64_t& pts);
+    // 判断缓存末尾m_szCarry字节中开始的起始码，head为紧随其后的本块数据
+    void ScanCarry(const uint8_t* head, size_t size, int64_t& au_pts, int64_t& chunk_pts, const Emit& emit);
+    // 保证缓存能再放下size字节和填充
+    bool Reserve(size_t size);
+    void Append(const uint8_t* data, size_t size);
+    void EmitPending(size_t size, int64_t pts, const Emit& emit);
+
+private:
+    uint32_t m_uCodec;
+    bool m_bVCL;
+    bool m_bNoMemory;
+    // 连续从访问单元边界开始的块数
+    uint32_t m_uAligned;
+    // 当前访问单元在之前数据块中的部分，size不含填充；被回调持有后换新的缓冲
+    AVBufferRef* m_pPending;
+    size_t m_szPending;
+    // 新缓冲的初始容量，沿用之前的最大值
+    size_t m_szReserve;
+    // 输出缓存时暂存其后属于下一个访问单元的字节
+    std::vector<uint8_t> m_vecRest;
+    int64_t m_nPendingPts;
+    // m_vecPending末尾还没有判断过起始码的字节数
+    size_t m_szCarry;
+    std::vector<uint8_t> m_vecJoint;
+    uint64_t m_uDirect;
+    uint64_t m_uCopied;
+};
+}  // namespace bitstream
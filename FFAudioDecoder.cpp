@@ -1,176 +1,337 @@
-﻿#include "FFAudioDecoder.h"
-#include "FFmpegWrapper.hpp"
-#include "adaption/Logging.h"
-#include <cstring>
-#include <fstream>
-
-using namespace ffmpeg;
-
-FFAudioDecoder::FFAudioDecoder()
-    : m_pDecoderContext(nullptr)
-    , m_pWaveBuffer(nullptr)
-    , m_szWaveBuffer(0)
-    , m_wave({})
-{
-}
-
-FFAudioDecoder::~FFAudioDecoder()
-{
-    Release();
-}
-
-bool FFAudioDecoder::Config(const NVIAudioCodecParam& param)
-{
-    Release();
-    auto pDecoder = avcodec_find_decoder(ToAVCodecID(param.codec));
-    if (pDecoder == nullptr)
-    {
-        return false;
-    }
-    m_pDecoderContext = avcodec_alloc_context3(pDecoder);
-    if (m_pDecoderContext)
-    {
-        if (m_pDecoderContext->codec)
-        {
-            LOG_NOTICE("FFAudioDecoder init {}, {}.", m_pDecoderContext->codec->name, m_pDecoderContext->codec->long_name);
-        }
-        int nOpen = avcodec_open2(m_pDecoderContext, nullptr, nullptr);
-        if (nOpen == 0)
-        {
-            return true;
-        }
-        else
-        {
-            LOG_ERROR("FFAudioDecoder avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
-            avcodec_free_context(&m_pDecoderContext);
-        }
-    }
-    return false;
-}
-
-bool FFAudioDecoder::Decoding(const NVIAudioEncodedPacket& packet, const Output& output)
-{
-    if (m_pDecoderContext == nullptr)
-    {
-        return false;
-    }
-    if (avcodec_is_open(m_pDecoderContext))
-    {
-        auto pPacket(AllocAVPacket());
-        if (pPacket == nullptr)
-        {
-            return false;
-        }
-        pPacket->data = (uint8_t*)packet.buffer.bytes;
-        pPacket->size = (int)packet.buffer.size;
-        pPacket->pts = packet.info.tick.value;
-        pPacket->dts = pPacket->pts;
-        int nSend = avcodec_send_packet(m_pDecoderContext, pPacket.get());
-        if (nSend == 0)
-        {
-            int nRecv = 0;
-            uint32_t uOut = 0U;
-            while (nRecv >= 0)
-            {
-                auto pFrame = AllocAVFrame();
-                if (pFrame == nullptr)
-                {
-                    LOG_ERROR("av_frame_alloc failed!");
-                    return false;
-                }
-                nRecv = avcodec_receive_frame(m_pDecoderContext, pFrame.get());
-                if (nRecv >= 0)
-                {
-                    if (output)
-                    {
-                        const size_t szBytesPerSample = static_cast<size_t>(av_get_bytes_per_sample(m_pDecoderContext->sample_fmt));
-                        const size_t szFrameBuffer = static_cast<size_t>(
-                            av_samples_get_buffer_size(nullptr, pFrame->ch_layout.nb_channels, pFrame->nb_samples, m_pDecoderContext->sample_fmt, 0));
-                        if (uOut == 0u)
-                        {
-                            m_wave.info = packet.info;
-                            m_wave.info.tick.value = pFrame->pts;
-                            m_wave.info.sample_rate = static_cast<uint32_t>(pFrame->sample_rate);
-                            m_wave.info.depth = static_cast<uint16_t>(szBytesPerSample << 3);
-                            m_wave.info.channels = static_cast<uint16_t>(pFrame->ch_layout.nb_channels);
-                            m_wave.buffer.align =
-                                static_cast<uint16_t>(szFrameBuffer / pFrame->ch_layout.nb_channels / pFrame->nb_samples);  // bytes per sample
-                        }
-                        m_wave.buffer.samples += static_cast<uint16_t>(pFrame->nb_samples);
-                        const size_t szWaveBuffer = m_wave.buffer.size + szFrameBuffer;
-                        if (m_pWaveBuffer == nullptr || m_szWaveBuffer < szWaveBuffer)
-                        {
-                            uint8_t* pSwapBuffer = new uint8_t[szWaveBuffer];
-                            if (m_pWaveBuffer && m_wave.buffer.size > 0)
-                            {
-                                memcpy(pSwapBuffer, m_wave.buffer.data, m_wave.buffer.size);
-                            }
-                            m_pWaveBuffer.reset(pSwapBuffer);
-                            m_szWaveBuffer = szWaveBuffer;
-                            m_wave.buffer.data = m_pWaveBuffer.get();
-                        }
-                        uint8_t* pBuffer = m_pWaveBuffer.get() + m_wave.buffer.size;
-                        if (av_sample_fmt_is_planar(m_pDecoderContext->sample_fmt) == 1)
-                        {
-                            const size_t szBytesPerBlock = static_cast<size_t>(m_wave.buffer.align) * m_wave.info.channels;
-                            for (int i = 0; i < pFrame->ch_layout.nb_channels; ++i)
-                            {
-                                const uint8_t* pPlane = pFrame->data[i];
-                                if (pPlane == nullptr)
-                                {
-                                    LOG_ERROR("FFAudioDecoder audio wave buffer plane{} is null.", i);
-                                    return false;
-                                }
-                                const size_t szOffsetOfChannel = static_cast<size_t>(i) * m_wave.buffer.align;
-                                for (int j = 0; j < pFrame->nb_samples; ++j)
-                                {
-                                    memcpy(pBuffer + (szBytesPerBlock * j + szOffsetOfChannel), pPlane, szBytesPerSample);
-                                    pPlane += m_wave.buffer.align;
-                                }
-                            }
-                        }
-                        else
-                        {
-                            memcpy(pBuffer, pFrame->data[0], szFrameBuffer);
-                        }
-                        m_wave.buffer.size += szFrameBuffer;
-                        ++uOut;
-                    }
-                }
-                else
-                {
-                    if (uOut > 0u)
-                    {
-                        output(&m_wave);
-                        m_wave.buffer.size = 0;
-                        m_wave.buffer.samples = 0;
-                    }
-                    if (nRecv == AVERROR(EAGAIN))
-                    {
-                        break;
-                    }
-                    else
-                    {
-                        LOG_ERROR("FFAudioDecoder avcodec_receive_frame failed {}, {}.", nRecv, av_errstr(nRecv));
-                        return false;
-                    }
-                }
-            }
-        }
-        else
-        {
-            LOG_ERROR("FFAudioDecoder avcodec_send_packet failed {}, {}.", nSend, av_errstr(nSend));
-            return false;
-        }
-        return true;
-    }
-    return false;
-}
-
-void FFAudioDecoder::Release()
-{
-    if (m_pDecoderContext)
-    {
-        avcodec_free_context(&m_pDecoderContext);
-    }
-}
+#include "FFAudioDecoder.h"
+#include "FFmpegWrapper.hpp"
+#include "FFmpegCodecPlugin.h"
+#include "adaption/Logging.h"
+#include "adaption/Tracing.h"
+#include "adaption/Probes.h"
+#include "FFmpegG711.h"
+#include <cstring>
+#include <fstream>
+
+using namespace ffmpeg;
+
+FFAudioDecoder::FFAudioDecoder()
+    : m_uId(NextDecoderId())
+    , m_pDecoderContext(nullptr)
+    , m_pWaveBuffer(nullptr)
+    , m_szWaveBuffer(0)
+    , m_wave({})
+    , m_uCodec(0)
+{
+}
+
+FFAudioDecoder::~FFAudioDecoder()
+{
+    AllocStats::Scope scope(m_pAllocStats.get());
+    Release();
+    if (m_pWaveBuffer && m_pAllocStats)
+    {
+        m_pAllocStats->Free(m_szWaveBuffer);
+    }
+    MemoryBudget::Instance().Uncharge(m_szWaveBuffer);
+}
+
+bool FFAudioDecoder::Config(const NVIAudioCodecParam& param)
+{
+    if (m_pAllocStats == nullptr && AllocStats::Enabled())
+    {
+        m_pAllocStats = std::make_shared<AllocStats>();
+    }
+    AllocStats::Scope scope(m_pAllocStats.get());
+    Release();
+    m_uCodec = param.codec;
+    if (IsDirect(param.codec))
+    {
+        if (m_options.sample_rate <= 0 || m_options.channels <= 0 || m_options.channels > Options::kMaxChannels)
+        {
+            LOG_ERROR("FFAudioDecoder invalid sample rate {} or channels {}.", m_options.sample_rate, m_options.channels);
+            return false;
+        }
+        LOG_NOTICE("FFAudioDecoder init direct codec {:#x}, {}Hz, {} channels.", param.codec, m_options.sample_rate, m_options.channels);
+        return true;
+    }
+    auto pDecoder = avcodec_find_decoder(ToAVCodecID(param.codec));
+    if (pDecoder == nullptr)
+    {
+        return false;
+    }
+    m_pDecoderContext = avcodec_alloc_context3(pDecoder);
+    if (m_pDecoderContext)
+    {
+        if (m_pDecoderContext->codec)
+        {
+            LOG_NOTICE("FFAudioDecoder init {}, {}.", m_pDecoderContext->codec->name, m_pDecoderContext->codec->long_name);
+        }
+        int nOpen = avcodec_open2(m_pDecoderContext, nullptr, nullptr);
+        if (nOpen == 0)
+        {
+            return true;
+        }
+        else
+        {
+            LOG_ERROR("FFAudioDecoder avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+            avcodec_free_context(&m_pDecoderContext);
+        }
+    }
+    return false;
+}
+
+bool FFAudioDecoder::Decoding(const NVIAudioEncodedPacket& packet, const Output& output)
+{
+    if (IsDirect(m_uCodec))
+    {
+        return DecodingDirect(packet, output);
+    }
+    if (m_pDecoderContext == nullptr)
+    {
+        return false;
+    }
+    AllocStats::Scope scope(m_pAllocStats.get());
+    if (avcodec_is_open(m_pDecoderContext))
+    {
+        auto pPacket(AllocAVPacket());
+        if (pPacket == nullptr)
+        {
+            return false;
+        }
+        pPacket->data = (uint8_t*)packet.buffer.bytes;
+        pPacket->size = (int)packet.buffer.size;
+        pPacket->pts = packet.info.tick.value;
+        pPacket->dts = pPacket->pts;
+        int nSend = 0;
+        PROBE3(audio_packet_submit, m_uId, pPacket->pts, pPacket->size);
+        {
+            TRACE_SCOPE("avcodec_send_packet", m_uId, pPacket->pts);
+            nSend = avcodec_send_packet(m_pDecoderContext, pPacket.get());
+        }
+        if (nSend == 0)
+        {
+            int nRecv = 0;
+            uint32_t uOut = 0U;
+            while (nRecv >= 0)
+            {
+                auto pFrame = AllocAVFrame();
+                if (pFrame == nullptr)
+                {
+                    LOG_ERROR("av_frame_alloc failed!");
+                    return false;
+                }
+                {
+                    TRACE_SCOPE("avcodec_receive_frame", m_uId, pPacket->pts);
+                    nRecv = avcodec_receive_frame(m_pDecoderContext, pFrame.get());
+                }
+                if (nRecv >= 0)
+                {
+                    PROBE3(audio_frame_ready, m_uId, pFrame->pts, pFrame->nb_samples);
+                    if (output)
+                    {
+                        TRACE_SCOPE("convert", m_uId, pFrame->pts);
+                        const size_t szBytesPerSample = static_cast<size_t>(av_get_bytes_per_sample(m_pDecoderContext->sample_fmt));
+                        const size_t szFrameBuffer = static_cast<size_t>(
+                            av_samples_get_buffer_size(nullptr, pFrame->ch_layout.nb_channels, pFrame->nb_samples, m_pDecoderContext->sample_fmt, 0));
+                        if (uOut == 0u)
+                        {
+                            m_wave.info = packet.info;
+                            m_wave.info.tick.value = pFrame->pts;
+                            m_wave.info.sample_rate = static_cast<uint32_t>(pFrame->sample_rate);
+                            m_wave.info.depth = static_cast<uint16_t>(szBytesPerSample << 3);
+                            m_wave.info.channels = static_cast<uint16_t>(pFrame->ch_layout.nb_channels);
+                            m_wave.buffer.align =
+                                static_cast<uint16_t>(szFrameBuffer / pFrame->ch_layout.nb_channels / pFrame->nb_samples);  // bytes per sample
+                        }
+                        m_wave.buffer.samples += static_cast<uint16_t>(pFrame->nb_samples);
+                        ReserveWave(szFrameBuffer);
+                        uint8_t* pBuffer = m_pWaveBuffer.get() + m_wave.buffer.size;
+                        if (av_sample_fmt_is_planar(m_pDecoderContext->sample_fmt) == 1)
+                        {
+                            const size_t szBytesPerBlock = static_cast<size_t>(m_wave.buffer.align) * m_wave.info.channels;
+                            for (int i = 0; i < pFrame->ch_layout.nb_channels; ++i)
+                            {
+                                const uint8_t* pPlane = pFrame->data[i];
+                                if (pPlane == nullptr)
+                                {
+                                    LOG_ERROR("FFAudioDecoder audio wave buffer plane{} is null.", i);
+                                    return false;
+                                }
+                                const size_t szOffsetOfChannel = static_cast<size_t>(i) * m_wave.buffer.align;
+                                for (int j = 0; j < pFrame->nb_samples; ++j)
+                                {
+                                    memcpy(pBuffer + (szBytesPerBlock * j + szOffsetOfChannel), pPlane, szBytesPerSample);
+                                    pPlane += m_wave.buffer.align;
+                                }
+                            }
+                        }
+                        else
+                        {
+                            memcpy(pBuffer, pFrame->data[0], szFrameBuffer);
+                        }
+                        m_wave.buffer.size += szFrameBuffer;
+                        ++uOut;
+                    }
+                }
+                else
+                {
+                    if (uOut > 0u)
+                    {
+                        TRACE_SCOPE("output", m_uId, m_wave.info.tick.value);
+                        PROBE3(audio_callback, m_uId, m_wave.info.tick.value, m_wave.buffer.size);
+                        int32_t nOutput = output(&m_wave);
+                        PROBE3(audio_callback_return, m_uId, m_wave.info.tick.value, nOutput);
+                        (void)nOutput;
+                        m_wave.buffer.size = 0;
+                        m_wave.buffer.samples = 0;
+                    }
+                    if (nRecv == AVERROR(EAGAIN))
+                    {
+                        break;
+                    }
+                    else
+                    {
+                        LOG_ERROR("FFAudioDecoder avcodec_receive_frame failed {}, {}.", nRecv, av_errstr(nRecv));
+                        return false;
+                    }
+                }
+            }
+        }
+        else
+        {
+            LOG_ERROR("FFAudioDecoder avcodec_send_packet failed {}, {}.", nSend, av_errstr(nSend));
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool FFAudioDecoder::SetOption(const char* name, int64_t value)
+{
+    if (name == nullptr)
+    {
+        return false;
+    }
+    if (strcmp(name, "sample_rate") == 0)
+    {
+        if (value <= 0 || value > INT32_MAX)
+        {
+            LOG_ERROR("FFAudioDecoder invalid sample rate {}.", value);
+            return false;
+        }
+        m_options.sample_rate = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "channels") == 0)
+    {
+        if (value <= 0 || value > Options::kMaxChannels)
+        {
+            LOG_ERROR("FFAudioDecoder invalid channels {}, supported 1-{}.", value, Options::kMaxChannels);
+            return false;
+        }
+        m_options.channels = static_cast<int32_t>(value);
+        return true;
+    }
+    return false;
+}
+
+bool FFAudioDecoder::IsDirect(uint32_t codec)
+{
+    return codec == FF_CODEC_PCMA || codec == FF_CODEC_PCMU || codec == FF_CODEC_PCM_S16LE;
+}
+
+bool FFAudioDecoder::DecodingDirect(const NVIAudioEncodedPacket& packet, const Output& output)
+{
+    const uint8_t* pData = static_cast<const uint8_t*>(packet.buffer.bytes);
+    const size_t szChannels = static_cast<size_t>(m_options.channels);
+    const size_t szBlock = szChannels * (m_uCodec == FF_CODEC_PCM_S16LE ? 2 : 1);
+    if (pData == nullptr || packet.buffer.size < szBlock)
+    {
+        return packet.buffer.size == 0;
+    }
+    const size_t szSamples = packet.buffer.size / szBlock;
+    if (szSamples > UINT16_MAX)
+    {
+        LOG_ERROR("FFAudioDecoder packet of {} samples too large.", szSamples);
+        return false;
+    }
+    PROBE3(audio_packet_submit, m_uId, packet.info.tick.value, packet.buffer.size);
+    if (!output)
+    {
+        return true;
+    }
+    AllocStats::Scope scope(m_pAllocStats.get());
+    m_wave.info = packet.info;
+    m_wave.info.sample_rate = static_cast<uint32_t>(m_options.sample_rate);
+    m_wave.info.depth = 16;
+    m_wave.info.channels = static_cast<uint16_t>(m_options.channels);
+    m_wave.buffer.align = 2;
+    m_wave.buffer.samples = static_cast<uint16_t>(szSamples);
+    const size_t szWave = szSamples * szChannels * 2;
+    if (m_uCodec == FF_CODEC_PCM_S16LE)
+    {
+        // 与输出格式相同，直接引用包数据
+        m_wave.buffer.data = const_cast<uint8_t*>(pData);
+    }
+    else
+    {
+        TRACE_SCOPE("convert", m_uId, packet.info.tick.value);
+        m_wave.buffer.size = 0;
+        ReserveWave(szWave);
+        m_wave.buffer.data = m_pWaveBuffer.get();
+        int16_t* pOut = reinterpret_cast<int16_t*>(m_wave.buffer.data);
+        if (m_uCodec == FF_CODEC_PCMA)
+        {
+            ALawToLinear(pData, szSamples * szChannels, pOut);
+        }
+        else
+        {
+            MuLawToLinear(pData, szSamples * szChannels, pOut);
+        }
+    }
+    m_wave.buffer.size = szWave;
+    PROBE3(audio_frame_ready, m_uId, m_wave.info.tick.value, szSamples);
+    {
+        TRACE_SCOPE("output", m_uId, m_wave.info.tick.value);
+        PROBE3(audio_callback, m_uId, m_wave.info.tick.value, m_wave.buffer.size);
+        int32_t nOutput = output(&m_wave);
+        PROBE3(audio_callback_return, m_uId, m_wave.info.tick.value, nOutput);
+        (void)nOutput;
+    }
+    m_wave.buffer.data = m_pWaveBuffer.get();
+    m_wave.buffer.size = 0;
+    m_wave.buffer.samples = 0;
+    return true;
+}
+
+void FFAudioDecoder::ReserveWave(size_t size)
+{
+    const size_t szWaveBuffer = m_wave.buffer.size + size;
+    if (m_pWaveBuffer && m_szWaveBuffer >= szWaveBuffer)
+    {
+        return;
+    }
+    uint8_t* pSwapBuffer = new uint8_t[szWaveBuffer];
+    MemoryBudget::Instance().Uncharge(m_szWaveBuffer);
+    MemoryBudget::Instance().Charge(szWaveBuffer, false);
+    if (m_pAllocStats)
+    {
+        if (m_pWaveBuffer)
+        {
+            m_pAllocStats->Free(m_szWaveBuffer);
+        }
+        m_pAllocStats->Alloc(szWaveBuffer);
+    }
+    if (m_pWaveBuffer && m_wave.buffer.size > 0)
+    {
+        memcpy(pSwapBuffer, m_wave.buffer.data, m_wave.buffer.size);
+    }
+    m_pWaveBuffer.reset(pSwapBuffer);
+    m_szWaveBuffer = szWaveBuffer;
+    m_wave.buffer.data = m_pWaveBuffer.get();
+}
+
+void FFAudioDecoder::Release()
+{
+    if (m_pDecoderContext)
+    {
+        avcodec_free_context(&m_pDecoderContext);
+    }
+}
@@ -1,30 +1,61 @@
-﻿#pragma once
-
-#include <memory>
-#include <functional>
-#include <NVI/Codec.h>
-
-struct AVCodecContext;
-
-class FFAudioDecoder final
-{
-public:
-    typedef std::function<int32_t(const NVIAudioWaveFrame* wave)> Output;
-
-public:
-    FFAudioDecoder();
-    virtual ~FFAudioDecoder();
-
-public:
-    bool Config(const NVIAudioCodecParam& param);
-    bool Decoding(const NVIAudioEncodedPacket& packet, const Output& output);
-
-private:
-    void Release();
-
-private:
-    AVCodecContext* m_pDecoderContext;
-    std::unique_ptr<uint8_t[]> m_pWaveBuffer;
-    size_t m_szWaveBuffer;
-    NVIAudioWaveFrame m_wave;
-};
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <NVI/Codec.h>
+
+struct AVCodecContext;
+namespace ffmpeg
+{
+class AllocStats;
+}  // namespace ffmpeg
+
+class FFAudioDecoder final
+{
+public:
+    typedef std::function<int32_t(const NVIAudioWaveFrame* wave)> Output;
+
+public:
+    FFAudioDecoder();
+    virtual ~FFAudioDecoder();
+
+public:
+    bool Config(const NVIAudioCodecParam& param);
+    bool Decoding(const NVIAudioEncodedPacket& packet, const Output& output);
+    // 选项在Config时生效，名称及取值见FFmpegCodecPlugin.h
+    bool SetOption(const char* name, int64_t value);
+    uint32_t Id() const
+    {
+        return m_uId;
+    }
+    const std::shared_ptr<ffmpeg::AllocStats>& Stats() const
+    {
+        return m_pAllocStats;
+    }
+
+private:
+    struct Options
+    {
+        static constexpr int32_t kMaxChannels = 64;
+        int32_t sample_rate = 8000;  // G.711和PCM的采样率
+        int32_t channels = 1;        // G.711和PCM的声道数
+    };
+
+private:
+    // G.711和PCM不经过libavcodec
+    static bool IsDirect(uint32_t codec);
+    bool DecodingDirect(const NVIAudioEncodedPacket& packet, const Output& output);
+    // 保证输出缓冲在已有数据之后还能容纳size字节
+    void ReserveWave(size_t size);
+    void Release();
+
+private:
+    const uint32_t m_uId;
+    AVCodecContext* m_pDecoderContext;
+    std::unique_ptr<uint8_t[]> m_pWaveBuffer;
+    size_t m_szWaveBuffer;
+    NVIAudioWaveFrame m_wave;
+    std::shared_ptr<ffmpeg::AllocStats> m_pAllocStats;
+    uint32_t m_uCodec;
+    Options m_options;
+};
@@ -0,0 +1,465 @@
+#include "FFBatchDecoder.h"
+#include "FFmpegWrapper.hpp"
+#include "Bitstream.h"
+#include "adaption/Logging.h"
+#include <thread>
+#include <cstring>
+#include <algorithm>
+
+using namespace ffmpeg;
+
+// 裸流的每次输入长度
+#define BATCH_PARSE_CHUNK (1 << 20)
+
+namespace
+{
+std::vector<uint8_t> JoinParameterSets(const std::vector<std::vector<uint8_t>>& sets)
+{
+    std::vector<uint8_t> vecJoined;
+    for (const auto& vecNAL : sets)
+    {
+        vecJoined.insert(vecJoined.end(), vecNAL.begin(), vecNAL.end());
+    }
+    return vecJoined;
+}
+}  // namespace
+
+FFBatchDecoder::FFBatchDecoder()
+    : m_uCodec(0)
+    , m_pStream(nullptr)
+    , m_szStream(0)
+    , m_szNextSegment(0)
+    , m_szScan(0)
+    , m_uEmitSegment(0)
+    , m_nEmitted(0)
+    , m_bFailed(false)
+{
+}
+
+FFBatchDecoder::~FFBatchDecoder()
+{
+}
+
+bool FFBatchDecoder::Config(uint32_t codec, const Options& options)
+{
+    if (codec != NVICodec_AVC && codec != NVICodec_HEVC)
+    {
+        return false;
+    }
+    if (avcodec_find_decoder(ToAVCodecID(codec)) == nullptr)
+    {
+        return false;
+    }
+    m_uCodec = codec;
+    m_options = options;
+    if (m_options.workers == 0)
+    {
+        m_options.workers = static_cast<uint32_t>(std::max(av_cpu_count(), 1));
+    }
+    if (m_options.max_segments == 0)
+    {
+        m_options.max_segments = m_options.workers * 2;
+    }
+    // 在途段数小于线程数时，多出的线程只会等待
+    m_options.workers = std::min(m_options.workers, m_options.max_segments);
+    if (m_options.max_frames == 0)
+    {
+        m_options.max_frames = 1;
+    }
+    if (m_options.threads == 0)
+    {
+        m_options.threads = 1;
+    }
+    return true;
+}
+
+bool FFBatchDecoder::Decoding(const NVIVideoEncodedPacket* packets, size_t count, const Output& output)
+{
+    if (m_uCodec == 0 || packets == nullptr)
+    {
+        return false;
+    }
+    m_vecUnits.clear();
+    m_vecUnits.reserve(count);
+    m_vecParams.clear();
+    m_deqSegments.clear();
+    size_t szSkipped = 0;
+    std::vector<std::pair<const uint8_t*, size_t>> vecSets;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t* pData = reinterpret_cast<const uint8_t*>(packets[i].buffer.bytes);
+        m_vecUnits.push_back({pData, packets[i].buffer.size, packets[i].info.tick.value, &packets[i].info});
+        bool bIDR = false;
+        vecSets.clear();
+        bitstream::ForEachNAL(pData, packets[i].buffer.size,
+                              [this, &bIDR, &vecSets](const uint8_t* nal, size_t length) -> bool
+                              {
+                                  // 参数集在图像数据之前，第一个片决定是否为IDR
+                                  const uint8_t type = bitstream::NALType(m_uCodec, nal);
+                                  if (bitstream::IsSlice(m_uCodec, type))
+                                  {
+                                      bIDR = bitstream::IsIDR(m_uCodec, type);
+                                      return false;
+                                  }
+                                  if (bitstream::IsParameterSet(m_uCodec, type))
+                                  {
+                                      vecSets.emplace_back(nal, length);
+                                  }
+                                  return true;
+                              });
+        // 包已在内存中，只记录下标和此前的参数集
+        if (bIDR)
+        {
+            if (!m_deqSegments.empty())
+            {
+                m_deqSegments.back().end = i;
+            }
+            m_deqSegments.push_back(Segment{i, count, JoinParameterSets(m_vecParams), {}});
+        }
+        else if (m_deqSegments.empty())
+        {
+            ++szSkipped;
+        }
+        for (const auto& set : vecSets)
+        {
+            bitstream::StoreParameterSet(m_uCodec, m_vecParams, set.first, set.second);
+        }
+    }
+    if (szSkipped > 0)
+    {
+        LOG_WARNING("FFBatchDecoder skip {} packets before the first IDR.", szSkipped);
+    }
+    m_pStream = nullptr;
+    m_szStream = 0;
+    const bool bResult = m_deqSegments.empty() ? szSkipped == 0 : Run(output);
+    m_vecUnits.clear();
+    m_deqSegments.clear();
+    return bResult;
+}
+
+bool FFBatchDecoder::Decoding(const uint8_t* stream, size_t size, const Output& output)
+{
+    if (m_uCodec == 0 || stream == nullptr)
+    {
+        return false;
+    }
+    m_vecUnits.clear();
+    m_vecParams.clear();
+    m_deqSegments.clear();
+    m_pStream = stream;
+    m_szStream = size;
+    m_szScan = FindIDR(0, false);
+    if (m_szScan > 0)
+    {
+        LOG_WARNING("FFBatchDecoder skip {} bytes before the first IDR.", m_szScan);
+    }
+    const bool bResult = m_szScan >= size ? size == 0 : Run(output);
+    m_pStream = nullptr;
+    m_szStream = 0;
+    m_deqSegments.clear();
+    return bResult;
+}
+
+bool FFBatchDecoder::Run(const Output& output)
+{
+    m_szNextSegment = 0;
+    m_uEmitSegment = 0;
+    m_nEmitted = 0;
+    m_bFailed = false;
+    // 裸流的段数事先未知，按线程数启动
+    const size_t szWorkers = m_pStream ? m_options.workers : std::min<size_t>(m_options.workers, m_deqSegments.size());
+    std::vector<std::thread> vecWorkers;
+    vecWorkers.reserve(szWorkers);
+    for (size_t i = 0; i < szWorkers; ++i)
+    {
+        vecWorkers.emplace_back(&FFBatchDecoder::Work, this, std::cref(output));
+    }
+    for (auto& worker : vecWorkers)
+    {
+        worker.join();
+    }
+    return !m_bFailed;
+}
+
+bool FFBatchDecoder::Claim(size_t& index, Segment*& segment)
+{
+    std::lock_guard<std::mutex> lock(m_mtxScan);
+    if (m_pStream)
+    {
+        if (m_szScan >= m_szStream)
+        {
+            return false;
+        }
+        // deque追加不移动已有的段，其他线程持有的引用仍然有效
+        // 参数集取切分到段首时的，之后扫描本段再更新
+        std::vector<uint8_t> vecParams = JoinParameterSets(m_vecParams);
+        const size_t szEnd = FindIDR(m_szScan, true);
+        m_deqSegments.push_back(Segment{m_szScan, szEnd, std::move(vecParams), {}});
+        m_szScan = szEnd;
+    }
+    if (m_szNextSegment >= m_deqSegments.size())
+    {
+        return false;
+    }
+    index = m_szNextSegment++;
+    segment = &m_deqSegments[index];
+    return true;
+}
+
+size_t FFBatchDecoder::FindIDR(size_t from, bool skip)
+{
+    const uint8_t* pBegin = m_pStream + from;
+    size_t szFound = m_szStream;
+    size_t szUnit = from;
+    bool bVCL = false;
+    bitstream::ForEachNAL(pBegin, m_szStream - from,
+                          [&](const uint8_t* nal, size_t length) -> bool
+                          {
+                              if (length < 3)
+                              {
+                                  return true;
+                              }
+                              // 访问单元从第一个NAL的起始码开始，包括四字节起始码的前导0
+                              const uint8_t* pStart = nal - 3;
+                              if (pStart > pBegin && pStart[-1] == 0)
+                              {
+                                  --pStart;
+                              }
+                              if (bitstream::IsFirstInAccessUnit(m_uCodec, nal, bVCL))
+                              {
+                                  bVCL = false;
+                                  szUnit = static_cast<size_t>(pStart - m_pStream);
+                              }
+                              const uint8_t type = bitstream::NALType(m_uCodec, nal);
+                              if (bitstream::IsSlice(m_uCodec, type))
+                              {
+                                  bVCL = true;
+                                  if (bitstream::IsIDR(m_uCodec, type) && !(skip && szUnit == from))
+                                  {
+                                      szFound = szUnit;
+                                      return false;
+                                  }
+                              }
+                              else if (bitstream::IsParameterSet(m_uCodec, type))
+                              {
+                                  bitstream::StoreParameterSet(m_uCodec, m_vecParams, nal, length);
+                              }
+                              return true;
+                          });
+    return szFound;
+}
+
+void FFBatchDecoder::Work(const Output& output)
+{
+    static const NVIImageInfo s_info{};
+    AVCodecContext* pContext = nullptr;
+    auto pPacket = AllocAVPacket();
+    size_t uIndex = 0;
+    Segment* pSegment = nullptr;
+    while (pPacket && Claim(uIndex, pSegment))
+    {
+        {
+            // 限制在途段数，从而限制缓存的解码帧
+            std::unique_lock<std::mutex> lock(m_mtxSegments);
+            m_cvSegments.wait(lock, [this, uIndex]() { return uIndex < m_uEmitSegment + m_options.max_segments; });
+        }
+        Segment& segment = *pSegment;
+        const NVIImageInfo& info = !m_pStream && m_vecUnits[segment.begin].info ? *m_vecUnits[segment.begin].info : s_info;
+        if (pContext == nullptr)
+        {
+            pContext = avcodec_alloc_context3(avcodec_find_decoder(ToAVCodecID(m_uCodec)));
+            if (pContext)
+            {
+                pContext->thread_count = static_cast<int>(m_options.threads);
+                int nOpen = avcodec_open2(pContext, nullptr, nullptr);
+                if (nOpen != 0)
+                {
+                    LOG_ERROR("FFBatchDecoder avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+                    avcodec_free_context(&pContext);
+                }
+            }
+        }
+        if (pContext == nullptr)
+        {
+            Fail();
+        }
+        else
+        {
+            if (m_pStream)
+            {
+                DecodeStream(pContext, pPacket.get(), uIndex, segment, info, output);
+            }
+            else
+            {
+                for (size_t i = segment.begin; i < segment.end; ++i)
+                {
+                    pPacket->data = const_cast<uint8_t*>(m_vecUnits[i].data);
+                    pPacket->size = static_cast<int>(m_vecUnits[i].size);
+                    pPacket->pts = m_vecUnits[i].pts;
+                    pPacket->dts = pPacket->pts;
+                    Send(pContext, pPacket.get(), i == segment.begin, uIndex, segment, info, output);
+                }
+            }
+            // 最后发送空包，取出解码器中剩余的帧
+            pPacket->data = nullptr;
+            pPacket->size = 0;
+            pPacket->pts = AV_NOPTS_VALUE;
+            pPacket->dts = AV_NOPTS_VALUE;
+            Send(pContext, pPacket.get(), false, uIndex, segment, info, output);
+            avcodec_flush_buffers(pContext);
+        }
+        Finish(uIndex, segment, info, output);
+    }
+    avcodec_free_context(&pContext);
+}
+
+void FFBatchDecoder::DecodeStream(AVCodecContext* ctx, AVPacket* packet, size_t index, Segment& segment, const NVIImageInfo& info, const Output& output)
+{
+    // 每段一个解析器，解析出的访问单元指向解析器内部缓冲，立即送入解码器
+    std::unique_ptr<AVCodecParserContext, void (*)(AVCodecParserContext*)> pParser(av_parser_init(ToAVCodecID(m_uCodec)), &av_parser_close);
+    if (pParser == nullptr)
+    {
+        Fail();
+        return;
+    }
+    const uint8_t* pData = m_pStream + segment.begin;
+    size_t szRemain = segment.end - segment.begin;
+    bool bFirst = true;
+    while (true)
+    {
+        // 数据输入完后再以空输入调用一次，取出解析器中的最后一个访问单元
+        const int nInput = static_cast<int>(std::min<size_t>(szRemain, BATCH_PARSE_CHUNK));
+        uint8_t* pOut = nullptr;
+        int nOut = 0;
+        int nUsed = av_parser_parse2(pParser.get(), ctx, &pOut, &nOut, nInput > 0 ? pData : nullptr, nInput, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (nUsed < 0)
+        {
+            LOG_ERROR("FFBatchDecoder av_parser_parse2 failed {}, {}.", nUsed, av_errstr(nUsed));
+            Fail();
+            break;
+        }
+        pData += nUsed;
+        szRemain -= static_cast<size_t>(nUsed);
+        if (nOut > 0)
+        {
+            packet->data = pOut;
+            packet->size = nOut;
+            packet->pts = AV_NOPTS_VALUE;
+            packet->dts = AV_NOPTS_VALUE;
+            Send(ctx, packet, bFirst, index, segment, info, output);
+            bFirst = false;
+        }
+        if (nInput == 0)
+        {
+            break;
+        }
+    }
+}
+
+void FFBatchDecoder::Send(AVCodecContext* ctx, AVPacket* packet, bool first, size_t index, Segment& segment, const NVIImageInfo& info,
+                          const Output& output)
+{
+    std::vector<uint8_t> vecJoined;
+    if (first && !segment.params.empty() && packet->data)
+    {
+        // 码流可能只在开头带参数集，每段的解码上下文都要先收到
+        vecJoined.reserve(segment.params.size() + static_cast<size_t>(packet->size) + AV_INPUT_BUFFER_PADDING_SIZE);
+        vecJoined = segment.params;
+        vecJoined.insert(vecJoined.end(), packet->data, packet->data + packet->size);
+        vecJoined.resize(vecJoined.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        packet->data = vecJoined.data();
+        packet->size = static_cast<int>(vecJoined.size() - AV_INPUT_BUFFER_PADDING_SIZE);
+    }
+    int nSend = avcodec_send_packet(ctx, packet);
+    if (nSend < 0)
+    {
+        LOG_WARNING("FFBatchDecoder avcodec_send_packet failed {}, {}.", nSend, av_errstr(nSend));
+        Fail();
+        return;
+    }
+    int nRecv = 0;
+    while (nRecv >= 0)
+    {
+        auto pFrame = AllocAVFrame();
+        if (pFrame == nullptr)
+        {
+            break;
+        }
+        nRecv = avcodec_receive_frame(ctx, pFrame.get());
+        if (nRecv >= 0)
+        {
+            Deliver(index, segment, std::move(pFrame), info, output);
+        }
+        else if (nRecv != AVERROR(EAGAIN) && nRecv != AVERROR_EOF)
+        {
+            LOG_WARNING("FFBatchDecoder avcodec_receive_frame failed {}, {}.", nRecv, av_errstr(nRecv));
+            Fail();
+        }
+    }
+}
+
+void FFBatchDecoder::Fail()
+{
+    std::lock_guard<std::mutex> lock(m_mtxSegments);
+    m_bFailed = true;
+}
+
+void FFBatchDecoder::Deliver(size_t index, Segment& segment, std::unique_ptr<AVFrame, void (*)(AVFrame*)> frame, const NVIImageInfo& info,
+                             const Output& output)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mtxSegments);
+        m_cvSegments.wait(lock, [this, index, &segment]() { return index == m_uEmitSegment || segment.frames.size() < m_options.max_frames; });
+        if (index != m_uEmitSegment)
+        {
+            segment.frames.push_back(std::move(frame));
+            return;
+        }
+    }
+    // 只有队首段输出，成为队首后先输出之前缓存的帧
+    for (const auto& pFrame : segment.frames)
+    {
+        Emit(pFrame.get(), info, output);
+    }
+    segment.frames.clear();
+    Emit(frame.get(), info, output);
+}
+
+void FFBatchDecoder::Finish(size_t index, Segment& segment, const NVIImageInfo& info, const Output& output)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mtxSegments);
+        m_cvSegments.wait(lock, [this, index]() { return index == m_uEmitSegment; });
+    }
+    for (const auto& pFrame : segment.frames)
+    {
+        Emit(pFrame.get(), info, output);
+    }
+    segment.frames.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_mtxSegments);
+        ++m_uEmitSegment;
+    }
+    m_cvSegments.notify_all();
+}
+
+void FFBatchDecoder::Emit(const AVFrame* frame, const NVIImageInfo& info, const Output& output)
+{
+    NVIVideoImageFrame image{};
+    if (ConvertImageFrame(frame, NVIBuffer_HOST, info, image))
+    {
+        if (frame->pts == AV_NOPTS_VALUE)
+        {
+            image.info.tick.value = m_nEmitted;
+        }
+        ++m_nEmitted;
+        if (output)
+        {
+            output(&image);
+        }
+    }
+    else
+    {
+        LOG_ERROR("FFBatchDecoder not match our pixel format: {}.", frame->format);
+    }
+}
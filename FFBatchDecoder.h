@@ -0,0 +1,92 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include <NVI/Codec.h>
+
+struct AVFrame;
+struct AVPacket;
+struct AVCodecContext;
+
+// 离线批量解码：在IDR处切分码流，各段在独立的解码上下文中并行解码，按显示顺序输出
+class FFBatchDecoder final
+{
+public:
+    typedef std::function<int32_t(const NVIVideoImageFrame* image)> Output;
+
+    struct Options
+    {
+        uint32_t workers = 0;          // 并行解码的段数，0为CPU核数
+        uint32_t max_segments = 0;     // 同时在途（已开始但未输出完）的段数上限，0为workers的两倍；小于workers时只用max_segments个线程
+        uint32_t max_frames = 16;      // 非队首段最多缓存的解码帧数，超出后等待
+        uint32_t threads = 1;          // 每个解码上下文的线程数
+    };
+
+public:
+    FFBatchDecoder();
+    ~FFBatchDecoder();
+
+public:
+    bool Config(uint32_t codec, const Options& options);
+    // 完整的包列表，每个包是一个访问单元
+    bool Decoding(const NVIVideoEncodedPacket* packets, size_t count, const Output& output);
+    // 整个Annex-B裸流，输出帧的tick为显示顺序的序号；分派时才在原数据上找下一个IDR切分，不拷贝
+    bool Decoding(const uint8_t* stream, size_t size, const Output& output);
+
+private:
+    struct Unit
+    {
+        const uint8_t* data;
+        size_t size;
+        int64_t pts;
+        const NVIImageInfo* info;
+    };
+    // 包列表时为包的下标，裸流时为字节偏移
+    struct Segment
+    {
+        size_t begin;
+        size_t end;
+        // 段首之前出现过的参数集，拼在段的第一个访问单元之前送入解码器
+        std::vector<uint8_t> params;
+        std::vector<std::unique_ptr<AVFrame, void (*)(AVFrame*)>> frames;
+    };
+
+    bool Run(const Output& output);
+    void Work(const Output& output);
+    // 取下一个段，裸流时在此切分；段的地址在Run期间不变
+    bool Claim(size_t& index, Segment*& segment);
+    // 从from开始的第一个包含IDR的访问单元的起始偏移，skip时跳过从from开始的访问单元，找不到返回流长度
+    // 同时记录经过的参数集
+    size_t FindIDR(size_t from, bool skip);
+    void DecodeStream(AVCodecContext* ctx, AVPacket* packet, size_t index, Segment& segment, const NVIImageInfo& info, const Output& output);
+    // first为段的第一个访问单元，先拼上段的参数集
+    void Send(AVCodecContext* ctx, AVPacket* packet, bool first, size_t index, Segment& segment, const NVIImageInfo& info, const Output& output);
+    // 解码出错时调用，Decoding返回失败
+    void Fail();
+    void Deliver(size_t index, Segment& segment, std::unique_ptr<AVFrame, void (*)(AVFrame*)> frame, const NVIImageInfo& info, const Output& output);
+    void Finish(size_t index, Segment& segment, const NVIImageInfo& info, const Output& output);
+    void Emit(const AVFrame* frame, const NVIImageInfo& info, const Output& output);
+
+private:
+    uint32_t m_uCodec;
+    Options m_options;
+    // 包列表或裸流，Run期间有效
+    std::vector<Unit> m_vecUnits;
+    const uint8_t* m_pStream;
+    size_t m_szStream;
+    std::mutex m_mtxScan;
+    // 切分时最近的参数集，按类型和id各保留一个
+    std::vector<std::vector<uint8_t>> m_vecParams;
+    std::deque<Segment> m_deqSegments;
+    size_t m_szNextSegment;
+    size_t m_szScan;
+    size_t m_uEmitSegment;
+    int64_t m_nEmitted;
+    bool m_bFailed;
+    std::mutex m_mtxSegments;
+    std::condition_variable m_cvSegments;
+};
@@ -0,0 +1,480 @@
+#include "FFGopCache.h"
+#include "FFmpegWrapper.hpp"
+#include "Bitstream.h"
+#include "adaption/Logging.h"
+#include <algorithm>
+
+using namespace ffmpeg;
+
+namespace
+{
+uint64_t FrameBytes(const AVFrame* frame)
+{
+    uint64_t uBytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i)
+    {
+        uBytes += frame->buf[i]->size;
+    }
+    return uBytes;
+}
+}  // namespace
+
+FFGopCache::FFGopCache()
+    : m_uCodec(0)
+    , m_uNextId(0)
+    , m_uClock(0)
+    , m_uPacketBytes(0)
+    , m_uFrameBytes(0)
+    , m_nCurrent(0)
+    , m_bHasCurrent(false)
+    , m_stats{}
+    , m_pForeground(nullptr)
+    , m_pBackground(nullptr)
+    , m_bStop(false)
+{
+}
+
+FFGopCache::~FFGopCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtxCache);
+        m_bStop = true;
+    }
+    m_cvCache.notify_all();
+    if (m_thWorker.joinable())
+    {
+        m_thWorker.join();
+    }
+    avcodec_free_context(&m_pForeground);
+    avcodec_free_context(&m_pBackground);
+    MemoryBudget::Instance().Uncharge(static_cast<size_t>(m_uFrameBytes));
+}
+
+bool FFGopCache::Config(uint32_t codec, const Options& options)
+{
+    if (codec != NVICodec_AVC && codec != NVICodec_HEVC)
+    {
+        return false;
+    }
+    if (avcodec_find_decoder(ToAVCodecID(codec)) == nullptr || m_uCodec != 0)
+    {
+        return false;
+    }
+    m_uCodec = codec;
+    m_options = options;
+    if (m_options.threads == 0)
+    {
+        m_options.threads = 1;
+    }
+    if (m_options.prefetch > 0)
+    {
+        m_thWorker = std::thread(&FFGopCache::Work, this);
+    }
+    return true;
+}
+
+bool FFGopCache::Push(const NVIVideoEncodedPacket& packet)
+{
+    const uint8_t* pData = reinterpret_cast<const uint8_t*>(packet.buffer.bytes);
+    if (m_uCodec == 0 || pData == nullptr || packet.buffer.size == 0)
+    {
+        return false;
+    }
+    // 记录参数集，随机访问点开始新的GOP；只有CRA或恢复点的流也按它们分段，单个GOP不会无限增长
+    bool bRandomAccess = false;
+    bool bRecovery = false;
+    std::vector<uint8_t> vecParams;
+    bitstream::ForEachNAL(pData, packet.buffer.size,
+                          [this, &bRandomAccess, &bRecovery, &vecParams](const uint8_t* nal, size_t length) -> bool
+                          {
+                              const uint8_t type = bitstream::NALType(m_uCodec, nal);
+                              if (bitstream::IsSlice(m_uCodec, type))
+                              {
+                                  bRandomAccess = bRecovery || bitstream::IsRandomAccess(m_uCodec, type);
+                                  return false;
+                              }
+                              if (bitstream::IsParameterSet(m_uCodec, type))
+                              {
+                                  vecParams.insert(vecParams.end(), {0, 0, 0, 1});
+                                  vecParams.insert(vecParams.end(), nal, nal + length);
+                              }
+                              bRecovery = bRecovery || bitstream::IsRecoveryPoint(m_uCodec, nal, length);
+                              return true;
+                          });
+    auto pPacket = std::make_unique<Packet>(Packet{std::vector<uint8_t>(pData, pData + packet.buffer.size), packet.info.tick.value});
+    std::unique_lock<std::mutex> lock(m_mtxCache);
+    if (!vecParams.empty())
+    {
+        m_vecParams = std::move(vecParams);
+    }
+    if (bRandomAccess)
+    {
+        auto pGop = std::make_unique<Gop>();
+        pGop->id = m_uNextId++;
+        pGop->info = packet.info;
+        pGop->params = m_vecParams;
+        m_deqGops.push_back(std::move(pGop));
+    }
+    else if (m_deqGops.empty())
+    {
+        return true;
+    }
+    Gop* pGop = m_deqGops.back().get();
+    pGop->packets.push_back(std::move(pPacket));
+    pGop->packet_bytes += packet.buffer.size;
+    // 新的包让之前的解码结果不完整
+    pGop->decoded = false;
+    m_uPacketBytes += packet.buffer.size;
+    m_mapPts[packet.info.tick.value] = pGop->id;
+    EvictPackets();
+    return true;
+}
+
+bool FFGopCache::Seek(int64_t pts, const Output& output)
+{
+    std::unique_lock<std::mutex> lock(m_mtxCache);
+    auto it = m_mapPts.upper_bound(pts);
+    if (it == m_mapPts.begin())
+    {
+        return false;
+    }
+    --it;
+    const int32_t nDirection = m_bHasCurrent && it->first < m_nCurrent ? -1 : 1;
+    m_nCurrent = it->first;
+    m_bHasCurrent = true;
+    const uint64_t uId = it->second;
+    Gop* pGop = FindGop(uId);
+    if (pGop == nullptr)
+    {
+        return false;
+    }
+    pGop->last_use = ++m_uClock;
+    if (pGop->decoded && !pGop->decoding)
+    {
+        ++m_stats.hits;
+    }
+    else
+    {
+        ++m_stats.misses;
+        // 后台正在解码时等它完成，否则在调用线程上解码
+        m_cvCache.wait(lock,
+                       [this, uId]()
+                       {
+                           Gop* pWait = FindGop(uId);
+                           return pWait == nullptr || !pWait->decoding;
+                       });
+        pGop = FindGop(uId);
+        if (pGop == nullptr)
+        {
+            return false;
+        }
+        if (!pGop->decoded && !DecodeGop(pGop, m_pForeground, lock))
+        {
+            return false;
+        }
+        // 解码期间可能有其他GOP被释放，重新查找
+        it = m_mapPts.find(m_nCurrent);
+        if (it == m_mapPts.end())
+        {
+            return false;
+        }
+    }
+    Prefetch(uId, nDirection);
+    return Emit(it, output, lock);
+}
+
+bool FFGopCache::Step(int32_t delta, const Output& output)
+{
+    int64_t nTarget = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxCache);
+        if (m_mapPts.empty())
+        {
+            return false;
+        }
+        auto it = m_bHasCurrent ? m_mapPts.lower_bound(m_nCurrent) : m_mapPts.begin();
+        if (it == m_mapPts.end())
+        {
+            --it;
+        }
+        for (; delta > 0 && std::next(it) != m_mapPts.end(); --delta)
+        {
+            ++it;
+        }
+        for (; delta < 0 && it != m_mapPts.begin(); ++delta)
+        {
+            --it;
+        }
+        nTarget = it->first;
+    }
+    return Seek(nTarget, output);
+}
+
+FFGopCache::Stats FFGopCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mtxCache);
+    Stats stats = m_stats;
+    stats.packet_bytes = m_uPacketBytes;
+    stats.frame_bytes = m_uFrameBytes;
+    stats.gops = static_cast<uint32_t>(m_deqGops.size());
+    return stats;
+}
+
+bool FFGopCache::Emit(std::map<int64_t, uint64_t>::const_iterator it, const Output& output, std::unique_lock<std::mutex>& lock)
+{
+    Gop* pGop = FindGop(it->second);
+    if (pGop == nullptr)
+    {
+        return false;
+    }
+    auto itFrame = pGop->frames.find(it->first);
+    if (itFrame == pGop->frames.end())
+    {
+        LOG_WARNING("FFGopCache frame {} not decoded.", it->first);
+        return false;
+    }
+    // 持有帧的引用后释放锁，回调期间GOP被释放也不影响输出的帧
+    auto pFrame = AllocAVFrame();
+    if (pFrame == nullptr || av_frame_ref(pFrame.get(), itFrame->second.get()) < 0)
+    {
+        return false;
+    }
+    const NVIImageInfo info = pGop->info;
+    lock.unlock();
+    NVIVideoImageFrame image{};
+    if (!ConvertImageFrame(pFrame.get(), NVIBuffer_HOST, info, image))
+    {
+        LOG_ERROR("FFGopCache not match our pixel format: {}.", pFrame->format);
+        return false;
+    }
+    if (output)
+    {
+        output(&image);
+    }
+    return true;
+}
+
+FFGopCache::Gop* FFGopCache::FindGop(uint64_t id) const
+{
+    if (m_deqGops.empty() || id < m_deqGops.front()->id || id > m_deqGops.back()->id)
+    {
+        return nullptr;
+    }
+    // GOP编号连续，只从队首丢弃
+    return m_deqGops[static_cast<size_t>(id - m_deqGops.front()->id)].get();
+}
+
+bool FFGopCache::DecodeGop(Gop* gop, AVCodecContext*& context, std::unique_lock<std::mutex>& lock)
+{
+    AVCodecContext* pContext = context;
+    context = nullptr;
+    gop->decoding = true;
+    // 解码期间Push可能追加包，只解码此时已有的
+    std::vector<const Packet*> vecPackets;
+    vecPackets.reserve(gop->packets.size());
+    for (const auto& pPacket : gop->packets)
+    {
+        vecPackets.push_back(pPacket.get());
+    }
+    const size_t szPackets = vecPackets.size();
+    lock.unlock();
+
+    if (pContext == nullptr)
+    {
+        pContext = OpenContext();
+    }
+    std::map<int64_t, AVFramePtr> mapFrames;
+    uint64_t uBytes = 0;
+    auto pPacket = AllocAVPacket();
+    bool bDecoded = pContext != nullptr && pPacket != nullptr;
+    // 第一个包前加上参数集，GOP可以独立解码
+    std::vector<uint8_t> vecFirst;
+    for (size_t i = 0; bDecoded && i <= szPackets; ++i)
+    {
+        const bool bDrain = i == szPackets;
+        if (i == 0 && !bDrain && !gop->params.empty())
+        {
+            vecFirst.reserve(gop->params.size() + vecPackets[0]->data.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            vecFirst = gop->params;
+            vecFirst.insert(vecFirst.end(), vecPackets[0]->data.begin(), vecPackets[0]->data.end());
+            pPacket->data = vecFirst.data();
+            pPacket->size = static_cast<int>(vecFirst.size());
+        }
+        else
+        {
+            pPacket->data = bDrain ? nullptr : const_cast<uint8_t*>(vecPackets[i]->data.data());
+            pPacket->size = bDrain ? 0 : static_cast<int>(vecPackets[i]->data.size());
+        }
+        pPacket->pts = bDrain ? AV_NOPTS_VALUE : vecPackets[i]->pts;
+        pPacket->dts = pPacket->pts;
+        int nSend = avcodec_send_packet(pContext, pPacket.get());
+        if (nSend < 0)
+        {
+            LOG_WARNING("FFGopCache avcodec_send_packet failed {}, {}.", nSend, av_errstr(nSend));
+            continue;
+        }
+        while (true)
+        {
+            auto pFrame = AllocAVFrame();
+            if (pFrame == nullptr || avcodec_receive_frame(pContext, pFrame.get()) < 0)
+            {
+                break;
+            }
+            uBytes += FrameBytes(pFrame.get());
+            const int64_t nPts = pFrame->pts;
+            mapFrames.insert_or_assign(nPts, std::move(pFrame));
+        }
+    }
+    if (pContext)
+    {
+        avcodec_flush_buffers(pContext);
+    }
+    MemoryBudget::Instance().Charge(static_cast<size_t>(uBytes), false);
+
+    lock.lock();
+    if (context == nullptr)
+    {
+        context = pContext;
+    }
+    else
+    {
+        avcodec_free_context(&pContext);
+    }
+    gop->decoding = false;
+    if (bDecoded)
+    {
+        m_uFrameBytes += uBytes;
+        m_uFrameBytes -= gop->frame_bytes;
+        MemoryBudget::Instance().Uncharge(static_cast<size_t>(gop->frame_bytes));
+        gop->frames = std::move(mapFrames);
+        gop->frame_bytes = uBytes;
+        // 解码期间追加了包时结果不完整，下次访问时重新解码
+        gop->decoded = gop->packets.size() == szPackets;
+        EvictFrames(gop->id);
+    }
+    else
+    {
+        MemoryBudget::Instance().Uncharge(static_cast<size_t>(uBytes));
+    }
+    m_cvCache.notify_all();
+    return bDecoded;
+}
+
+void FFGopCache::Prefetch(uint64_t id, int32_t direction)
+{
+    if (m_options.prefetch == 0)
+    {
+        return;
+    }
+    // 方向改变后之前排队的预取已不需要
+    m_deqPrefetch.clear();
+    for (uint32_t i = 1; i <= m_options.prefetch; ++i)
+    {
+        if (direction < 0 && id < i)
+        {
+            break;
+        }
+        const uint64_t uNext = direction < 0 ? id - i : id + i;
+        Gop* pGop = FindGop(uNext);
+        if (pGop == nullptr)
+        {
+            break;
+        }
+        pGop->last_use = m_uClock;
+        if (!pGop->decoded && !pGop->decoding)
+        {
+            m_deqPrefetch.push_back(uNext);
+        }
+    }
+    if (!m_deqPrefetch.empty())
+    {
+        m_cvCache.notify_all();
+    }
+}
+
+void FFGopCache::EvictFrames(uint64_t keep)
+{
+    while (m_uFrameBytes > m_options.max_frame_bytes)
+    {
+        Gop* pOldest = nullptr;
+        for (const auto& pGop : m_deqGops)
+        {
+            if (pGop->id != keep && !pGop->decoding && pGop->frame_bytes > 0 && (pOldest == nullptr || pGop->last_use < pOldest->last_use))
+            {
+                pOldest = pGop.get();
+            }
+        }
+        if (pOldest == nullptr)
+        {
+            break;
+        }
+        MemoryBudget::Instance().Uncharge(static_cast<size_t>(pOldest->frame_bytes));
+        m_uFrameBytes -= pOldest->frame_bytes;
+        pOldest->frames.clear();
+        pOldest->frame_bytes = 0;
+        pOldest->decoded = false;
+        ++m_stats.evicted;
+    }
+}
+
+void FFGopCache::EvictPackets()
+{
+    while (m_uPacketBytes > m_options.max_packet_bytes && !m_deqGops.empty() && !m_deqGops.front()->decoding)
+    {
+        Gop* pGop = m_deqGops.front().get();
+        if (m_deqGops.size() == 1)
+        {
+            // 最新的GOP单独超出上限（随机访问点间隔过长），整个丢弃，之后的包等到下一个随机访问点
+            LOG_WARNING("FFGopCache gop {} exceeds {} bytes, dropped.", pGop->packet_bytes, m_options.max_packet_bytes);
+        }
+        for (const auto& pPacket : pGop->packets)
+        {
+            auto it = m_mapPts.find(pPacket->pts);
+            if (it != m_mapPts.end() && it->second == pGop->id)
+            {
+                m_mapPts.erase(it);
+            }
+        }
+        m_uPacketBytes -= pGop->packet_bytes;
+        m_uFrameBytes -= pGop->frame_bytes;
+        MemoryBudget::Instance().Uncharge(static_cast<size_t>(pGop->frame_bytes));
+        m_deqGops.pop_front();
+    }
+}
+
+void FFGopCache::Work()
+{
+    std::unique_lock<std::mutex> lock(m_mtxCache);
+    while (true)
+    {
+        m_cvCache.wait(lock, [this]() { return m_bStop || !m_deqPrefetch.empty(); });
+        if (m_bStop)
+        {
+            break;
+        }
+        const uint64_t uId = m_deqPrefetch.front();
+        m_deqPrefetch.pop_front();
+        Gop* pGop = FindGop(uId);
+        if (pGop && !pGop->decoded && !pGop->decoding && DecodeGop(pGop, m_pBackground, lock))
+        {
+            ++m_stats.prefetched;
+        }
+    }
+}
+
+AVCodecContext* FFGopCache::OpenContext() const
+{
+    AVCodecContext* pContext = avcodec_alloc_context3(avcodec_find_decoder(ToAVCodecID(m_uCodec)));
+    if (pContext == nullptr)
+    {
+        return nullptr;
+    }
+    pContext->thread_count = static_cast<int>(m_options.threads);
+    int nOpen = avcodec_open2(pContext, nullptr, nullptr);
+    if (nOpen != 0)
+    {
+        LOG_ERROR("FFGopCache avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+        avcodec_free_context(&pContext);
+    }
+    return pContext;
+}
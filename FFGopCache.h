@@ -0,0 +1,111 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <NVI/Codec.h>
+
+struct AVCodecContext;
+struct AVFrame;
+
+// 回放用的GOP缓存：保存最近若干GOP的包和有限数量的解码帧，按任意顺序输出帧
+// 按访问方向在后台预先解码相邻的GOP，倒放和逐帧后退时不必每次从IDR重新解码
+class FFGopCache final
+{
+public:
+    typedef std::function<int32_t(const NVIVideoImageFrame* image)> Output;
+
+    struct Options
+    {
+        uint64_t max_packet_bytes = 256ull << 20;  // 保存的包数据上限，超出时丢弃最早的GOP，最新的GOP超出时也丢弃
+        uint64_t max_frame_bytes = 512ull << 20;   // 解码帧上限，超出时按最近使用时间释放整个GOP的帧
+        uint32_t prefetch = 1;                     // 沿访问方向预先解码的GOP数，0不预取
+        uint32_t threads = 1;                      // 每个解码上下文的线程数
+    };
+    struct Stats
+    {
+        uint64_t hits;           // 帧已解码
+        uint64_t misses;         // 需要同步解码所在的GOP
+        uint64_t prefetched;     // 后台解码的GOP数
+        uint64_t evicted;        // 释放解码帧的GOP数
+        uint64_t packet_bytes;
+        uint64_t frame_bytes;
+        uint32_t gops;
+    };
+
+public:
+    FFGopCache();
+    ~FFGopCache();
+
+public:
+    bool Config(uint32_t codec, const Options& options);
+    // 按解码顺序追加包，包数据被拷贝；IDR、CRA/BLA和带恢复点SEI的访问单元开始新的GOP
+    // 第一个随机访问点之前的包被丢弃；不等待正在解码的GOP
+    bool Push(const NVIVideoEncodedPacket& packet);
+    // 输出pts不大于给定值的最后一帧
+    bool Seek(int64_t pts, const Output& output);
+    // 从上次输出的帧按显示顺序前进或后退delta帧
+    bool Step(int32_t delta, const Output& output);
+    Stats GetStats() const;
+
+private:
+    typedef std::unique_ptr<AVFrame, void (*)(AVFrame*)> AVFramePtr;
+    struct Packet
+    {
+        std::vector<uint8_t> data;
+        int64_t pts;
+    };
+    struct Gop
+    {
+        uint64_t id;
+        NVIImageInfo info;
+        std::vector<uint8_t> params;  // GOP开始时的参数集，解码时放在第一个包之前
+        // 包对象地址不变，解码时在锁外读取加锁时取得的列表，追加不必等待
+        std::vector<std::unique_ptr<const Packet>> packets;
+        uint64_t packet_bytes = 0;
+        std::map<int64_t, AVFramePtr> frames;
+        uint64_t frame_bytes = 0;
+        uint64_t last_use = 0;
+        bool decoded = false;
+        bool decoding = false;
+    };
+
+    // 在锁内取得帧的引用，释放锁后转换和回调
+    bool Emit(std::map<int64_t, uint64_t>::const_iterator it, const Output& output, std::unique_lock<std::mutex>& lock);
+    Gop* FindGop(uint64_t id) const;
+    // 在调用线程上解码整个GOP，需要持有lock，解码期间释放
+    bool DecodeGop(Gop* gop, AVCodecContext*& context, std::unique_lock<std::mutex>& lock);
+    void Prefetch(uint64_t id, int32_t direction);
+    void EvictFrames(uint64_t keep);
+    void EvictPackets();
+    void Work();
+    AVCodecContext* OpenContext() const;
+
+private:
+    uint32_t m_uCodec;
+    Options m_options;
+    mutable std::mutex m_mtxCache;
+    std::condition_variable m_cvCache;
+    std::deque<std::unique_ptr<Gop>> m_deqGops;
+    // 所有已保存的包的pts到所在GOP，按显示顺序查找
+    std::map<int64_t, uint64_t> m_mapPts;
+    std::vector<uint8_t> m_vecParams;
+    uint64_t m_uNextId;
+    uint64_t m_uClock;
+    uint64_t m_uPacketBytes;
+    uint64_t m_uFrameBytes;
+    int64_t m_nCurrent;
+    bool m_bHasCurrent;
+    Stats m_stats;
+    // 前台同步解码和后台预取各用一个解码上下文
+    AVCodecContext* m_pForeground;
+    AVCodecContext* m_pBackground;
+    std::deque<uint64_t> m_deqPrefetch;
+    bool m_bStop;
+    std::thread m_thWorker;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+
+// 共享内存帧环的布局，解码进程和消费进程共用，只在Linux上可用
+// 段内依次为：头、帧描述环、缓冲引用表、缓冲代数表、数据区（按块划分）
+// 每个帧缓冲占用连续的若干块，引用计数和代数记在其首块的表项上：
+//   引用表只记消费者的引用，通过FFSharedFrameAcquire获得，用完后FFSharedFrameRelease
+//   解码器和帧环持有的引用记在解码进程内，段内的内容不影响解码进程自身的正确性
+// 解码进程不再持有且消费者引用归零的缓冲被回收；消费者持有超过lease_ms的缓冲（如消费进程崩溃）
+// 也被强制回收，回收时代数加1，消费者读完数据后用FFSharedFrameValid确认缓冲未被回收
+
+#define FF_SHARED_FRAME_MAGIC (0x46465346u)  // "FSFF"
+#define FF_SHARED_FRAME_VERSION (2u)
+
+typedef struct FFSharedFrameHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;            // 段的总字节数
+    uint32_t ring_capacity;   // 帧描述个数
+    uint32_t block_size;      // 数据区的块大小
+    uint32_t block_count;     // 数据区的块数
+    uint32_t lease_ms;        // 离开帧环后消费者最多持有的时间，0不强制回收
+    uint64_t ring_offset;     // 帧描述环的偏移
+    uint64_t refs_offset;     // 引用表（uint32_t[block_count]）的偏移
+    uint64_t data_offset;     // 数据区的偏移
+    uint64_t head;            // 已发布的帧数，原子读写
+    uint64_t dropped;         // 不在共享内存中而未发布的帧数
+    uint64_t gens_offset;     // 代数表（uint32_t[block_count]）的偏移
+    uint64_t reclaimed;       // 超过lease_ms被强制回收的缓冲数
+} FFSharedFrameHeader;
+
+typedef struct FFSharedFrame
+{
+    uint64_t seq;          // 第几帧（从1开始），写入完成后最后更新，为0或不符时描述无效
+    int64_t pts;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;       // NVIImageBuffer::format
+    uint8_t primary;       // NVIColorSpace
+    uint8_t transfer;
+    uint8_t matrix;
+    uint8_t range;
+    uint32_t planes;
+    uint32_t buffer[4];    // 各平面所在缓冲的首块号
+    uint64_t offset[4];    // 各平面相对段起始的偏移
+    uint32_t stride[4];
+    uint32_t gen[4];       // 发布时各平面缓冲的代数
+} FFSharedFrame;
+
+#if defined(__linux__)
+// 以下为消费进程的访问函数，使用GCC/Clang的原子内建函数
+static inline const FFSharedFrameHeader* FFSharedFrameGetHeader(const void* base)
+{
+    return (const FFSharedFrameHeader*)base;
+}
+
+static inline uint32_t* FFSharedFrameRefs(const void* base, uint32_t buffer)
+{
+    const FFSharedFrameHeader* header = FFSharedFrameGetHeader(base);
+    return (uint32_t*)((uint8_t*)base + header->refs_offset) + buffer;
+}
+
+static inline const uint32_t* FFSharedFrameGens(const void* base, uint32_t buffer)
+{
+    const FFSharedFrameHeader* header = FFSharedFrameGetHeader(base);
+    return (const uint32_t*)((const uint8_t*)base + header->gens_offset) + buffer;
+}
+
+// 缓冲在Acquire之后是否被强制回收过，为0时读到的平面数据不可信
+static inline int FFSharedFrameValid(const void* base, const FFSharedFrame* frame)
+{
+    for (uint32_t i = 0; i < frame->planes; ++i)
+    {
+        if (__atomic_load_n(FFSharedFrameGens(base, frame->buffer[i]), __ATOMIC_ACQUIRE) != frame->gen[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline void FFSharedFrameRelease(const void* base, const FFSharedFrame* frame)
+{
+    for (uint32_t i = 0; i < frame->planes; ++i)
+    {
+        __atomic_fetch_sub(FFSharedFrameRefs(base, frame->buffer[i]), 1, __ATOMIC_ACQ_REL);
+    }
+}
+
+// 取得第index帧（从0开始）并持有其缓冲
+// 返回0成功；1尚未发布；-1已被覆盖，应跳到head - ring_capacity之后
+static inline int FFSharedFrameAcquire(const void* base, uint64_t index, FFSharedFrame* frame)
+{
+    const FFSharedFrameHeader* header = FFSharedFrameGetHeader(base);
+    if (header->ring_capacity == 0)
+    {
+        return -1;
+    }
+    const FFSharedFrame* ring = (const FFSharedFrame*)((const uint8_t*)base + header->ring_offset);
+    const FFSharedFrame* slot = ring + index % header->ring_capacity;
+    if (__atomic_load_n(&header->head, __ATOMIC_ACQUIRE) <= index)
+    {
+        return 1;
+    }
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1)
+    {
+        return -1;
+    }
+    *frame = *slot;
+    // 拷贝期间可能正被改写，先检查范围再加引用
+    if (frame->planes > 4)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < frame->planes; ++i)
+    {
+        if (frame->buffer[i] >= header->block_count)
+        {
+            frame->planes = i;
+            FFSharedFrameRelease(base, frame);
+            return -1;
+        }
+        __atomic_fetch_add(FFSharedFrameRefs(base, frame->buffer[i]), 1, __ATOMIC_ACQ_REL);
+    }
+    // 加引用期间被覆盖时，缓冲可能已被回收
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1 || !FFSharedFrameValid(base, frame))
+    {
+        FFSharedFrameRelease(base, frame);
+        return -1;
+    }
+    return 0;
+}
+
+static inline const uint8_t* FFSharedFramePlane(const void* base, const FFSharedFrame* frame, uint32_t plane)
+{
+    return (const uint8_t*)base + frame->offset[plane];
+}
+#endif
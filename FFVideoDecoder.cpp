@@ -1,456 +1,1704 @@
-﻿#include "FFVideoDecoder.h"
-#include "FFmpegAccel.h"
-#include "FFmpegWrapper.hpp"
-#include "adaption/Logging.h"
-
-using namespace ffmpeg;
-
-inline NVIBufferType GetHWBufferType(NVIAccelType eAccelType)
-{
-    switch (eAccelType)
-    {
-    case NVIAccel_NVCodec: return NVIBuffer_CUDA;
-    case NVIAccel_DXVA2: return NVIBuffer_D3DSurface9;
-    case NVIAccel_D3D11VA: return NVIBuffer_D3D11Texture2D;
-    case NVIAccel_VideoToolbox: return NVIBuffer_CVPixelBufferRef;
-    case NVIAccel_MediaCodec: return NVIBuffer_MediaCodecBuffer;
-    case NVIAccel_VAAPI: return NVIBuffer_VASurfaceID;
-    default: return NVIBuffer_HOST;
-    }
-}
-
-AVPixelFormat GetHWFormat(AVCodecContext* ctx, const enum AVPixelFormat* fmts)
-{
-    FFVideoDecoder* pDelegate = (FFVideoDecoder*)ctx->opaque;
-    if (pDelegate)
-    {
-        AVPixelFormat fmt = (AVPixelFormat)pDelegate->HWPixelFormat();
-        for (auto p = fmts; *p != -1; p++)
-        {
-            if (*p == fmt)
-            {
-                return fmt;
-            }
-        }
-    }
-    return fmts ? *fmts : AV_PIX_FMT_NONE;
-}
-
-AVPixelFormat GetHWDownloadFormat(AVBufferRef* ctx)
-{
-    AVPixelFormat format = AV_PIX_FMT_NONE;
-    AVPixelFormat* arrFormats = nullptr;
-    int nGetFormats = av_hwframe_transfer_get_formats(ctx, AVHWFrameTransferDirection::AV_HWFRAME_TRANSFER_DIRECTION_FROM, &arrFormats, 0);
-    if (nGetFormats >= 0 && arrFormats)
-    {
-        format = arrFormats[0];
-        av_freep(&arrFormats);
-    }
-    else
-    {
-        LOG_ERROR("av_hwframe_transfer_get_formats failed {}, {}.", nGetFormats, av_errstr(nGetFormats));
-    }
-    return format;
-}
-
-#ifdef _NVCODEC
-#define FFNV_LOG_FUNC(ctx, fmt, ...)
-#define FFNV_DEBUG_LOG_FUNC(ctx, fmt, ...)
-#include <dynlink_loader.h>
-#define ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
-
-class CudaHostModule
-{
-public:
-    static CudaHostFunctions* Functions()
-    {
-        static CudaHostModule m;
-        return m.m_pFunctions;
-    }
-
-private:
-    CudaHostModule()
-    {
-        cuda_host_load_functions(&m_pFunctions, nullptr);
-        LOG_INFO("Load cuda host functions {}.", (void*)m_pFunctions);
-    }
-    ~CudaHostModule()
-    {
-        cuda_host_free_functions(&m_pFunctions);
-    }
-
-private:
-    CudaHostFunctions* m_pFunctions;
-};
-
-static void FreeCudaHost(void* opaque, uint8_t* data)
-{
-    if (opaque && data)
-    {
-        CudaHostFunctions* cuda = reinterpret_cast<CudaHostFunctions*>(opaque);
-        cuda->cuMemFreeHost(data);
-        LOG_INFO("Free cuda host {}.", (void*)data);
-    }
-}
-
-static AVFrame* AllocHostAVFrame(AVBufferRef* ref, int width, int height)
-{
-    if (ref == nullptr)
-    {
-        return nullptr;
-    }
-    CUcontext context = reinterpret_cast<CUcontext>(CudaContext(reinterpret_cast<AVHWFramesContext*>(ref->data)));
-    if (context == nullptr)
-    {
-        return nullptr;
-    }
-    // code reference get_video_buffer
-    if (av_image_check_size(width, height, 0, nullptr) < 0)
-    {
-        LOG_ERROR("Alloc host av_image_check_size({},{}) failed.", width, height);
-        return nullptr;
-    }
-    AVFrame* pFrame = av_frame_alloc();
-    if (pFrame == nullptr)
-    {
-        LOG_ERROR("Alloc host av_frame_alloc failed.");
-        return nullptr;
-    }
-    const AVPixelFormat format = GetHWDownloadFormat(ref);
-    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
-    if (desc == nullptr)
-    {
-        LOG_ERROR("Alloc host not found pixel format[{}] descriptor.", (int32_t)format);
-        return pFrame;
-    }
-    CudaHostFunctions* cuda = CudaHostModule::Functions();
-    if (cuda)
-    {
-        // for page-locked host memory.
-        pFrame->format = format;
-        pFrame->width = width;
-        pFrame->height = height;
-        int nFill = av_image_fill_linesizes(pFrame->linesize, format, FFALIGN(width, 32));
-        if (nFill < 0)
-        {
-            LOG_ERROR("Alloc host call av_image_fill_linesizes failed {}.", nFill);
-            return pFrame;
-        }
-        ptrdiff_t linesizes[4]{};
-        for (int i = 0; i < 4; ++i)
-        {
-            linesizes[i] = pFrame->linesize[i];
-        }
-        const int padding = FFALIGN(height, 32);
-        size_t sizes[4]{};
-        nFill = av_image_fill_plane_sizes(sizes, format, padding, linesizes);
-        if (nFill < 0)
-        {
-            LOG_ERROR("Alloc host call av_image_fill_plane_sizes failed {}.", nFill);
-            return pFrame;
-        }
-        size_t bytes = 0ull;
-        for (int i = 0; i < 4; ++i)
-        {
-            bytes += sizes[i];
-        }
-        uint8_t* pMem = nullptr;
-        cuda->cuCtxPushCurrent(context);
-        CUresult result = cuda->cuMemHostAlloc(reinterpret_cast<void**>(&pMem), bytes, 0);
-        if (result == CUDA_SUCCESS && pMem)
-        {
-            LOG_INFO("Cuda host alloc {}@{}.", (void*)pMem, bytes);
-            pFrame->buf[0] = av_buffer_create(pMem, bytes, &FreeCudaHost, cuda, 0);
-            nFill = av_image_fill_pointers(pFrame->data, format, padding, pMem, pFrame->linesize);
-            if (nFill < 0)
-            {
-                LOG_ERROR("Alloc host call av_image_fill_pointers failed {}.", nFill);
-            }
-        }
-        else
-        {
-            LOG_ERROR("Cuda host alloc failed {}.", (int32_t)result);
-        }
-        cuda->cuCtxPopCurrent(nullptr);
-    }
-    return pFrame;
-}
-#else
-#define AllocHostAVFrame(...) (nullptr)
-#endif
-
-FFVideoDecoder::FFVideoDecoder()
-    : m_pDecoderContext(nullptr)
-    , m_nHWPixelFormat(-1)
-    , m_eOutBufferType(NVIBuffer_HOST)
-    , m_pLastFrame(nullptr, &FreeAVFrame)
-    , m_pHostFrame(nullptr, &FreeAVFrame)
-{
-}
-
-FFVideoDecoder::~FFVideoDecoder()
-{
-    Release();
-}
-
-bool FFVideoDecoder::Config(const NVIVideoCodecParam& param)
-{
-    Release();
-    auto pDecoder = avcodec_find_decoder(ToAVCodecID(param.codec));
-    if (pDecoder == nullptr)
-    {
-        return false;
-    }
-    m_pDecoderContext = avcodec_alloc_context3(pDecoder);
-    if (m_pDecoderContext)
-    {
-        if (!HWAccelContextInit(param.accel))
-        {
-            avcodec_free_context(&m_pDecoderContext);
-            return false;
-        }
-        if (m_pDecoderContext->codec)
-        {
-            LOG_NOTICE("FFVideoDecoder init {}, {}.", m_pDecoderContext->codec->name, m_pDecoderContext->codec->long_name);
-        }
-        int nOpen = avcodec_open2(m_pDecoderContext, nullptr, nullptr);
-        if (nOpen == 0)
-        {
-            return true;
-        }
-        else
-        {
-            LOG_ERROR("FFVideoDecoder avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
-            avcodec_free_context(&m_pDecoderContext);
-        }
-    }
-    return false;
-}
-
-bool FFVideoDecoder::Decoding(const NVIVideoEncodedPacket& packet, const Output& output)
-{
-    if (m_pDecoderContext == nullptr)
-    {
-        return false;
-    }
-    if (avcodec_is_open(m_pDecoderContext))
-    {
-        auto pPacket(AllocAVPacket());
-        if (pPacket == nullptr)
-        {
-            return false;
-        }
-        pPacket->data = (uint8_t*)packet.buffer.bytes;
-        pPacket->size = (int)packet.buffer.size;
-        pPacket->pts = packet.info.tick.value;
-        pPacket->dts = pPacket->pts;
-        av_frame_unref(m_pLastFrame.get());
-        int nSend = avcodec_send_packet(m_pDecoderContext, pPacket.get());
-        if (nSend == 0)
-        {
-            int nRecv = 0;
-            uint32_t uOut = 0U;
-            while (nRecv >= 0)
-            {
-                auto pFrame = AllocAVFrame();
-                if (pFrame == nullptr)
-                {
-                    LOG_ERROR("av_frame_alloc failed!");
-                    return false;
-                }
-                nRecv = avcodec_receive_frame(m_pDecoderContext, pFrame.get());
-                if (nRecv >= 0)
-                {
-                    ++uOut;
-                    m_pLastFrame = std::move(pFrame);
-                    OutputLastFrame(packet.info, output);
-                }
-                else
-                {
-                    if (nRecv == AVERROR(EAGAIN))
-                    {
-                        if (uOut == 0u)
-                        {
-                            LOG_WARNING("FFVideoDecoder avcodec_receive_frame delay!!!!");
-                        }
-                        break;
-                    }
-                    else
-                    {
-                        LOG_ERROR("FFVideoDecoder avcodec_receive_frame failed {}, {}.", nRecv, av_errstr(nRecv));
-                        return false;
-                    }
-                }
-            }
-        }
-        else
-        {
-            LOG_ERROR("FFVideoDecoder avcodec_send_packet failed {}, {}.", nSend, av_errstr(nSend));
-            return false;
-        }
-        return true;
-    }
-    return false;
-}
-
-bool FFVideoDecoder::OutputLastFrame(const NVIImageInfo& info, const Output& output)
-{
-    if (m_pLastFrame && output)
-    {
-        AVFrame* pOutFrame = nullptr;
-        if (m_nHWPixelFormat == m_pLastFrame->format)
-        {
-            if (m_eOutBufferType == NVIBuffer_HOST)
-            {
-                // download
-                if (m_pHostFrame == nullptr || (m_pLastFrame->width != m_pHostFrame->width || m_pLastFrame->height != m_pHostFrame->height))
-                {
-                    if (m_pLastFrame->format == AV_PIX_FMT_CUDA)
-                    {
-                        m_pHostFrame.reset(AllocHostAVFrame(m_pLastFrame->hw_frames_ctx, m_pLastFrame->width, m_pLastFrame->height));
-                    }
-                    if (m_pHostFrame == nullptr)
-                    {
-                        m_pHostFrame = AllocAVFrame();
-                    }
-                }
-                int nTransfer = av_hwframe_transfer_data(m_pHostFrame.get(), m_pLastFrame.get(), 0);
-                if ((nTransfer) < 0)
-                {
-                    LOG_ERROR("av_hwframe_transfer_data failed {}, {}.", nTransfer, av_errstr(nTransfer));
-                    return false;
-                }
-                m_pHostFrame->pts = m_pLastFrame->pts;
-                m_pHostFrame->pict_type = m_pLastFrame->pict_type;
-                m_pHostFrame->color_range = m_pLastFrame->color_range;
-                m_pHostFrame->color_primaries = m_pLastFrame->color_primaries;
-                m_pHostFrame->color_trc = m_pLastFrame->color_trc;
-                m_pHostFrame->colorspace = m_pLastFrame->colorspace;
-                pOutFrame = m_pHostFrame.get();
-                m_pLastFrame = nullptr;
-            }
-            else
-            {
-                // or direct device buffer
-                m_pLastFrame->format = GetHWDownloadFormat(m_pLastFrame->hw_frames_ctx);
-                if (m_pLastFrame->format == AV_PIX_FMT_NONE)
-                {
-                    return false;
-                }
-                pOutFrame = m_pLastFrame.get();
-            }
-        }
-        else
-        {
-            pOutFrame = m_pLastFrame.get();
-        }
-        NVIVideoImageFrame image{};
-        if (ConvertPixelFormat((AVPixelFormat)pOutFrame->format, image.buffer.format))
-        {
-            image.info = info;
-            image.info.width = static_cast<uint32_t>(pOutFrame->width);
-            image.info.height = static_cast<uint32_t>(pOutFrame->height);
-            image.info.tick.value = pOutFrame->pts;
-            if (pOutFrame->colorspace != AVCOL_SPC_UNSPECIFIED && pOutFrame->color_range != AVCOL_RANGE_UNSPECIFIED)
-            {
-                image.info.colorspace = ConvertColorSpace(pOutFrame->color_primaries, pOutFrame->color_trc, pOutFrame->colorspace, pOutFrame->color_range);
-            }
-            image.buffer.type = m_eOutBufferType;
-            if (m_eOutBufferType == NVIBuffer_D3DSurface9)
-            {
-                image.buffer.planes[0] = pOutFrame->data[0];
-            }
-            else if (m_eOutBufferType == NVIBuffer_D3D11Texture2D)
-            {
-                image.buffer.planes[0] = pOutFrame->data[0];
-                image.buffer.planes[1] = pOutFrame->data[1];
-            }  //todo! else device buffer
-            else
-            {
-                for (int i = 0; i < 4; ++i)
-                {
-                    image.buffer.planes[i] = pOutFrame->data[i];
-                    image.buffer.strides[i] = static_cast<uint32_t>(pOutFrame->linesize[i]);
-                }
-            }
-            output(&image);
-        }
-        else
-        {
-            LOG_ERROR("Not match our pixel format: {}.", pOutFrame->format);
-            return false;
-        }
-    }
-    return true;
-}
-
-bool FFVideoDecoder::HWAccelContextInit(const NVIVideoAccelerate* accel)
-{
-    if (m_pDecoderContext == nullptr)
-    {
-        return false;
-    }
-    m_nHWPixelFormat = -1;
-    m_eOutBufferType = NVIBuffer_HOST;
-    if (accel == nullptr || accel->type <= NVIAccel_Auto)
-    {
-        return true;
-    }
-    auto typDevice = ToAVHWDeviceType(static_cast<NVIAccelType>(accel->type));
-    if (typDevice == AV_HWDEVICE_TYPE_NONE)
-    {
-        return false;
-    }
-    else
-    {
-        for (int i = 0;; i++)
-        {
-            const AVCodecHWConfig* config = avcodec_get_hw_config(m_pDecoderContext->codec, i);
-            if (!config)
-            {
-                break;
-            }
-            if (config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX && config->device_type == typDevice)
-            {
-                m_nHWPixelFormat = (int32_t)config->pix_fmt;
-                break;
-            }
-        }
-        if (m_nHWPixelFormat == -1)
-        {
-            LOG_WARNING("FFVideoDecoder not found valid hw pixel format.");
-            return false;
-        }
-        else
-        {
-            AVBufferRef* pHWContext = CreateHWContext(accel);
-            if (pHWContext)
-            {
-                if ((accel->flags & NVIAccelFlag_UseDeviceBuffer) == NVIAccelFlag_UseDeviceBuffer)
-                {
-                    m_eOutBufferType = GetHWBufferType(static_cast<NVIAccelType>(accel->type));
-                }
-                else
-                {
-                    m_eOutBufferType = NVIBuffer_HOST;
-                }
-                m_pDecoderContext->hw_device_ctx = pHWContext;
-                m_pDecoderContext->opaque = this;
-                m_pDecoderContext->get_format = GetHWFormat;
-            }
-            else
-            {
-                return false;
-            }
-        }
-        return true;
-    }
-}
-
-void FFVideoDecoder::Release()
-{
-    if (m_pDecoderContext)
-    {
-        avcodec_free_context(&m_pDecoderContext);
-    }
-}
+#include "FFVideoDecoder.h"
+#include "FFmpegAccel.h"
+#include "FFmpegWrapper.hpp"
+#include "FFmpegCodecPlugin.h"
+#include "adaption/Logging.h"
+#include "adaption/Tracing.h"
+#include "adaption/Probes.h"
+#include "Bitstream.h"
+#include "FFmpegScheduler.h"
+#include "FFmpegSnapshot.h"
+#include "FFmpegSharedRing.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+extern "C"
+{
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+}
+
+using namespace ffmpeg;
+
+inline NVIBufferType GetHWBufferType(NVIAccelType eAccelType)
+{
+    switch (eAccelType)
+    {
+    case NVIAccel_NVCodec: return NVIBuffer_CUDA;
+    case NVIAccel_DXVA2: return NVIBuffer_D3DSurface9;
+    case NVIAccel_D3D11VA: return NVIBuffer_D3D11Texture2D;
+    case NVIAccel_VideoToolbox: return NVIBuffer_CVPixelBufferRef;
+    case NVIAccel_MediaCodec: return NVIBuffer_MediaCodecBuffer;
+    case NVIAccel_VAAPI: return NVIBuffer_VASurfaceID;
+    default: return NVIBuffer_HOST;
+    }
+}
+
+AVPixelFormat GetHWFormat(AVCodecContext* ctx, const enum AVPixelFormat* fmts)
+{
+    FFVideoDecoder* pDelegate = (FFVideoDecoder*)ctx->opaque;
+    if (pDelegate)
+    {
+        AVPixelFormat fmt = (AVPixelFormat)pDelegate->HWPixelFormat();
+        for (auto p = fmts; *p != -1; p++)
+        {
+            if (*p == fmt)
+            {
+                return fmt;
+            }
+        }
+    }
+    return fmts ? *fmts : AV_PIX_FMT_NONE;
+}
+
+// 软件解码器对给定色度格式和位深输出的像素格式，不常见的组合不预分配
+AVPixelFormat SoftwareFormat(const bitstream::SequenceInfo& info)
+{
+    static const AVPixelFormat s_arrFormats[3][2] = {
+        {AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV420P10LE},
+        {AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV422P10LE},
+        {AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV444P10LE},
+    };
+    if (info.chroma_format < 1 || info.chroma_format > 3 || (info.bit_depth != 8 && info.bit_depth != 10))
+    {
+        return AV_PIX_FMT_NONE;
+    }
+    return s_arrFormats[info.chroma_format - 1][info.bit_depth == 10 ? 1 : 0];
+}
+
+int GetFrameBuffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+{
+    FFVideoDecoder* pDelegate = (FFVideoDecoder*)ctx->opaque;
+    if (pDelegate && pDelegate->Pool())
+    {
+        return pDelegate->Pool()->GetBuffer(ctx, frame, flags);
+    }
+    return avcodec_default_get_buffer2(ctx, frame, flags);
+}
+
+AVPixelFormat GetHWDownloadFormat(AVBufferRef* ctx)
+{
+    AVPixelFormat format = AV_PIX_FMT_NONE;
+    AVPixelFormat* arrFormats = nullptr;
+    int nGetFormats = av_hwframe_transfer_get_formats(ctx, AVHWFrameTransferDirection::AV_HWFRAME_TRANSFER_DIRECTION_FROM, &arrFormats, 0);
+    if (nGetFormats >= 0 && arrFormats)
+    {
+        format = arrFormats[0];
+        av_freep(&arrFormats);
+    }
+    else
+    {
+        LOG_ERROR("av_hwframe_transfer_get_formats failed {}, {}.", nGetFormats, av_errstr(nGetFormats));
+    }
+    return format;
+}
+
+#ifdef _NVCODEC
+#define FFNV_LOG_FUNC(ctx, fmt, ...)
+#define FFNV_DEBUG_LOG_FUNC(ctx, fmt, ...)
+#include <dynlink_loader.h>
+#define ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+
+class CudaHostModule
+{
+public:
+    static CudaHostFunctions* Functions()
+    {
+        static CudaHostModule m;
+        return m.m_pFunctions;
+    }
+
+private:
+    CudaHostModule()
+    {
+        cuda_host_load_functions(&m_pFunctions, nullptr);
+        LOG_INFO("Load cuda host functions {}.", (void*)m_pFunctions);
+    }
+    ~CudaHostModule()
+    {
+        cuda_host_free_functions(&m_pFunctions);
+    }
+
+private:
+    CudaHostFunctions* m_pFunctions;
+};
+
+static void FreeCudaHost(void* opaque, uint8_t* data)
+{
+    if (opaque && data)
+    {
+        CudaHostFunctions* cuda = reinterpret_cast<CudaHostFunctions*>(opaque);
+        cuda->cuMemFreeHost(data);
+        LOG_INFO("Free cuda host {}.", (void*)data);
+    }
+}
+
+// format为下载的像素格式，分配页锁定的主机帧
+static AVFrame* AllocHostAVFrame(CUcontext context, AVPixelFormat format, int width, int height)
+{
+    if (context == nullptr)
+    {
+        return nullptr;
+    }
+    // code reference get_video_buffer
+    if (av_image_check_size(width, height, 0, nullptr) < 0)
+    {
+        LOG_ERROR("Alloc host av_image_check_size({},{}) failed.", width, height);
+        return nullptr;
+    }
+    AVFrame* pFrame = AllocAVFrame().release();
+    if (pFrame == nullptr)
+    {
+        LOG_ERROR("Alloc host av_frame_alloc failed.");
+        return nullptr;
+    }
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (desc == nullptr)
+    {
+        LOG_ERROR("Alloc host not found pixel format[{}] descriptor.", (int32_t)format);
+        return pFrame;
+    }
+    CudaHostFunctions* cuda = CudaHostModule::Functions();
+    if (cuda)
+    {
+        // for page-locked host memory.
+        pFrame->format = format;
+        pFrame->width = width;
+        pFrame->height = height;
+        int nFill = av_image_fill_linesizes(pFrame->linesize, format, FFALIGN(width, 32));
+        if (nFill < 0)
+        {
+            LOG_ERROR("Alloc host call av_image_fill_linesizes failed {}.", nFill);
+            return pFrame;
+        }
+        ptrdiff_t linesizes[4]{};
+        for (int i = 0; i < 4; ++i)
+        {
+            linesizes[i] = pFrame->linesize[i];
+        }
+        const int padding = FFALIGN(height, 32);
+        size_t sizes[4]{};
+        nFill = av_image_fill_plane_sizes(sizes, format, padding, linesizes);
+        if (nFill < 0)
+        {
+            LOG_ERROR("Alloc host call av_image_fill_plane_sizes failed {}.", nFill);
+            return pFrame;
+        }
+        size_t bytes = 0ull;
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes += sizes[i];
+        }
+        uint8_t* pMem = nullptr;
+        cuda->cuCtxPushCurrent(context);
+        CUresult result = cuda->cuMemHostAlloc(reinterpret_cast<void**>(&pMem), bytes, 0);
+        if (result == CUDA_SUCCESS && pMem)
+        {
+            LOG_INFO("Cuda host alloc {}@{}.", (void*)pMem, bytes);
+            pFrame->buf[0] = av_buffer_create(pMem, bytes, &FreeCudaHost, cuda, 0);
+            nFill = av_image_fill_pointers(pFrame->data, format, padding, pMem, pFrame->linesize);
+            if (nFill < 0)
+            {
+                LOG_ERROR("Alloc host call av_image_fill_pointers failed {}.", nFill);
+            }
+        }
+        else
+        {
+            LOG_ERROR("Cuda host alloc failed {}.", (int32_t)result);
+        }
+        cuda->cuCtxPopCurrent(nullptr);
+    }
+    return pFrame;
+}
+
+static AVFrame* AllocHostAVFrame(AVBufferRef* ref, int width, int height)
+{
+    if (ref == nullptr)
+    {
+        return nullptr;
+    }
+    CUcontext context = reinterpret_cast<CUcontext>(CudaContext(reinterpret_cast<AVHWFramesContext*>(ref->data)));
+    return context ? AllocHostAVFrame(context, GetHWDownloadFormat(ref), width, height) : nullptr;
+}
+#else
+#define AllocHostAVFrame(...) (nullptr)
+#endif
+
+namespace
+{
+// 定期检查开启了休眠的解码器
+class IdleReaper final
+{
+public:
+    // 不析构，同LoggingDispatcher：线程由Shutdown在插件卸载之前停止
+    static IdleReaper& Instance()
+    {
+        static IdleReaper* s_pReaper = new IdleReaper();
+        return *s_pReaper;
+    }
+
+    void Add(FFVideoDecoder* pDecoder)
+    {
+        std::lock_guard<std::mutex> lock(m_mtxDecoders);
+        if (std::find(m_vecDecoders.begin(), m_vecDecoders.end(), pDecoder) == m_vecDecoders.end())
+        {
+            m_vecDecoders.push_back(pDecoder);
+        }
+        if (!m_thread.joinable())
+        {
+            m_thread = std::thread(&IdleReaper::Run, this);
+        }
+    }
+
+    // 返回后后台线程不会再访问该解码器
+    void Remove(FFVideoDecoder* pDecoder)
+    {
+        std::lock_guard<std::mutex> lock(m_mtxDecoders);
+        m_vecDecoders.erase(std::remove(m_vecDecoders.begin(), m_vecDecoders.end(), pDecoder), m_vecDecoders.end());
+    }
+
+    // 停止并等待后台线程，之后有解码器开启休眠时重新启动
+    void Shutdown()
+    {
+        std::thread thread;
+        {
+            std::lock_guard<std::mutex> lock(m_mtxDecoders);
+            m_bStop = true;
+            thread.swap(m_thread);
+        }
+        m_cvStop.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        std::lock_guard<std::mutex> lock(m_mtxDecoders);
+        m_bStop = false;
+    }
+
+private:
+    IdleReaper()
+        : m_bStop(false)
+    {
+    }
+    ~IdleReaper() = delete;
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(m_mtxDecoders);
+        while (!m_cvStop.wait_for(lock, std::chrono::seconds(1), [this]() { return m_bStop; }))
+        {
+            const auto now = std::chrono::steady_clock::now();
+            for (FFVideoDecoder* pDecoder : m_vecDecoders)
+            {
+                pDecoder->TryHibernate(now);
+            }
+        }
+    }
+
+private:
+    std::mutex m_mtxDecoders;
+    std::condition_variable m_cvStop;
+    std::vector<FFVideoDecoder*> m_vecDecoders;
+    std::thread m_thread;
+    bool m_bStop;
+};
+}  // namespace
+
+FFVideoDecoder::FFVideoDecoder()
+    : m_uId(NextDecoderId())
+    , m_pDecoderContext(nullptr)
+    , m_nHWPixelFormat(-1)
+    , m_eOutBufferType(NVIBuffer_HOST)
+    , m_pLastFrame(nullptr, &FreeAVFrame)
+    , m_pHostFrame(nullptr, &FreeAVFrame)
+    , m_pConvertedFrame(nullptr, &FreeAVFrame)
+    , m_pFramePool(nullptr, &ReleaseFramePool)
+    , m_uCodec(0)
+    , m_bSteady(true)
+    , m_nThreads(-1)
+    , m_nCallerCpuUs(0)
+    , m_nWorkerCpuUs(-1)
+    , m_uLoadFrames(0)
+    , m_uLoadGops(0)
+    , m_fLoad(0.0)
+    , m_fIntervalUs(0.0)
+    , m_uSamples(0)
+    , m_nFirstFrameUs(-1)
+    , m_uFrames(0)
+    , m_uSteadyFrames(0)
+    , m_pCodec(nullptr)
+    , m_bHibernated(false)
+    , m_bResuming(false)
+    , m_nResumeUs(-1)
+    , m_uHibernations(0)
+    , m_uHibernateDropped(0)
+    , m_allocator{}
+    , m_pSharedRing(nullptr, &ReleaseSharedRing)
+    , m_nKeyframePts(AV_NOPTS_VALUE)
+    , m_uKeyframeCodec(0)
+    , m_snapshot{}
+    , m_nBandPts(AV_NOPTS_VALUE)
+    , m_bBandFallback(false)
+    , m_uPresizeBytes(0)
+    , m_pTicket(nullptr)
+{
+}
+
+FFVideoDecoder::~FFVideoDecoder()
+{
+    IdleReaper::Instance().Remove(this);
+    AllocStats::Scope scope(m_pAllocStats.get());
+    Release();
+    m_pLastFrame.reset();
+    m_pHostFrame.reset();
+    m_pConvertedFrame.reset();
+}
+
+bool FFVideoDecoder::Config(const NVIVideoCodecParam& param)
+{
+    if (m_pAllocStats == nullptr && AllocStats::Enabled())
+    {
+        m_pAllocStats = std::make_shared<AllocStats>();
+    }
+    {
+        std::lock_guard<std::mutex> lockStream(m_mtxStream);
+        m_splitter.Reset(param.codec);
+    }
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    AllocStats::Scope scope(m_pAllocStats.get());
+    Release();
+    auto pDecoder = FindVideoDecoder(param.codec, param.accel && param.accel->type > NVIAccel_Auto);
+    if (pDecoder == nullptr)
+    {
+        return false;
+    }
+    m_pDecoderContext = avcodec_alloc_context3(pDecoder);
+    if (m_pDecoderContext)
+    {
+        if (!HWAccelContextInit(param.accel))
+        {
+            avcodec_free_context(&m_pDecoderContext);
+            return false;
+        }
+        m_uCodec = param.codec;
+        // 混合模式只对软件解码的H264/HEVC生效，切换点需要识别IDR
+        m_bSteady = m_options.threading != Threading_Hybrid || m_nHWPixelFormat != -1 || (param.codec != NVICodec_AVC && param.codec != NVICodec_HEVC);
+        m_vecParameterSets.clear();
+        bitstream::SequenceInfo sSequence{};
+        const bool bSequence = ParseExtradata(sSequence);
+        {
+            std::lock_guard<std::mutex> lockSnapshot(m_mtxSnapshot);
+            m_pKeyframe.reset();
+            m_snapshot = SnapshotCache{};
+        }
+        m_nFirstFrameUs = -1;
+        m_uFrames = 0;
+        m_uSteadyFrames = 0;
+        m_nThreads = m_options.threads;
+        if (m_nThreads < 0 && m_options.qos == QoS_Background)
+        {
+            // 后台流不占用额外的线程
+            m_nThreads = 1;
+        }
+        if (m_nThreads < 0 && (param.codec == FF_CODEC_VP9 || param.codec == FF_CODEC_AV1))
+        {
+            // FFmpeg默认单线程，VP9/AV1单线程跟不上实时，未设置时按CPU核数
+            m_nThreads = 0;
+        }
+        if (AdaptiveThreads())
+        {
+            // 自适应从给定线程数开始，未给定时从单线程开始
+            m_nThreads = std::min(std::max(m_options.threads, 1), m_options.adaptive_threads);
+        }
+        m_nCallerCpuUs = 0;
+        m_nWorkerCpuUs = -1;
+        m_uLoadGops = 0;
+        m_fLoad = 0.0;
+        m_fIntervalUs = 0.0;
+        m_uSamples = 0;
+        m_analytics.Reset();
+        static const int32_t s_arrPriority[QoS_Count] = {Overload::kMaxPriority, 2, 0};
+        m_overload.Reset(m_uId, m_options.priority >= 0 ? m_options.priority : s_arrPriority[m_options.qos]);
+        if (m_nHWPixelFormat == -1)
+        {
+            ApplyThreading(m_pDecoderContext, m_bSteady);
+            ApplyBandOutput(m_pDecoderContext);
+        }
+        if (m_options.shared_ring_bytes > 0 && m_nHWPixelFormat == -1 && m_pSharedRing == nullptr)
+        {
+            // 重新Config时保留已有的段，消费者持有的fd不变
+            m_pSharedRing.reset(SharedRing::Create(m_uId, static_cast<uint64_t>(m_options.shared_ring_bytes), static_cast<uint32_t>(m_options.shared_ring_frames),
+                                                  static_cast<uint32_t>(m_options.shared_ring_lease_ms)));
+        }
+        if (m_pAllocStats || MemoryBudget::Instance().Limited() || FramePool::GetHugePages() != FramePool::HugePages_None || m_allocator.alloc || m_pSharedRing ||
+            (bSequence && m_nHWPixelFormat == -1))
+        {
+            // 统计、内存预算、大页、宿主分配、共享内存或预分配模式下由插件分配软件帧
+            m_pFramePool.reset(FramePool::Create(m_pAllocStats));
+            m_pFramePool->SetAllocator(m_pSharedRing ? m_pSharedRing->Allocator() : m_allocator);
+            m_pDecoderContext->opaque = this;
+            m_pDecoderContext->get_buffer2 = GetFrameBuffer;
+        }
+        if (m_pDecoderContext->codec)
+        {
+            LOG_NOTICE("FFVideoDecoder init {}, {}.", m_pDecoderContext->codec->name, m_pDecoderContext->codec->long_name);
+        }
+        if (m_options.gray)
+        {
+            // 需要FFmpeg以--enable-gray编译才会跳过色度重建，否则只省去插件侧的色度处理
+            m_pDecoderContext->flags |= AV_CODEC_FLAG_GRAY;
+        }
+        if (m_options.export_mvs)
+        {
+            // libavcodec的H264解码器支持导出，HEVC解码器不导出，帧上没有运动矢量
+            m_pDecoderContext->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+        }
+        m_uPresizeBytes = 0;
+        if (bSequence)
+        {
+            Presize(sSequence);
+        }
+        m_tpConfig = std::chrono::steady_clock::now();
+        m_tpSteady = m_tpConfig;
+        if (AdaptiveThreads())
+        {
+            m_threadClock.Begin();
+        }
+        int nOpen = avcodec_open2(m_pDecoderContext, nullptr, nullptr);
+        m_threadClock.End();
+        if (nOpen == 0)
+        {
+            m_tpActive = m_tpConfig;
+            m_nResumeUs = -1;
+            const bool bParallel = m_nHWPixelFormat == -1 && StartParallel(pDecoder);
+            if (m_options.hibernate_ms > 0 && m_nHWPixelFormat == -1 && !bParallel)
+            {
+                IdleReaper::Instance().Add(this);
+            }
+            return true;
+        }
+        else
+        {
+            LOG_ERROR("FFVideoDecoder avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+            avcodec_free_context(&m_pDecoderContext);
+        }
+    }
+    return false;
+}
+
+bool FFVideoDecoder::Decoding(const NVIVideoEncodedPacket& packet, const Output& output)
+{
+    return Decoding(packet, m_options.deadline_us, output);
+}
+
+bool FFVideoDecoder::DecodingStream(const uint8_t* data, size_t size, int64_t pts, bool end, const Output& output)
+{
+    std::lock_guard<std::mutex> lock(m_mtxStream);
+    bool bResult = true;
+    auto emit = [this, &output, &bResult](const uint8_t* au, size_t au_size, int64_t au_pts, AVBufferRef* buffer)
+    {
+        NVIVideoEncodedPacket packet{};
+        packet.info.tick.value = au_pts != bitstream::AccessUnitSplitter::kNoPts ? au_pts : AV_NOPTS_VALUE;
+        packet.buffer.bytes = au;
+        packet.buffer.size = au_size;
+        bResult = Decoding(packet, m_options.deadline_us, buffer, output) && bResult;
+    };
+    if (!m_splitter.Push(data, size, pts, end, emit))
+    {
+        LOG_ERROR("FFVideoDecoder#{} stream buffer allocation failed, pending access unit dropped.", m_uId);
+        return false;
+    }
+    return bResult;
+}
+
+bool FFVideoDecoder::Decoding(const NVIVideoEncodedPacket& packet, int64_t budget, const Output& output)
+{
+    return Decoding(packet, budget, nullptr, output);
+}
+
+bool FFVideoDecoder::Decoding(const NVIVideoEncodedPacket& packet, int64_t budget, AVBufferRef* buffer, const Output& output)
+{
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    AllocStats::Scope scope(m_pAllocStats.get());
+    Scheduler::Ticket ticket(static_cast<QoSClass>(m_options.qos));
+    m_pTicket = &ticket;
+    const bool bResult = DecodePacket(packet, budget, buffer, output);
+    m_pTicket = nullptr;
+    return bResult;
+}
+
+bool FFVideoDecoder::DecodePacket(const NVIVideoEncodedPacket& packet, int64_t budget, AVBufferRef* buffer, const Output& output)
+{
+    m_tpActive = std::chrono::steady_clock::now();
+    if (m_bHibernated && !Resume(packet))
+    {
+        // 休眠中丢弃关键帧之前的包
+        return true;
+    }
+    if (m_pDecoderContext == nullptr)
+    {
+        return false;
+    }
+    if (avcodec_is_open(m_pDecoderContext))
+    {
+        auto pPacket(AllocAVPacket());
+        if (pPacket == nullptr)
+        {
+            return false;
+        }
+        pPacket->data = (uint8_t*)packet.buffer.bytes;
+        pPacket->size = (int)packet.buffer.size;
+        // 引用计数的包avcodec_send_packet直接引用；引用失败时按普通包拷贝
+        pPacket->buf = buffer ? av_buffer_ref(buffer) : nullptr;
+        pPacket->pts = packet.info.tick.value;
+        pPacket->dts = pPacket->pts;
+        m_nBandPts = pPacket->pts;
+        av_frame_unref(m_pLastFrame.get());
+        const bool bAdaptive = AdaptiveThreads() && m_nHWPixelFormat == -1;
+        const bool bKeep = m_options.snapshot && (m_uCodec == NVICodec_AVC || m_uCodec == NVICodec_HEVC);
+        if ((!m_bSteady || bAdaptive || bKeep) && packet.buffer.bytes && packet.buffer.size > 0)
+        {
+            const bool bIDR = IsKeyframe(reinterpret_cast<const uint8_t*>(packet.buffer.bytes), packet.buffer.size);
+            if (bIDR && bKeep)
+            {
+                KeepKeyframe(packet);
+            }
+            // 线程模型只能在打开解码器时确定，都在IDR处重建解码器
+            if (bIDR && m_uFrames > 0)
+            {
+                const int32_t nThreads = bAdaptive ? NextThreadCount() : m_nThreads;
+                if (!m_bSteady || nThreads != m_nThreads)
+                {
+                    ReopenContext(packet.info, output, nThreads);
+                }
+            }
+        }
+        const auto tpBegin = std::chrono::steady_clock::now();
+        if (bAdaptive && m_uSamples > 0)
+        {
+            const double fInterval = std::chrono::duration<double, std::micro>(tpBegin - m_tpArrival).count();
+            m_fIntervalUs += (fInterval - m_fIntervalUs) / 16.0;
+        }
+        m_tpArrival = tpBegin;
+        // 自适应按CPU时间估计负载，帧并行时调用线程在send中的等待只是排队，不计入
+        int64_t nCpuUs = 0;
+        m_overload.Submit(pPacket->pts, budget);
+        const int32_t nDiscard = m_overload.Discard();
+        if (nDiscard != m_pDecoderContext->skip_frame)
+        {
+            // 从只解关键帧恢复时，参考帧已缺失，要等到下一个IDR
+            const bool bKeyOnly = m_pDecoderContext->skip_frame >= AVDISCARD_NONKEY && nDiscard < AVDISCARD_NONKEY;
+            if (!bKeyOnly || (m_uCodec != NVICodec_AVC && m_uCodec != NVICodec_HEVC) ||
+                bitstream::HasIDR(m_uCodec, pPacket->data, static_cast<size_t>(pPacket->size)))
+            {
+                m_pDecoderContext->skip_frame = static_cast<AVDiscard>(nDiscard);
+            }
+        }
+        if (m_pParallel)
+        {
+            return DecodingParallel(pPacket.get(), packet.info, output);
+        }
+        int nSend = 0;
+        PROBE3(video_packet_submit, m_uId, pPacket->pts, pPacket->size);
+        {
+            TRACE_SCOPE("avcodec_send_packet", m_uId, pPacket->pts);
+            const int64_t nCpuBegin = bAdaptive ? ThreadClock::CurrentThreadCpuUs() : 0;
+            nSend = avcodec_send_packet(m_pDecoderContext, pPacket.get());
+            nCpuUs += bAdaptive ? ThreadClock::CurrentThreadCpuUs() - nCpuBegin : 0;
+        }
+        if (nSend == 0)
+        {
+            int nRecv = 0;
+            uint32_t uOut = 0U;
+            while (nRecv >= 0)
+            {
+                auto pFrame = AllocAVFrame();
+                if (pFrame == nullptr)
+                {
+                    LOG_ERROR("av_frame_alloc failed!");
+                    return false;
+                }
+                {
+                    TRACE_SCOPE("avcodec_receive_frame", m_uId, pPacket->pts);
+                    const int64_t nCpuBegin = bAdaptive ? ThreadClock::CurrentThreadCpuUs() : 0;
+                    nRecv = avcodec_receive_frame(m_pDecoderContext, pFrame.get());
+                    nCpuUs += bAdaptive ? ThreadClock::CurrentThreadCpuUs() - nCpuBegin : 0;
+                }
+                if (nRecv >= 0)
+                {
+                    ++uOut;
+                    CountFrame();
+                    PROBE5(video_frame_ready, m_uId, pFrame->pts, pFrame->width, pFrame->height, pFrame->format);
+                    m_pLastFrame = std::move(pFrame);
+                    OutputLastFrame(packet.info, output);
+                }
+                else
+                {
+                    if (nRecv == AVERROR(EAGAIN))
+                    {
+                        if (bAdaptive)
+                        {
+                            // 只统计解码，不含输出回调；工作线程的CPU时间在NextThreadCount中按GOP采样
+                            m_nCallerCpuUs += nCpuUs;
+                            ++m_uSamples;
+                        }
+                        if (uOut == 0u)
+                        {
+                            LOG_WARNING("FFVideoDecoder avcodec_receive_frame delay!!!!");
+                        }
+                        break;
+                    }
+                    else
+                    {
+                        LOG_ERROR("FFVideoDecoder avcodec_receive_frame failed {}, {}.", nRecv, av_errstr(nRecv));
+                        return false;
+                    }
+                }
+            }
+        }
+        else
+        {
+            LOG_ERROR("FFVideoDecoder avcodec_send_packet failed {}, {}.", nSend, av_errstr(nSend));
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool FFVideoDecoder::SetOption(const char* name, int64_t value)
+{
+    if (name == nullptr)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    if (strcmp(name, "threads") == 0)
+    {
+        m_options.threads = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "threading") == 0 && value >= Threading_Default && value <= Threading_Hybrid)
+    {
+        m_options.threading = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "adaptive_threads") == 0 && value >= 0)
+    {
+        m_options.adaptive_threads = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "frame_interval_us") == 0 && value >= 0)
+    {
+        m_options.frame_interval_us = value;
+        return true;
+    }
+    if (strcmp(name, "deadline_us") == 0 && value >= 0)
+    {
+        m_options.deadline_us = value;
+        return true;
+    }
+    if (strcmp(name, "priority") == 0 && value >= 0 && value <= Overload::kMaxPriority)
+    {
+        m_options.priority = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "qos") == 0 && value >= QoS_Realtime && value < QoS_Count)
+    {
+        m_options.qos = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "hibernate_ms") == 0 && value >= 0)
+    {
+        m_options.hibernate_ms = value;
+        return true;
+    }
+    if (strcmp(name, "gray") == 0)
+    {
+        m_options.gray = value != 0;
+        return true;
+    }
+    if (strcmp(name, "export_mvs") == 0)
+    {
+        m_options.export_mvs = value != 0;
+        return true;
+    }
+    if (strcmp(name, "mv_grid") == 0 && value >= 0 && value <= INT16_MAX)
+    {
+        m_options.mv_grid = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "motion_only") == 0)
+    {
+        m_options.motion_only = value != 0;
+        return true;
+    }
+    if (strcmp(name, "analytics_step") == 0 && value >= 0 && value <= INT16_MAX)
+    {
+        m_options.analytics_step = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "snapshot") == 0)
+    {
+        m_options.snapshot = value != 0;
+        return true;
+    }
+    if (strcmp(name, "band_output") == 0)
+    {
+        m_options.band_output = value != 0;
+        return true;
+    }
+    if (strcmp(name, "shared_ring_bytes") == 0 && value >= 0)
+    {
+        m_options.shared_ring_bytes = value;
+        return true;
+    }
+    if (strcmp(name, "shared_ring_frames") == 0 && value > 0 && value <= UINT16_MAX)
+    {
+        m_options.shared_ring_frames = static_cast<int32_t>(value);
+        return true;
+    }
+    if (strcmp(name, "shared_ring_lease_ms") == 0 && value >= 0 && value <= UINT32_MAX)
+    {
+        m_options.shared_ring_lease_ms = value;
+        return true;
+    }
+    return false;
+}
+
+bool FFVideoDecoder::GetStat(const char* name, double& value) const
+{
+    if (name == nullptr)
+    {
+        return false;
+    }
+    // 只有字节流统计需要切分锁，其他统计不等待正在切分的调用
+    if (strcmp(name, "stream_direct_bytes") == 0)
+    {
+        std::lock_guard<std::mutex> lockStream(m_mtxStream);
+        value = static_cast<double>(m_splitter.DirectBytes());
+        return true;
+    }
+    if (strcmp(name, "stream_copied_bytes") == 0)
+    {
+        std::lock_guard<std::mutex> lockStream(m_mtxStream);
+        value = static_cast<double>(m_splitter.CopiedBytes());
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    if (strcmp(name, "ttff_us") == 0)
+    {
+        value = static_cast<double>(m_nFirstFrameUs);
+        return true;
+    }
+    if (strcmp(name, "fps") == 0)
+    {
+        // 稳态帧率：混合模式从切换到帧并行开始统计，否则从首帧开始
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_tpSteady).count();
+        value = seconds > 0.0 && m_bSteady ? static_cast<double>(m_uSteadyFrames) / seconds : 0.0;
+        return true;
+    }
+    if (strcmp(name, "threads") == 0)
+    {
+        value = m_pDecoderContext ? static_cast<double>(m_pDecoderContext->thread_count) : 0.0;
+        return true;
+    }
+    if (strcmp(name, "decode_load") == 0)
+    {
+        const double fInterval = m_options.frame_interval_us > 0 ? static_cast<double>(m_options.frame_interval_us) : m_fIntervalUs;
+        value = fInterval > 0.0 ? m_fLoad : 0.0;
+        return true;
+    }
+    if (strcmp(name, "skip_level") == 0)
+    {
+        value = static_cast<double>(m_overload.Level());
+        return true;
+    }
+    if (strcmp(name, "lag_us") == 0)
+    {
+        value = m_overload.LagUs();
+        return true;
+    }
+    if (strcmp(name, "dropped_late") == 0)
+    {
+        value = static_cast<double>(m_overload.DroppedLate());
+        return true;
+    }
+    if (strcmp(name, "dropped_decode") == 0)
+    {
+        value = static_cast<double>(m_overload.DroppedDecode());
+        return true;
+    }
+    if (strcmp(name, "hibernated") == 0)
+    {
+        value = m_bHibernated ? 1.0 : 0.0;
+        return true;
+    }
+    if (strcmp(name, "hibernations") == 0)
+    {
+        value = static_cast<double>(m_uHibernations);
+        return true;
+    }
+    if (strcmp(name, "resume_us") == 0)
+    {
+        value = static_cast<double>(m_nResumeUs);
+        return true;
+    }
+    if (strcmp(name, "hibernate_dropped") == 0)
+    {
+        value = static_cast<double>(m_uHibernateDropped);
+        return true;
+    }
+    if (strcmp(name, "shared_published") == 0)
+    {
+        value = m_pSharedRing ? static_cast<double>(m_pSharedRing->Published()) : 0.0;
+        return true;
+    }
+    if (strcmp(name, "shared_dropped") == 0)
+    {
+        value = m_pSharedRing ? static_cast<double>(m_pSharedRing->Dropped()) : 0.0;
+        return true;
+    }
+    if (strcmp(name, "presize_bytes") == 0)
+    {
+        value = static_cast<double>(m_uPresizeBytes);
+        return true;
+    }
+    if (strcmp(name, "frame_threading") == 0)
+    {
+        value = m_pDecoderContext && (m_pDecoderContext->active_thread_type & FF_THREAD_FRAME) ? 1.0 : 0.0;
+        return true;
+    }
+    return false;
+}
+
+void FFVideoDecoder::ApplyThreading(AVCodecContext* ctx, bool steady) const
+{
+    if (m_nThreads >= 0)
+    {
+        ctx->thread_count = m_nThreads;
+    }
+    switch (m_options.threading)
+    {
+    case Threading_Slice: ctx->thread_type = FF_THREAD_SLICE; break;
+    case Threading_Frame: ctx->thread_type = FF_THREAD_FRAME; break;
+    case Threading_Hybrid:
+        if (steady)
+        {
+            ctx->thread_type = FF_THREAD_FRAME;
+        }
+        else
+        {
+            // 帧并行会带来thread_count-1帧的延迟，启动阶段只用片并行
+            ctx->thread_type = FF_THREAD_SLICE;
+            ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        }
+        break;
+    default: break;
+    }
+    if (ctx->codec && ctx->priv_data && strcmp(ctx->codec->name, "libdav1d") == 0 && ctx->thread_type == FF_THREAD_SLICE)
+    {
+        // libdav1d不看thread_type，线程数由thread_count给出；片并行对应不做帧延迟，只在帧内按分块并行
+        av_opt_set_int(ctx->priv_data, "max_frame_delay", 1, 0);
+    }
+}
+
+bool FFVideoDecoder::StartParallel(const AVCodec* codec)
+{
+    if (m_uCodec != FF_CODEC_MJPEG)
+    {
+        return false;
+    }
+    // libavcodec的mjpeg解码器没有帧并行，帧之间无依赖，由插件把包分给多个单线程上下文
+    uint32_t uWorkers = static_cast<uint32_t>(m_nThreads);
+    if (m_nThreads <= 0)
+    {
+        uWorkers = std::min(std::max(std::thread::hardware_concurrency(), 1u), 16u);
+    }
+    if (uWorkers <= 1)
+    {
+        return false;
+    }
+    auto setup = [this](AVCodecContext* ctx)
+    {
+        if (m_pFramePool)
+        {
+            ctx->opaque = this;
+            ctx->get_buffer2 = GetFrameBuffer;
+        }
+        if (m_options.gray)
+        {
+            ctx->flags |= AV_CODEC_FLAG_GRAY;
+        }
+    };
+    m_pParallel.reset(new IntraParallel());
+    if (!m_pParallel->Start(codec, uWorkers, setup))
+    {
+        LOG_WARNING("FFVideoDecoder#{} start {} parallel workers failed, fallback to single context.", m_uId, uWorkers);
+        m_pParallel.reset();
+        return false;
+    }
+    LOG_INFO("FFVideoDecoder#{} {} parallel workers.", m_uId, m_pParallel->Workers());
+    return true;
+}
+
+bool FFVideoDecoder::DecodingParallel(const AVPacket* packet, const NVIImageInfo& info, const Output& output)
+{
+    auto emit = [this, &info, &output](AVFrame* frame)
+    {
+        auto pFrame = AllocAVFrame();
+        if (pFrame == nullptr)
+        {
+            LOG_ERROR("av_frame_alloc failed!");
+            return;
+        }
+        av_frame_move_ref(pFrame.get(), frame);
+        CountFrame();
+        PROBE5(video_frame_ready, m_uId, pFrame->pts, pFrame->width, pFrame->height, pFrame->format);
+        m_pLastFrame = std::move(pFrame);
+        OutputLastFrame(info, output);
+    };
+    if (packet->data == nullptr || packet->size <= 0)
+    {
+        // 空包排空所有在途的帧
+        m_pParallel->Drain(emit);
+        return true;
+    }
+    PROBE3(video_packet_submit, m_uId, packet->pts, packet->size);
+    if (!m_pParallel->Submit(packet, emit))
+    {
+        LOG_ERROR("FFVideoDecoder#{} submit parallel packet failed.", m_uId);
+        return false;
+    }
+    return true;
+}
+
+void FFVideoDecoder::ApplyBandOutput(AVCodecContext* ctx)
+{
+    m_bBandFallback = false;
+    if (!m_options.band_output)
+    {
+        return;
+    }
+    // h264解码器在片并行下逐宏块行回调，但没有声明该能力；其余不回调的解码器在整帧解出后按行带补发
+    m_bBandFallback = ctx->codec == nullptr || ((ctx->codec->capabilities & AV_CODEC_CAP_DRAW_HORIZ_BAND) == 0 && ctx->codec->id != AV_CODEC_ID_H264);
+    if (m_bBandFallback)
+    {
+        LOG_INFO("FFVideoDecoder#{} {} has no band callback, bands follow whole frames.", m_uId, ctx->codec ? ctx->codec->name : "");
+        return;
+    }
+    // 帧并行和帧重排时解码器不回调，只用片并行并关闭重排延迟
+    ctx->opaque = this;
+    ctx->draw_horiz_band = DrawHorizBand;
+    ctx->slice_flags = SLICE_FLAG_CODED_ORDER;
+    ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    ctx->thread_type = FF_THREAD_SLICE;
+}
+
+bool FFVideoDecoder::CollectParameterSets(const uint8_t* data, size_t size)
+{
+    bool bIDR = false;
+    bitstream::ForEachNAL(data, size,
+                          [this, &bIDR](const uint8_t* nal, size_t length) -> bool
+                          {
+                              const uint8_t type = bitstream::NALType(m_uCodec, nal);
+                              if (bitstream::IsSlice(m_uCodec, type))
+                              {
+                                  // 参数集在图像数据之前，之后不必再扫描
+                                  bIDR = bitstream::IsIDR(m_uCodec, type);
+                                  return false;
+                              }
+                              if (bitstream::IsParameterSet(m_uCodec, type))
+                              {
+                                  // 按类型和id只保留最新的一个，流中可以有多个SPS/PPS
+                                  bitstream::StoreParameterSet(m_uCodec, m_vecParameterSets, nal, length);
+                              }
+                              return true;
+                          });
+    return bIDR;
+}
+
+bool FFVideoDecoder::IsKeyframe(const uint8_t* data, size_t size)
+{
+    switch (m_uCodec)
+    {
+    case NVICodec_AVC:
+    case NVICodec_HEVC: return CollectParameterSets(data, size);
+    case FF_CODEC_VP9: return bitstream::IsVP9Keyframe(data, size);
+    case FF_CODEC_AV1: return bitstream::IsAV1Keyframe(data, size);
+    default: return false;
+    }
+}
+
+bool FFVideoDecoder::AdaptiveThreads() const
+{
+    // 只在关键帧处重建解码器，需要能识别关键帧；MJPEG按帧并行，不自适应
+    return m_options.adaptive_threads > 0 &&
+           (m_uCodec == NVICodec_AVC || m_uCodec == NVICodec_HEVC || m_uCodec == FF_CODEC_VP9 || m_uCodec == FF_CODEC_AV1);
+}
+
+int32_t FFVideoDecoder::NextThreadCount()
+{
+    // 每个GOP采样一次：调用线程和解码上下文工作线程的CPU时间之和，按帧平均后与帧间隔相比，为需要的核数
+    constexpr uint32_t kMinGops = 4;    // 两次调整之间至少间隔的GOP数
+    constexpr double kTarget = 0.6;     // 调整后每个线程的目标占用
+    constexpr double kHigh = 0.8;       // 占用超过时增加线程
+    constexpr double kLow = 0.5;        // 减少一个线程后占用仍低于时减少
+    const double fInterval = m_options.frame_interval_us > 0 ? static_cast<double>(m_options.frame_interval_us) : m_fIntervalUs;
+    const int64_t nWorkerCpuUs = m_threadClock.CpuUs();
+    const uint64_t uFrames = m_uFrames - m_uLoadFrames;
+    if (m_nWorkerCpuUs >= 0 && nWorkerCpuUs >= m_nWorkerCpuUs && uFrames > 0 && fInterval > 0.0)
+    {
+        const double fLoad = static_cast<double>(m_nCallerCpuUs + nWorkerCpuUs - m_nWorkerCpuUs) / static_cast<double>(uFrames) / fInterval;
+        m_fLoad = m_uLoadGops == 0 ? fLoad : m_fLoad + (fLoad - m_fLoad) / 4.0;
+        ++m_uLoadGops;
+    }
+    // 工作线程的时钟不可用（不支持的平台或刚重建上下文）时只重新取基准
+    m_nWorkerCpuUs = nWorkerCpuUs;
+    m_nCallerCpuUs = 0;
+    m_uLoadFrames = m_uFrames;
+    if (m_uLoadGops < kMinGops || m_uSamples < 32)
+    {
+        return m_nThreads;
+    }
+    const int32_t nThreads = std::max(m_nThreads, 1);
+    const int32_t nTarget = std::min(std::max(static_cast<int32_t>(std::ceil(m_fLoad / kTarget)), 1), m_options.adaptive_threads);
+    int32_t nNext = nThreads;
+    if (m_fLoad / nThreads > kHigh && nTarget > nThreads)
+    {
+        nNext = nTarget;
+    }
+    else if (nThreads > 1 && m_fLoad / (nThreads - 1) < kLow)
+    {
+        nNext = std::min(nTarget, nThreads - 1);
+    }
+    if (nNext != nThreads)
+    {
+        LOG_INFO("FFVideoDecoder#{} load {:.2f}, threads {} -> {}.", m_uId, m_fLoad, nThreads, nNext);
+        // 新上下文的线程重新计时，负载重新累计
+        m_nWorkerCpuUs = -1;
+        m_uLoadGops = 0;
+    }
+    return nNext;
+}
+
+void FFVideoDecoder::ApplyParameterSets(AVCodecContext* ctx) const
+{
+    size_t szExtra = 0;
+    for (const auto& vecNAL : m_vecParameterSets)
+    {
+        szExtra += vecNAL.size();
+    }
+    if (szExtra == 0)
+    {
+        return;
+    }
+    av_freep(&ctx->extradata);
+    ctx->extradata_size = 0;
+    ctx->extradata = static_cast<uint8_t*>(av_mallocz(szExtra + AV_INPUT_BUFFER_PADDING_SIZE));
+    if (ctx->extradata)
+    {
+        for (const auto& vecNAL : m_vecParameterSets)
+        {
+            memcpy(ctx->extradata + ctx->extradata_size, vecNAL.data(), vecNAL.size());
+            ctx->extradata_size += static_cast<int>(vecNAL.size());
+        }
+    }
+}
+
+bool FFVideoDecoder::ParseExtradata(bitstream::SequenceInfo& info)
+{
+    if (m_vecExtradata.empty() || (m_uCodec != NVICodec_AVC && m_uCodec != NVICodec_HEVC))
+    {
+        return false;
+    }
+    CollectParameterSets(m_vecExtradata.data(), m_vecExtradata.size());
+    const uint8_t uSPS = m_uCodec == NVICodec_HEVC ? static_cast<uint8_t>(bitstream::HEVC_NAL_SPS) : static_cast<uint8_t>(bitstream::H264_NAL_SPS);
+    for (const auto& vecNAL : m_vecParameterSets)
+    {
+        if (bitstream::NALType(m_uCodec, vecNAL.data() + 4) == uSPS)
+        {
+            if (bitstream::ParseSPS(m_uCodec, vecNAL.data() + 4, vecNAL.size() - 4, info))
+            {
+                return true;
+            }
+            LOG_WARNING("FFVideoDecoder#{} parse extradata sps failed.", m_uId);
+            return false;
+        }
+    }
+    LOG_WARNING("FFVideoDecoder#{} extradata without sps.", m_uId);
+    return false;
+}
+
+void FFVideoDecoder::Presize(const bitstream::SequenceInfo& info)
+{
+    // 打开时由解码器解析参数集，尺寸先行给出
+    ApplyParameterSets(m_pDecoderContext);
+    m_pDecoderContext->coded_width = static_cast<int>(info.coded_width);
+    m_pDecoderContext->coded_height = static_cast<int>(info.coded_height);
+    m_pDecoderContext->width = static_cast<int>(info.width);
+    m_pDecoderContext->height = static_cast<int>(info.height);
+    if (m_nHWPixelFormat == -1)
+    {
+        const AVPixelFormat eFormat = SoftwareFormat(info);
+        if (eFormat != AV_PIX_FMT_NONE && m_pFramePool)
+        {
+            // DPB、正在解码的帧和输出回调持有的帧，帧并行时每个额外线程各多一帧
+            uint32_t uFrames = info.dpb_size + 2;
+            int32_t nThreads = m_pDecoderContext->thread_count;
+            if (nThreads == 0)
+            {
+                // 打开前还是自动，按libavcodec的规则估计：CPU核数加1，最多16
+                const int32_t nCpus = av_cpu_count();
+                nThreads = nCpus > 1 ? std::min(nCpus + 1, 16) : 1;
+            }
+            if ((m_pDecoderContext->thread_type & FF_THREAD_FRAME) && nThreads > 1)
+            {
+                uFrames += static_cast<uint32_t>(nThreads - 1);
+            }
+            m_uPresizeBytes = m_pFramePool->Reserve(m_pDecoderContext, eFormat, static_cast<int32_t>(info.coded_width),
+                                                    static_cast<int32_t>(info.coded_height), uFrames);
+        }
+    }
+#ifdef _NVCODEC
+    else if (m_nHWPixelFormat == AV_PIX_FMT_CUDA && m_eOutBufferType == NVIBuffer_HOST && info.chroma_format == 1 && m_pDecoderContext->hw_device_ctx)
+    {
+        // NVDEC的4:2:0按位深下载为NV12或P010，下载用的页锁定内存先分配好
+        const AVPixelFormat eDownload = info.bit_depth > 8 ? AV_PIX_FMT_P010LE : AV_PIX_FMT_NV12;
+        CUcontext context = reinterpret_cast<CUcontext>(CudaContext(reinterpret_cast<AVHWDeviceContext*>(m_pDecoderContext->hw_device_ctx->data)));
+        m_pHostFrame.reset(AllocHostAVFrame(context, eDownload, static_cast<int>(info.width), static_cast<int>(info.height)));
+        if (m_pHostFrame && m_pHostFrame->buf[0])
+        {
+            m_uPresizeBytes = m_pHostFrame->buf[0]->size;
+        }
+    }
+#endif
+    LOG_INFO("FFVideoDecoder#{} presize {}x{}, depth {}, dpb {}, {} bytes.", m_uId, info.width, info.height, info.bit_depth, info.dpb_size,
+             m_uPresizeBytes);
+}
+
+AVCodecContext* FFVideoDecoder::OpenContext(const AVCodec* codec, bool steady)
+{
+    AVCodecContext* pContext = avcodec_alloc_context3(codec);
+    if (pContext == nullptr)
+    {
+        return nullptr;
+    }
+    if (m_pFramePool)
+    {
+        pContext->opaque = this;
+        pContext->get_buffer2 = GetFrameBuffer;
+    }
+    ApplyThreading(pContext, steady);
+    ApplyBandOutput(pContext);
+    if (m_options.gray)
+    {
+        pContext->flags |= AV_CODEC_FLAG_GRAY;
+    }
+    if (m_options.export_mvs)
+    {
+        pContext->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+    }
+    // 之前的参数集作为extradata，保证IDR不带参数集时新解码器也可解
+    ApplyParameterSets(pContext);
+    if (AdaptiveThreads())
+    {
+        m_threadClock.Begin();
+    }
+    int nOpen = avcodec_open2(pContext, nullptr, nullptr);
+    m_threadClock.End();
+    m_nWorkerCpuUs = -1;
+    if (nOpen != 0)
+    {
+        LOG_WARNING("FFVideoDecoder reopen failed {}, {}.", nOpen, av_errstr(nOpen));
+        avcodec_free_context(&pContext);
+    }
+    return pContext;
+}
+
+bool FFVideoDecoder::ReopenContext(const NVIImageInfo& info, const Output& output, int32_t threads)
+{
+    const bool bSwitch = !m_bSteady;
+    const int32_t nPrevious = m_nThreads;
+    m_nThreads = threads;
+    AVCodecContext* pContext = OpenContext(m_pDecoderContext->codec, true);
+    if (pContext == nullptr)
+    {
+        // 仍用原来的解码器，下一个IDR再尝试
+        m_nThreads = nPrevious;
+        return false;
+    }
+    m_bSteady = true;
+    // 取出旧解码器中剩余的帧，保证输出连续
+    if (avcodec_send_packet(m_pDecoderContext, nullptr) == 0)
+    {
+        while (true)
+        {
+            auto pFrame = AllocAVFrame();
+            if (pFrame == nullptr || avcodec_receive_frame(m_pDecoderContext, pFrame.get()) < 0)
+            {
+                break;
+            }
+            CountFrame();
+            m_pLastFrame = std::move(pFrame);
+            OutputLastFrame(info, output);
+        }
+    }
+    avcodec_free_context(&m_pDecoderContext);
+    m_pDecoderContext = pContext;
+    if (bSwitch)
+    {
+        m_tpSteady = std::chrono::steady_clock::now();
+        m_uSteadyFrames = 0;
+        LOG_INFO("FFVideoDecoder#{} switch to frame threading, time to first frame {}us.", m_uId, m_nFirstFrameUs);
+    }
+    return true;
+}
+
+void FFVideoDecoder::SetAllocator(const FramePool::Allocator& allocator)
+{
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    m_allocator = allocator;
+}
+
+void FFVideoDecoder::SetExtradata(const uint8_t* data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    m_vecExtradata.assign(data, data + (data ? size : 0));
+}
+
+void FFVideoDecoder::SetMotionOutput(const MotionOutput& output)
+{
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    m_motionOutput = output;
+}
+
+void FFVideoDecoder::SetAnalyticsOutput(const AnalyticsOutput& output)
+{
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    m_analyticsOutput = output;
+}
+
+void FFVideoDecoder::SetBandOutput(const BandOutput& output)
+{
+    std::lock_guard<std::mutex> lock(m_mtxDecode);
+    m_bandOutput = output;
+}
+
+void FFVideoDecoder::DrawHorizBand(AVCodecContext* ctx, const AVFrame* src, int offset[AV_NUM_DATA_POINTERS], int y, int /*type*/, int height)
+{
+    FFVideoDecoder* pDelegate = (FFVideoDecoder*)ctx->opaque;
+    if (pDelegate && src)
+    {
+        pDelegate->OutputBand(src, offset, y, height);
+    }
+}
+
+void FFVideoDecoder::OutputBand(const AVFrame* frame, const int offset[], int y, int height)
+{
+    Band band{};
+    if (!m_bandOutput || !ConvertPixelFormat(static_cast<AVPixelFormat>(frame->format), band.format))
+    {
+        return;
+    }
+    band.pts = frame->pts != AV_NOPTS_VALUE ? frame->pts : m_nBandPts;
+    band.width = static_cast<uint32_t>(frame->width);
+    band.height = static_cast<uint32_t>(frame->height);
+    band.y = static_cast<uint32_t>(y);
+    band.rows = static_cast<uint32_t>(height);
+    for (int i = 0; i < 4 && frame->data[i]; ++i)
+    {
+        band.planes[i] = frame->data[i] + offset[i];
+        band.strides[i] = static_cast<uint32_t>(frame->linesize[i]);
+    }
+    PROBE3(video_band, m_uId, band.pts, y + height);
+    m_bandOutput(band);
+}
+
+void FFVideoDecoder::OutputFrameBands(const AVFrame* frame)
+{
+    const AVPixFmtDescriptor* pDesc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+    if (!m_bandOutput || pDesc == nullptr)
+    {
+        return;
+    }
+    // 带高取宏块行，色度平面按垂直采样比例换算偏移
+    static const int kBandRows = 16;
+    int arrOffset[AV_NUM_DATA_POINTERS] = {};
+    for (int y = 0; y < frame->height; y += kBandRows)
+    {
+        for (int i = 0; i < 4 && frame->data[i]; ++i)
+        {
+            const int nRow = (i == 1 || i == 2) ? (y >> pDesc->log2_chroma_h) : y;
+            arrOffset[i] = nRow * frame->linesize[i];
+        }
+        OutputBand(frame, arrOffset, y, std::min(kBandRows, frame->height - y));
+    }
+}
+
+void FFVideoDecoder::KeepKeyframe(const NVIVideoEncodedPacket& packet)
+{
+    // 参数集放在前面，IDR不带参数集时快照解码器也可解
+    size_t szKeyframe = packet.buffer.size;
+    for (const auto& vecNAL : m_vecParameterSets)
+    {
+        szKeyframe += vecNAL.size();
+    }
+    auto pKeyframe = std::make_shared<std::vector<uint8_t>>();
+    pKeyframe->reserve(szKeyframe + AV_INPUT_BUFFER_PADDING_SIZE);
+    for (const auto& vecNAL : m_vecParameterSets)
+    {
+        pKeyframe->insert(pKeyframe->end(), vecNAL.begin(), vecNAL.end());
+    }
+    const uint8_t* pData = reinterpret_cast<const uint8_t*>(packet.buffer.bytes);
+    pKeyframe->insert(pKeyframe->end(), pData, pData + packet.buffer.size);
+    // 末尾补零，满足libavcodec对输入缓冲的填充要求
+    pKeyframe->resize(pKeyframe->size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    std::lock_guard<std::mutex> lock(m_mtxSnapshot);
+    m_pKeyframe = std::move(pKeyframe);
+    m_nKeyframePts = packet.info.tick.value;
+    m_uKeyframeCodec = m_uCodec;
+}
+
+bool FFVideoDecoder::TakeSnapshot(uint32_t max_width, uint32_t max_height, int32_t quality, std::shared_ptr<const std::vector<uint8_t>>& jpeg,
+                                  int64_t& pts)
+{
+    std::shared_ptr<const std::vector<uint8_t>> pKeyframe;
+    uint32_t uCodec = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxSnapshot);
+        if (m_pKeyframe == nullptr)
+        {
+            return false;
+        }
+        pts = m_nKeyframePts;
+        if (m_snapshot.keyframe == m_pKeyframe && m_snapshot.max_width == max_width && m_snapshot.max_height == max_height &&
+            m_snapshot.quality == quality)
+        {
+            jpeg = m_snapshot.jpeg;
+            return true;
+        }
+        pKeyframe = m_pKeyframe;
+        uCodec = m_uKeyframeCodec;
+    }
+    // 解码和编码不持锁，不阻塞解码线程更新关键帧
+    auto pJpeg = std::make_shared<std::vector<uint8_t>>();
+    {
+        TRACE_SCOPE("snapshot", m_uId, pts);
+        if (!ffmpeg::Snapshot::Instance().Encode(uCodec, pKeyframe->data(), pKeyframe->size() - AV_INPUT_BUFFER_PADDING_SIZE, max_width, max_height, quality, *pJpeg))
+        {
+            return false;
+        }
+    }
+    jpeg = pJpeg;
+    std::lock_guard<std::mutex> lock(m_mtxSnapshot);
+    m_snapshot = SnapshotCache{std::move(pKeyframe), max_width, max_height, quality, std::move(pJpeg)};
+    return true;
+}
+
+void FFVideoDecoder::ShutdownIdleReaper()
+{
+    IdleReaper::Instance().Shutdown();
+}
+
+void FFVideoDecoder::TryHibernate(std::chrono::steady_clock::time_point now)
+{
+    std::unique_lock<std::mutex> lock(m_mtxDecode, std::try_to_lock);
+    if (!lock.owns_lock() || m_bHibernated || m_pDecoderContext == nullptr || m_options.hibernate_ms <= 0)
+    {
+        return;
+    }
+    if (now - m_tpActive < std::chrono::milliseconds(m_options.hibernate_ms))
+    {
+        return;
+    }
+    AllocStats::Scope scope(m_pAllocStats.get());
+    // 保留解码器类型、选项和参数集，释放上下文（参考帧、线程）、输出帧和空闲缓冲
+    // 上下文中未输出的帧随之丢弃，空闲的流本来也要等下一个包才会输出它们
+    m_pCodec = m_pDecoderContext->codec;
+    avcodec_free_context(&m_pDecoderContext);
+    av_frame_unref(m_pLastFrame.get());
+    m_pHostFrame.reset();
+    m_pConvertedFrame.reset();
+    size_t szTrim = 0;
+    if (m_pFramePool)
+    {
+        szTrim = m_pFramePool->Trim();
+    }
+    m_bHibernated = true;
+    ++m_uHibernations;
+    LOG_INFO("FFVideoDecoder#{} hibernate, trim {} bytes.", m_uId, szTrim);
+}
+
+bool FFVideoDecoder::Resume(const NVIVideoEncodedPacket& packet)
+{
+    const uint8_t* pData = reinterpret_cast<const uint8_t*>(packet.buffer.bytes);
+    if (pData == nullptr || packet.buffer.size == 0)
+    {
+        return false;
+    }
+    if (m_uCodec == NVICodec_AVC || m_uCodec == NVICodec_HEVC || m_uCodec == FF_CODEC_VP9 || m_uCodec == FF_CODEC_AV1)
+    {
+        if (!IsKeyframe(pData, packet.buffer.size))
+        {
+            ++m_uHibernateDropped;
+            return false;
+        }
+    }
+    m_tpResume = std::chrono::steady_clock::now();
+    m_pDecoderContext = OpenContext(m_pCodec, m_bSteady);
+    if (m_pDecoderContext == nullptr)
+    {
+        ++m_uHibernateDropped;
+        return false;
+    }
+    m_bHibernated = false;
+    m_bResuming = true;
+    return true;
+}
+
+void FFVideoDecoder::CountFrame()
+{
+    if (m_bResuming)
+    {
+        m_bResuming = false;
+        m_nResumeUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_tpResume).count();
+        LOG_INFO("FFVideoDecoder#{} resume in {}us.", m_uId, m_nResumeUs);
+    }
+    if (m_uFrames++ == 0)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        m_nFirstFrameUs = std::chrono::duration_cast<std::chrono::microseconds>(now - m_tpConfig).count();
+        if (m_bSteady)
+        {
+            m_tpSteady = now;
+        }
+    }
+    ++m_uSteadyFrames;
+}
+
+bool FFVideoDecoder::OutputLastFrame(const NVIImageInfo& info, const Output& output)
+{
+    if (m_pTicket)
+    {
+        // 宿主回调的耗时不占用解码名额，同一个包之后的接收只取已解出的帧
+        m_pTicket->Finish();
+    }
+    if (m_pLastFrame && m_overload.Complete(m_pLastFrame->pts))
+    {
+        // 已经超时的帧不再下载和转换
+        PROBE2(video_frame_late, m_uId, m_pLastFrame->pts);
+        return true;
+    }
+    if (m_pLastFrame && m_options.export_mvs && m_motionOutput)
+    {
+        TRACE_SCOPE("motion", m_uId, m_pLastFrame->pts);
+        m_motion.Extract(m_pLastFrame.get(), m_options.mv_grid);
+        m_motionOutput(m_motion);
+    }
+    if (m_options.export_mvs && m_options.motion_only)
+    {
+        return true;
+    }
+    if (m_pLastFrame && m_bBandFallback && m_pLastFrame->format != m_nHWPixelFormat)
+    {
+        OutputFrameBands(m_pLastFrame.get());
+    }
+    if (m_pLastFrame && output)
+    {
+        AVFrame* pOutFrame = nullptr;
+        if (m_nHWPixelFormat == m_pLastFrame->format)
+        {
+            if (m_eOutBufferType == NVIBuffer_HOST)
+            {
+                // download
+                // 预分配的页锁定帧按SPS推测的格式分配，与实际的下载格式不同时重新分配
+                if (m_pHostFrame == nullptr || (m_pLastFrame->width != m_pHostFrame->width || m_pLastFrame->height != m_pHostFrame->height) ||
+                    (m_pLastFrame->format == AV_PIX_FMT_CUDA && m_pLastFrame->hw_frames_ctx &&
+                     m_pHostFrame->format != reinterpret_cast<AVHWFramesContext*>(m_pLastFrame->hw_frames_ctx->data)->sw_format))
+                {
+                    if (m_pLastFrame->format == AV_PIX_FMT_CUDA)
+                    {
+                        m_pHostFrame.reset(AllocHostAVFrame(m_pLastFrame->hw_frames_ctx, m_pLastFrame->width, m_pLastFrame->height));
+                    }
+                    if (m_pHostFrame == nullptr)
+                    {
+                        m_pHostFrame = AllocAVFrame();
+                    }
+                }
+                int nTransfer = -1;
+                if (m_options.gray && m_pLastFrame->format != AV_PIX_FMT_CUDA)
+                {
+                    // 只读映射代替整帧下载，只有被访问的亮度平面产生传输
+                    TRACE_SCOPE("av_hwframe_map", m_uId, m_pLastFrame->pts);
+                    av_frame_unref(m_pHostFrame.get());
+                    nTransfer = av_hwframe_map(m_pHostFrame.get(), m_pLastFrame.get(), AV_HWFRAME_MAP_READ);
+                    if (nTransfer < 0)
+                    {
+                        av_frame_unref(m_pHostFrame.get());
+                    }
+                }
+                if (nTransfer < 0)
+                {
+                    TRACE_SCOPE("av_hwframe_transfer_data", m_uId, m_pLastFrame->pts);
+                    nTransfer = av_hwframe_transfer_data(m_pHostFrame.get(), m_pLastFrame.get(), 0);
+                }
+                if ((nTransfer) < 0)
+                {
+                    LOG_ERROR("av_hwframe_transfer_data failed {}, {}.", nTransfer, av_errstr(nTransfer));
+                    return false;
+                }
+                m_pHostFrame->pts = m_pLastFrame->pts;
+                m_pHostFrame->pict_type = m_pLastFrame->pict_type;
+                m_pHostFrame->color_range = m_pLastFrame->color_range;
+                m_pHostFrame->color_primaries = m_pLastFrame->color_primaries;
+                m_pHostFrame->color_trc = m_pLastFrame->color_trc;
+                m_pHostFrame->colorspace = m_pLastFrame->colorspace;
+                pOutFrame = m_pHostFrame.get();
+                m_pLastFrame = nullptr;
+            }
+            else
+            {
+                // or direct device buffer
+                m_pLastFrame->format = GetHWDownloadFormat(m_pLastFrame->hw_frames_ctx);
+                if (m_pLastFrame->format == AV_PIX_FMT_NONE)
+                {
+                    return false;
+                }
+                pOutFrame = m_pLastFrame.get();
+            }
+        }
+        else
+        {
+            pOutFrame = m_pLastFrame.get();
+            // 单上下文的MJPEG做与帧并行工作线程同样的下采样，10位4:2:0转为P010
+            if (m_pConvertedFrame == nullptr)
+            {
+                m_pConvertedFrame = AllocAVFrame();
+            }
+            av_frame_unref(m_pConvertedFrame.get());
+            if (m_pConvertedFrame && m_converter.Convert(pOutFrame, m_pConvertedFrame.get()))
+            {
+                pOutFrame = m_pConvertedFrame.get();
+            }
+        }
+        NVIVideoImageFrame image{};
+        tracing::Scope convert("convert", m_uId, pOutFrame->pts);
+        PROBE3(video_convert, m_uId, pOutFrame->pts, pOutFrame->format);
+        if (ConvertImageFrame(pOutFrame, m_eOutBufferType, info, image))
+        {
+            if (m_options.gray && m_eOutBufferType == NVIBuffer_HOST)
+            {
+                // 色度平面可能未重建，不输出
+                for (int i = 1; i < 4; ++i)
+                {
+                    image.buffer.planes[i] = nullptr;
+                    image.buffer.strides[i] = 0;
+                }
+            }
+            convert.End();
+            if (m_options.analytics_step > 0 && m_analyticsOutput && m_eOutBufferType == NVIBuffer_HOST)
+            {
+                // 帧刚解码或下载完，亮度平面大多还在缓存中
+                TRACE_SCOPE("analytics", m_uId, pOutFrame->pts);
+                if (m_analytics.Analyze(pOutFrame, m_options.analytics_step))
+                {
+                    m_analyticsOutput(m_analytics);
+                }
+            }
+            if (m_pSharedRing)
+            {
+                m_pSharedRing->Publish(pOutFrame, image);
+            }
+            TRACE_SCOPE("output", m_uId, pOutFrame->pts);
+            PROBE2(video_callback, m_uId, pOutFrame->pts);
+            int32_t nOutput = output(&image);
+            PROBE3(video_callback_return, m_uId, pOutFrame->pts, nOutput);
+            (void)nOutput;
+        }
+        else
+        {
+            LOG_ERROR("Not match our pixel format: {}.", pOutFrame->format);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FFVideoDecoder::HWAccelContextInit(const NVIVideoAccelerate* accel)
+{
+    if (m_pDecoderContext == nullptr)
+    {
+        return false;
+    }
+    m_nHWPixelFormat = -1;
+    m_eOutBufferType = NVIBuffer_HOST;
+    if (accel == nullptr || accel->type <= NVIAccel_Auto)
+    {
+        return true;
+    }
+    auto typDevice = ToAVHWDeviceType(static_cast<NVIAccelType>(accel->type));
+    if (typDevice == AV_HWDEVICE_TYPE_NONE)
+    {
+        return false;
+    }
+    else
+    {
+        for (int i = 0;; i++)
+        {
+            const AVCodecHWConfig* config = avcodec_get_hw_config(m_pDecoderContext->codec, i);
+            if (!config)
+            {
+                break;
+            }
+            if (config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX && config->device_type == typDevice)
+            {
+                m_nHWPixelFormat = (int32_t)config->pix_fmt;
+                break;
+            }
+        }
+        if (m_nHWPixelFormat == -1)
+        {
+            LOG_WARNING("FFVideoDecoder not found valid hw pixel format.");
+            return false;
+        }
+        else
+        {
+            AVBufferRef* pHWContext = CreateHWContext(accel);
+            if (pHWContext)
+            {
+                if ((accel->flags & NVIAccelFlag_UseDeviceBuffer) == NVIAccelFlag_UseDeviceBuffer)
+                {
+                    m_eOutBufferType = GetHWBufferType(static_cast<NVIAccelType>(accel->type));
+                }
+                else
+                {
+                    m_eOutBufferType = NVIBuffer_HOST;
+                }
+                m_pDecoderContext->hw_device_ctx = pHWContext;
+                m_pDecoderContext->opaque = this;
+                m_pDecoderContext->get_format = GetHWFormat;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+void FFVideoDecoder::Release()
+{
+    if (m_pDecoderContext)
+    {
+        avcodec_free_context(&m_pDecoderContext);
+    }
+    m_bHibernated = false;
+    m_bResuming = false;
+    // 工作线程的上下文从帧池分配，先于帧池释放
+    m_pParallel.reset();
+    m_pFramePool.reset();
+}
@@ -1,40 +1,248 @@
-﻿#pragma once
-
-#include <memory>
-#include <functional>
-#include <NVI/Codec.h>
-
-struct AVCodecContext;
-struct AVFrame;
-
-class FFVideoDecoder final
-{
-public:
-    typedef std::function<int32_t(const NVIVideoImageFrame* image)> Output;
-    //typedef NVIVideoDecode::OnFrame Output;
-
-public:
-    FFVideoDecoder();
-    virtual ~FFVideoDecoder();
-
-public:
-    bool Config(const NVIVideoCodecParam& param);
-    bool Decoding(const NVIVideoEncodedPacket& packet, const Output& output);
-    int32_t HWPixelFormat() const
-    {
-        return m_nHWPixelFormat;
-    }
-
-private:
-    bool OutputLastFrame(const NVIImageInfo& info, const Output& output);
-    bool HWAccelContextInit(const NVIVideoAccelerate* accel);
-    void Release();
-
-private:
-    Output m_output;
-    AVCodecContext* m_pDecoderContext;
-    int32_t m_nHWPixelFormat;
-    NVIBufferType m_eOutBufferType;
-    std::unique_ptr<AVFrame, void (*)(AVFrame*)> m_pLastFrame;
-    std::unique_ptr<AVFrame, void (*)(AVFrame*)> m_pHostFrame;
-};
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <NVI/Codec.h>
+#include "FFmpegOverload.h"
+#include "FFmpegMemory.h"
+#include "FFmpegMotion.h"
+#include "FFmpegAnalytics.h"
+#include "Bitstream.h"
+#include "FFmpegConvert.h"
+#include "FFmpegIntraParallel.h"
+#include "FFmpegScheduler.h"
+#include "FFmpegThreadClock.h"
+
+struct AVCodec;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct AVBufferRef;
+
+namespace ffmpeg
+{
+class SharedRing;
+}
+
+class FFVideoDecoder final
+{
+public:
+    typedef std::function<int32_t(const NVIVideoImageFrame* image)> Output;
+    //typedef NVIVideoDecode::OnFrame Output;
+    typedef std::function<void(const ffmpeg::MotionField& motion)> MotionOutput;
+    typedef std::function<void(const ffmpeg::FrameAnalytics& analytics)> AnalyticsOutput;
+    // 帧的一个已完成的水平带，planes指向带的第一行
+    struct Band
+    {
+        int64_t pts;
+        uint32_t width;
+        uint32_t height;
+        uint32_t y;
+        uint32_t rows;
+        uint32_t format;
+        uint8_t* planes[4];
+        uint32_t strides[4];
+    };
+    typedef std::function<void(const Band& band)> BandOutput;
+
+public:
+    FFVideoDecoder();
+    virtual ~FFVideoDecoder();
+
+public:
+    bool Config(const NVIVideoCodecParam& param);
+    bool Decoding(const NVIVideoEncodedPacket& packet, const Output& output);
+    // budget为该包从提交起的处理时限（微秒），超时的帧不再输出，持续落后时逐级跳帧
+    bool Decoding(const NVIVideoEncodedPacket& packet, int64_t budget, const Output& output);
+    // 任意分块的Annex-B字节流，切分为访问单元后按Decoding处理，pts见bitstream::AccessUnitSplitter
+    // end表示这块数据在访问单元边界结束；data为空且end时输出缓存的最后一个访问单元
+    bool DecodingStream(const uint8_t* data, size_t size, int64_t pts, bool end, const Output& output);
+    // 选项在Config时生效，名称及取值见FFmpegCodecPlugin.h
+    bool SetOption(const char* name, int64_t value);
+    bool GetStat(const char* name, double& value) const;
+    // 在Config之前设置Annex-B格式的参数集（H264的SPS/PPS，HEVC的VPS/SPS/PPS），空为清除
+    // Config时按SPS设置尺寸并预先分配帧缓冲，首帧不再等待分配
+    void SetExtradata(const uint8_t* data, size_t size);
+    // 在Config之前设置，之后Config的软件解码帧直接分配在宿主内存中
+    void SetAllocator(const ffmpeg::FramePool::Allocator& allocator);
+    // 开启"export_mvs"时每个输出帧先回调运动矢量，在解码线程上同步调用
+    void SetMotionOutput(const MotionOutput& output);
+    // 开启"analytics_step"时每个主机内存输出帧在图像回调之前回调亮度统计
+    void SetAnalyticsOutput(const AnalyticsOutput& output);
+    // 开启"snapshot"时把最近的IDR编码为JPEG，关键帧未变且参数相同时返回上次的结果
+    // 不经过解码锁，可在任意线程（包括输出回调中）调用
+    bool TakeSnapshot(uint32_t max_width, uint32_t max_height, int32_t quality, std::shared_ptr<const std::vector<uint8_t>>& jpeg, int64_t& pts);
+    // 开启"band_output"时解码过程中逐带回调，整帧仍按原方式输出；可能在解码器的片线程上调用
+    // 解码器不回调行带时（H264以外）在整帧输出之前补发
+    void SetBandOutput(const BandOutput& output);
+    // 共享内存帧环的memfd，未开启时为空
+    ffmpeg::SharedRing* SharedFrameRing() const
+    {
+        return m_pSharedRing.get();
+    }
+    // 空闲超过hibernate_ms时释放解码上下文等重量状态，下一个关键帧到来时恢复
+    // 由后台线程调用，解码器正在使用时直接返回
+    void TryHibernate(std::chrono::steady_clock::time_point now);
+    // 停止并等待检查休眠的后台线程，在插件卸载之前调用；之后Config开启休眠的解码器时重新启动
+    static void ShutdownIdleReaper();
+    int32_t HWPixelFormat() const
+    {
+        return m_nHWPixelFormat;
+    }
+    uint32_t Id() const
+    {
+        return m_uId;
+    }
+    ffmpeg::FramePool* Pool() const
+    {
+        return m_pFramePool.get();
+    }
+    const std::shared_ptr<ffmpeg::AllocStats>& Stats() const
+    {
+        return m_pAllocStats;
+    }
+
+private:
+    enum Threading : int32_t
+    {
+        Threading_Default = 0,
+        Threading_Slice = 1,
+        Threading_Frame = 2,
+        Threading_Hybrid = 3,  // 启动阶段低延迟片并行，首个GOP后切换到帧并行
+    };
+    struct Options
+    {
+        int32_t threads = -1;  // -1不设置，0由FFmpeg自动选择
+        int32_t threading = Threading_Default;
+        int32_t adaptive_threads = 0;    // 自适应线程数上限，0不开启
+        int64_t frame_interval_us = 0;   // 帧间隔，0按包到达间隔估计
+        int64_t deadline_us = 0;         // 默认的包处理时限，0不限
+        int32_t priority = -1;           // 过载时的丢帧优先级，越大越晚丢，-1按QoS等级
+        int32_t qos = 1;                 // ffmpeg::QoSClass
+        int64_t hibernate_ms = 0;        // 空闲休眠时间，0不休眠
+        int64_t shared_ring_bytes = 0;   // 共享内存帧环的数据区大小，0不开启
+        int32_t shared_ring_frames = 64; // 共享内存帧环的帧描述个数
+        int64_t shared_ring_lease_ms = 5000; // 消费者持有帧的时限，0不强制回收
+        bool gray = false;               // 只输出亮度平面
+        bool export_mvs = false;         // 导出运动矢量
+        int32_t mv_grid = 0;             // 运动矢量聚合网格的边长（像素），0不聚合
+        bool motion_only = false;        // 只输出运动矢量，不下载、转换和回调图像
+        int32_t analytics_step = 0;      // 亮度统计的行列采样间隔，0不统计
+        bool snapshot = false;           // 保留最近的IDR用于快照
+        bool band_output = false;        // 解码过程中按水平带提前输出
+    };
+
+private:
+    void ApplyThreading(AVCodecContext* ctx, bool steady) const;
+    void ApplyBandOutput(AVCodecContext* ctx);
+    // 对应AVCodecContext::draw_horiz_band，转给opaque指向的解码器
+    static void DrawHorizBand(AVCodecContext* ctx, const AVFrame* src, int offset[], int y, int /*type*/, int height);
+    void OutputBand(const AVFrame* frame, const int offset[], int y, int height);
+    // 解码器不回调时，整帧解出后自上而下按行带输出
+    void OutputFrameBands(const AVFrame* frame);
+    // 把已记录的参数集设为ctx的extradata
+    void ApplyParameterSets(AVCodecContext* ctx) const;
+    // 记录extradata中的参数集并解析SPS
+    bool ParseExtradata(bitstream::SequenceInfo& info);
+    // 按SPS设置尺寸并预先分配帧缓冲，在打开解码器之前调用
+    void Presize(const bitstream::SequenceInfo& info);
+    // 记录参数集，返回访问单元是否为IDR
+    bool CollectParameterSets(const uint8_t* data, size_t size);
+    // 按编码判断关键帧，H264/HEVC同时记录参数集；其他编码返回false
+    bool IsKeyframe(const uint8_t* data, size_t size);
+    bool AdaptiveThreads() const;
+    int32_t NextThreadCount();
+    // 帧内编码的流按线程设置启动帧并行解码，返回是否启用
+    bool StartParallel(const AVCodec* codec);
+    bool DecodingParallel(const AVPacket* packet, const NVIImageInfo& info, const Output& output);
+    // 按当前线程设置和参数集打开一个新的解码上下文，steady为false时混合模式用启动阶段的片并行
+    AVCodecContext* OpenContext(const AVCodec* codec, bool steady);
+    // 新的上下文打开成功后才替换旧的并进入稳定阶段，失败时保持原状
+    bool ReopenContext(const NVIImageInfo& info, const Output& output, int32_t threads);
+    void CountFrame();
+    void KeepKeyframe(const NVIVideoEncodedPacket& packet);
+    bool Resume(const NVIVideoEncodedPacket& packet);
+    bool OutputLastFrame(const NVIImageInfo& info, const Output& output);
+    // buffer非空时包数据位于其中并带填充，送入解码器时引用而不拷贝
+    bool Decoding(const NVIVideoEncodedPacket& packet, int64_t budget, AVBufferRef* buffer, const Output& output);
+    // 在解码锁和调度凭证内解码一个包
+    bool DecodePacket(const NVIVideoEncodedPacket& packet, int64_t budget, AVBufferRef* buffer, const Output& output);
+    bool HWAccelContextInit(const NVIVideoAccelerate* accel);
+    void Release();
+
+private:
+    const uint32_t m_uId;
+    Output m_output;
+    AVCodecContext* m_pDecoderContext;
+    int32_t m_nHWPixelFormat;
+    NVIBufferType m_eOutBufferType;
+    std::unique_ptr<AVFrame, void (*)(AVFrame*)> m_pLastFrame;
+    std::unique_ptr<AVFrame, void (*)(AVFrame*)> m_pHostFrame;
+    // 单上下文软件解码的帧转换为可输出的格式，见FormatConverter
+    std::unique_ptr<AVFrame, void (*)(AVFrame*)> m_pConvertedFrame;
+    ffmpeg::FormatConverter m_converter;
+    std::shared_ptr<ffmpeg::AllocStats> m_pAllocStats;
+    std::unique_ptr<ffmpeg::FramePool, void (*)(ffmpeg::FramePool*)> m_pFramePool;
+    uint32_t m_uCodec;
+    Options m_options;
+    bool m_bSteady;
+    int32_t m_nThreads;
+    // 自适应线程的负载采样：调用线程累计的CPU时间，工作线程上次的CPU时间（-1为重新取基准）
+    int64_t m_nCallerCpuUs;
+    int64_t m_nWorkerCpuUs;
+    uint64_t m_uLoadFrames;
+    uint32_t m_uLoadGops;
+    double m_fLoad;
+    ffmpeg::ThreadClock m_threadClock;
+    double m_fIntervalUs;
+    uint32_t m_uSamples;
+    std::chrono::steady_clock::time_point m_tpArrival;
+    std::vector<std::vector<uint8_t>> m_vecParameterSets;
+    std::chrono::steady_clock::time_point m_tpConfig;
+    std::chrono::steady_clock::time_point m_tpSteady;
+    int64_t m_nFirstFrameUs;
+    uint64_t m_uFrames;
+    uint64_t m_uSteadyFrames;
+    ffmpeg::Overload m_overload;
+    mutable std::mutex m_mtxDecode;
+    const AVCodec* m_pCodec;
+    bool m_bHibernated;
+    bool m_bResuming;
+    std::chrono::steady_clock::time_point m_tpActive;
+    std::chrono::steady_clock::time_point m_tpResume;
+    int64_t m_nResumeUs;
+    uint64_t m_uHibernations;
+    uint64_t m_uHibernateDropped;
+    ffmpeg::FramePool::Allocator m_allocator;
+    std::unique_ptr<ffmpeg::SharedRing, void (*)(ffmpeg::SharedRing*)> m_pSharedRing;
+    ffmpeg::MotionField m_motion;
+    MotionOutput m_motionOutput;
+    ffmpeg::FrameAnalytics m_analytics;
+    AnalyticsOutput m_analyticsOutput;
+    std::mutex m_mtxSnapshot;
+    std::shared_ptr<const std::vector<uint8_t>> m_pKeyframe;
+    int64_t m_nKeyframePts;
+    uint32_t m_uKeyframeCodec;
+    // 上次快照的参数和结果
+    struct SnapshotCache
+    {
+        std::shared_ptr<const std::vector<uint8_t>> keyframe;
+        uint32_t max_width;
+        uint32_t max_height;
+        int32_t quality;
+        std::shared_ptr<const std::vector<uint8_t>> jpeg;
+    } m_snapshot;
+    BandOutput m_bandOutput;
+    int64_t m_nBandPts;
+    bool m_bBandFallback;
+    // 字节流输入在解码锁之外切分，先于m_mtxDecode加锁
+    mutable std::mutex m_mtxStream;
+    bitstream::AccessUnitSplitter m_splitter;
+    std::vector<uint8_t> m_vecExtradata;
+    uint64_t m_uPresizeBytes;
+    std::unique_ptr<ffmpeg::IntraParallel> m_pParallel;
+    ffmpeg::Scheduler::Ticket* m_pTicket;  // 当前包的调度凭证，只在Decoding期间有效
+};
@@ -1,16 +1,21 @@
-﻿#pragma once
-
-extern "C"
-{
-#include <libavutil/cpu.h>
-#include <libavutil/buffer.h>
-#include <libavutil/hwcontext.h>
-#include <libavcodec/avcodec.h>
-}
-#include "NVI/Codec.h"
-
-namespace ffmpeg
-{
-AVBufferRef* CreateHWContext(const NVIVideoAccelerate* pAccel);
-void* CudaContext(AVHWFramesContext* pHWFramesContext);
-}  //namespace ffmpeg
+#pragma once
+
+extern "C"
+{
+#include <libavutil/cpu.h>
+#include <libavutil/buffer.h>
+#include <libavutil/hwcontext.h>
+#include <libavcodec/avcodec.h>
+}
+#include "NVI/Codec.h"
+#include "adaption/Logging.h"
+
+namespace ffmpeg
+{
+AVBufferRef* CreateHWContext(const NVIVideoAccelerate* pAccel);
+void* CudaContext(AVHWFramesContext* pHWFramesContext);
+// 解码器的hw_device_ctx，首帧之前还没有帧上下文时使用
+void* CudaContext(AVHWDeviceContext* pDeviceContext);
+// 同时设置插件与FFmpeg的日志级别
+void SetLogLevel(LogLevel level);
+}  //namespace ffmpeg
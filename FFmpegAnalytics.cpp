@@ -0,0 +1,99 @@
+#include "FFmpegAnalytics.h"
+#include "FFmpegWrapper.hpp"
+#include <cmath>
+#include <cstring>
+
+namespace ffmpeg
+{
+FrameAnalytics::FrameAnalytics()
+    : pts(AV_NOPTS_VALUE)
+    , samples(0)
+    , mean(0.0)
+    , scene(0.0)
+    , histogram{}
+    , m_arrPrevious{}
+    , m_uPrevious(0)
+{
+}
+
+FrameAnalytics::~FrameAnalytics()
+{
+}
+
+void FrameAnalytics::Reset()
+{
+    m_uPrevious = 0;
+}
+
+bool FrameAnalytics::Analyze(const AVFrame* frame, int32_t step)
+{
+    int32_t nBytes = 1;
+    int32_t nHigh = 0;
+    switch (frame->format)
+    {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21: break;
+    case AV_PIX_FMT_P010LE: nBytes = 2, nHigh = 1; break;
+    case AV_PIX_FMT_P010BE: nBytes = 2, nHigh = 0; break;
+    default: return false;
+    }
+    const uint8_t* pPlane = frame->data[0];
+    if (pPlane == nullptr || frame->width <= 0 || frame->height <= 0)
+    {
+        return false;
+    }
+    const int32_t nStep = step > 0 ? step : 1;
+    const int32_t nStride = frame->linesize[0];
+    const int32_t nWidth = frame->width;
+    // 四个子直方图交替计数，避免相邻采样落在同一格时的存储转发依赖
+    uint32_t arrCounts[4][256];
+    memset(arrCounts, 0, sizeof(arrCounts));
+    for (int32_t y = 0; y < frame->height; y += nStep)
+    {
+        const uint8_t* pSample = pPlane + static_cast<ptrdiff_t>(y) * nStride + nHigh;
+        const ptrdiff_t nAdvance = static_cast<ptrdiff_t>(nStep) * nBytes;
+        int32_t x = 0;
+        for (; x + nStep * 3 < nWidth; x += nStep * 4)
+        {
+            ++arrCounts[0][pSample[0]];
+            ++arrCounts[1][pSample[nAdvance]];
+            ++arrCounts[2][pSample[nAdvance * 2]];
+            ++arrCounts[3][pSample[nAdvance * 3]];
+            pSample += nAdvance * 4;
+        }
+        for (; x < nWidth; x += nStep)
+        {
+            ++arrCounts[0][pSample[0]];
+            pSample += nAdvance;
+        }
+    }
+    // 均值直接由直方图得出，不再单独遍历像素
+    uint32_t uSamples = 0;
+    uint64_t uSum = 0;
+    for (size_t i = 0; i < histogram.size(); ++i)
+    {
+        histogram[i] = arrCounts[0][i] + arrCounts[1][i] + arrCounts[2][i] + arrCounts[3][i];
+        uSamples += histogram[i];
+        uSum += static_cast<uint64_t>(i) * histogram[i];
+    }
+    pts = frame->pts;
+    samples = uSamples;
+    mean = uSamples > 0 ? static_cast<double>(uSum) / static_cast<double>(uSamples) : 0.0;
+    // 归一化直方图的差异，分辨率或采样间隔变化后仍可比较
+    scene = 0.0;
+    if (m_uPrevious > 0 && uSamples > 0)
+    {
+        double fDiff = 0.0;
+        for (size_t i = 0; i < histogram.size(); ++i)
+        {
+            fDiff += std::fabs(static_cast<double>(histogram[i]) / uSamples - static_cast<double>(m_arrPrevious[i]) / m_uPrevious);
+        }
+        scene = fDiff / 2.0;
+    }
+    m_arrPrevious = histogram;
+    m_uPrevious = uSamples;
+    return true;
+}
+}  // namespace ffmpeg
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+struct AVFrame;
+
+namespace ffmpeg
+{
+// 输出帧的亮度统计：直方图、均值和与上一帧的场景变化分数
+// 在输出前帧数据还在缓存中时隔行采样计算，避免宿主再读一遍整帧
+class FrameAnalytics final
+{
+public:
+    FrameAnalytics();
+    ~FrameAnalytics();
+    FrameAnalytics(const FrameAnalytics&) = delete;
+    FrameAnalytics& operator=(const FrameAnalytics&) = delete;
+
+public:
+    // 清除上一帧，之后第一帧的场景变化分数为0
+    void Reset();
+    // step为行列的采样间隔；只支持主机内存中的8位和P010格式，其他返回false
+    bool Analyze(const AVFrame* frame, int32_t step);
+
+public:
+    int64_t pts;
+    uint32_t samples;  // 参与直方图的采样数
+    double mean;       // 采样点的亮度均值，0~255，10位格式取高8位
+    double scene;      // 与上一帧归一化直方图的差异，0~1
+    std::array<uint32_t, 256> histogram;
+
+private:
+    std::array<uint32_t, 256> m_arrPrevious;
+    uint32_t m_uPrevious;
+};
+}  // namespace ffmpeg
@@ -1,150 +1,705 @@
-﻿#include "FFmpegCodecPlugin.h"
-#include "FFAudioDecoder.h"
-#include "FFVideoDecoder.h"
-#include "adaption/Logging.h"
-
-#define DEC_SUCCESS (0)
-#define DEC_ERROR(x) (-1024 - x)
-#define DEC_ERROR_INVALID_ARGS DEC_ERROR(1)
-#define DEC_ERROR_NOT_SUPPORT DEC_ERROR(2)
-#define DEC_ERROR_DECODING DEC_ERROR(3)
-
-class FFmpegVideoDecodeDelegate final
-{
-public:
-    static FFVideoDecoder* Alloc(uint32_t codec)
-    {
-        if (codec == NVICodec_AVC || codec == NVICodec_HEVC)
-        {
-            return new FFVideoDecoder();
-        }
-        return nullptr;
-    }
-    static int32_t Config(void* decoder, const NVIVideoCodecParam* param)
-    {
-        if (decoder && param)
-        {
-            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
-            return pDecoder->Config(*param) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
-        }
-        return DEC_ERROR_INVALID_ARGS;
-    }
-    static int32_t Decoding(void* decoder, const NVIVideoEncodedPacket* in, NVIVideoDecode::OnFrame out, void* user)
-    {
-        if (decoder && in)
-        {
-            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
-            if (out == nullptr)
-            {
-                return pDecoder->Decoding(*in, FFVideoDecoder::Output(nullptr)) ? DEC_SUCCESS : DEC_ERROR_DECODING;
-            }
-            else
-            {
-                return pDecoder->Decoding(*in,
-                                          [out, user](const NVIVideoImageFrame* frame) -> int32_t
-                                          {
-                                              return out(frame, user);
-                                          })
-                           ? DEC_SUCCESS
-                           : DEC_ERROR_DECODING;
-            }
-        }
-        return DEC_ERROR_INVALID_ARGS;
-    }
-    static int32_t Release(void* decoder)
-    {
-        if (decoder)
-        {
-            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
-            delete pDecoder;
-            return DEC_SUCCESS;
-        }
-        return DEC_ERROR_INVALID_ARGS;
-    }
-};
-
-class FFmpegAudioDecodeDelegate final
-{
-public:
-    static FFAudioDecoder* Alloc(uint32_t codec)
-    {
-        if (codec == NVICodec_AAC || codec == NVICodec_OPUS)
-        {
-            return new FFAudioDecoder();
-        }
-        return nullptr;
-    }
-    static int32_t Config(void* decoder, const NVIAudioCodecParam* param)
-    {
-        if (decoder && param)
-        {
-            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
-            return pDecoder->Config(*param) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
-        }
-        return DEC_ERROR_INVALID_ARGS;
-    }
-    static int32_t Decoding(void* decoder, const NVIAudioEncodedPacket* in, NVIAudioDecode::OnFrame out, void* user)
-    {
-        if (decoder && in)
-        {
-            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
-            if (out == nullptr)
-            {
-                return pDecoder->Decoding(*in, FFAudioDecoder::Output(nullptr)) ? DEC_SUCCESS : DEC_ERROR_DECODING;
-            }
-            else
-            {
-                return pDecoder->Decoding(*in,
-                                          [out, user](const NVIAudioWaveFrame* frame) -> int32_t
-                                          {
-                                              return out(frame, user);
-                                          })
-                           ? DEC_SUCCESS
-                           : DEC_ERROR_DECODING;
-            }
-        }
-        return DEC_ERROR_INVALID_ARGS;
-    }
-    static int32_t Release(void* decoder)
-    {
-        if (decoder)
-        {
-            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
-            delete pDecoder;
-            return DEC_SUCCESS;
-        }
-        return DEC_ERROR_INVALID_ARGS;
-    }
-};
-
-//////////////////////////////////////////////////////////////////////////
-NVIVideoDecode VideoDecodeAlloc(uint32_t codec)
-{
-    NVIVideoDecode vd{};
-    vd.decoder = FFmpegVideoDecodeDelegate::Alloc(codec);
-    if (vd.decoder)
-    {
-        vd.Config = &FFmpegVideoDecodeDelegate::Config;
-        vd.Decoding = &FFmpegVideoDecodeDelegate::Decoding;
-        vd.Release = &FFmpegVideoDecodeDelegate::Release;
-    }
-    return vd;
-}
-
-NVIAudioDecode AudioDecodeAlloc(uint32_t codec)
-{
-    NVIAudioDecode ad{};
-    ad.decoder = FFmpegAudioDecodeDelegate::Alloc(codec);
-    if (ad.decoder)
-    {
-        ad.Config = &FFmpegAudioDecodeDelegate::Config;
-        ad.Decoding = &FFmpegAudioDecodeDelegate::Decoding;
-        ad.Release = &FFmpegAudioDecodeDelegate::Release;
-    }
-    return ad;
-}
-
-void SetLogging(void (*logging)(int level, const char* message, unsigned int length))
-{
-    SetLoggingFunc(logging);
-}
+#include "FFmpegCodecPlugin.h"
+#include "FFAudioDecoder.h"
+#include "FFVideoDecoder.h"
+#include "FFBatchDecoder.h"
+#include "FFGopCache.h"
+#include "FFmpegAccel.h"
+#include "FFmpegMemory.h"
+#include "FFmpegScheduler.h"
+#include "FFmpegSharedRing.h"
+#include "FFmpegWrapper.hpp"
+#include "adaption/Logging.h"
+#include "adaption/Tracing.h"
+#include <cstring>
+
+#define DEC_SUCCESS (0)
+#define DEC_ERROR(x) (-1024 - x)
+#define DEC_ERROR_INVALID_ARGS DEC_ERROR(1)
+#define DEC_ERROR_NOT_SUPPORT DEC_ERROR(2)
+#define DEC_ERROR_DECODING DEC_ERROR(3)
+
+template <typename Decoder>
+static int32_t GetAllocStats(const Decoder* pDecoder, FFAllocStats* stats)
+{
+    const auto& pStats = pDecoder->Stats();
+    if (pStats == nullptr)
+    {
+        return DEC_ERROR_NOT_SUPPORT;
+    }
+    stats->allocs = pStats->allocs.load(std::memory_order_relaxed);
+    stats->frees = pStats->frees.load(std::memory_order_relaxed);
+    stats->live_bytes = pStats->live.load(std::memory_order_relaxed);
+    stats->peak_bytes = pStats->peak.load(std::memory_order_relaxed);
+    return DEC_SUCCESS;
+}
+
+AVCodecID ffmpeg::ToPluginCodecID(uint32_t codec)
+{
+    switch (codec)
+    {
+    case FF_CODEC_MJPEG: return AV_CODEC_ID_MJPEG;
+    case FF_CODEC_VP9: return AV_CODEC_ID_VP9;
+    case FF_CODEC_AV1: return AV_CODEC_ID_AV1;
+    case FF_CODEC_PCMA: return AV_CODEC_ID_PCM_ALAW;
+    case FF_CODEC_PCMU: return AV_CODEC_ID_PCM_MULAW;
+    case FF_CODEC_PCM_S16LE: return AV_CODEC_ID_PCM_S16LE;
+    default: return AV_CODEC_ID_NONE;
+    }
+}
+
+class FFmpegVideoDecodeDelegate final
+{
+public:
+    static FFVideoDecoder* Alloc(uint32_t codec)
+    {
+        if (!ffmpeg::MemoryBudget::Instance().Admit())
+        {
+            LOG_WARNING("VideoDecodeAlloc refused, memory pressure.");
+            return nullptr;
+        }
+        if (codec == NVICodec_AVC || codec == NVICodec_HEVC || codec == FF_CODEC_MJPEG || codec == FF_CODEC_VP9 || codec == FF_CODEC_AV1)
+        {
+            return new FFVideoDecoder();
+        }
+        return nullptr;
+    }
+    static int32_t Config(void* decoder, const NVIVideoCodecParam* param)
+    {
+        if (decoder && param)
+        {
+            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
+            return pDecoder->Config(*param) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t Decoding(void* decoder, const NVIVideoEncodedPacket* in, NVIVideoDecode::OnFrame out, void* user)
+    {
+        return Decoding(decoder, in, -1, out, user);
+    }
+    // budget小于0时使用解码器的deadline_us选项
+    static int32_t Decoding(void* decoder, const NVIVideoEncodedPacket* in, int64_t budget, NVIVideoDecode::OnFrame out, void* user)
+    {
+        if (decoder && in)
+        {
+            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
+            FFVideoDecoder::Output output;
+            if (out)
+            {
+                // 只捕获两个指针，在std::function的小对象缓冲内，不产生堆分配
+                output = [out, user](const NVIVideoImageFrame* frame) -> int32_t
+                {
+                    return out(frame, user);
+                };
+            }
+            return (budget < 0 ? pDecoder->Decoding(*in, output) : pDecoder->Decoding(*in, budget, output)) ? DEC_SUCCESS : DEC_ERROR_DECODING;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t Release(void* decoder)
+    {
+        if (decoder)
+        {
+            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
+            delete pDecoder;
+            return DEC_SUCCESS;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t AllocStats(void* decoder, FFAllocStats* stats)
+    {
+        if (decoder && stats)
+        {
+            return GetAllocStats(reinterpret_cast<FFVideoDecoder*>(decoder), stats);
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t SetOption(void* decoder, const char* name, int64_t value)
+    {
+        if (decoder && name)
+        {
+            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
+            return pDecoder->SetOption(name, value) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t SetAllocator(void* decoder, const FFFrameAllocator* allocator)
+    {
+        if (decoder == nullptr || (allocator && (allocator->alloc == nullptr || allocator->free == nullptr)))
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        ffmpeg::FramePool::Allocator sAllocator{};
+        if (allocator)
+        {
+            sAllocator.user = allocator->user;
+            sAllocator.alloc = allocator->alloc;
+            sAllocator.free = allocator->free;
+        }
+        reinterpret_cast<FFVideoDecoder*>(decoder)->SetAllocator(sAllocator);
+        return DEC_SUCCESS;
+    }
+    static int32_t SetMotionOutput(void* decoder, void (*on_motion)(const FFMotionVectors* motion, void* user), void* user)
+    {
+        if (decoder == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        FFVideoDecoder::MotionOutput output;
+        if (on_motion)
+        {
+            output = [on_motion, user](const ffmpeg::MotionField& field)
+            {
+                FFMotionVectors motion{};
+                motion.pts = field.pts;
+                motion.width = field.width;
+                motion.height = field.height;
+                motion.count = static_cast<uint32_t>(field.Count());
+                motion.x = field.x.data();
+                motion.y = field.y.data();
+                motion.dx = field.dx.data();
+                motion.dy = field.dy.data();
+                motion.w = field.w.data();
+                motion.h = field.h.data();
+                motion.source = field.source.data();
+                motion.grid = field.grid;
+                motion.cols = field.cols;
+                motion.rows = field.rows;
+                motion.grid_dx = field.grid_dx.data();
+                motion.grid_dy = field.grid_dy.data();
+                on_motion(&motion, user);
+            };
+        }
+        reinterpret_cast<FFVideoDecoder*>(decoder)->SetMotionOutput(output);
+        return DEC_SUCCESS;
+    }
+    static int32_t SetAnalyticsOutput(void* decoder, void (*on_analytics)(const FFFrameAnalytics* analytics, void* user), void* user)
+    {
+        if (decoder == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        FFVideoDecoder::AnalyticsOutput output;
+        if (on_analytics)
+        {
+            output = [on_analytics, user](const ffmpeg::FrameAnalytics& stats)
+            {
+                FFFrameAnalytics analytics{};
+                analytics.pts = stats.pts;
+                analytics.samples = stats.samples;
+                analytics.mean = stats.mean;
+                analytics.scene_score = stats.scene;
+                memcpy(analytics.histogram, stats.histogram.data(), sizeof(analytics.histogram));
+                on_analytics(&analytics, user);
+            };
+        }
+        reinterpret_cast<FFVideoDecoder*>(decoder)->SetAnalyticsOutput(output);
+        return DEC_SUCCESS;
+    }
+    static int32_t SetBandOutput(void* decoder, void (*on_band)(const FFFrameBand* band, void* user), void* user)
+    {
+        if (decoder == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        FFVideoDecoder::BandOutput output;
+        if (on_band)
+        {
+            output = [on_band, user](const FFVideoDecoder::Band& band)
+            {
+                FFFrameBand out{};
+                out.pts = band.pts;
+                out.width = band.width;
+                out.height = band.height;
+                out.y = band.y;
+                out.rows = band.rows;
+                out.format = band.format;
+                for (int i = 0; i < 4; ++i)
+                {
+                    out.planes[i] = band.planes[i];
+                    out.strides[i] = band.strides[i];
+                }
+                on_band(&out, user);
+            };
+        }
+        reinterpret_cast<FFVideoDecoder*>(decoder)->SetBandOutput(output);
+        return DEC_SUCCESS;
+    }
+    static int32_t SetExtradata(void* decoder, const uint8_t* extradata, size_t size)
+    {
+        if (decoder == nullptr || (extradata == nullptr && size > 0))
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        reinterpret_cast<FFVideoDecoder*>(decoder)->SetExtradata(extradata, size);
+        return DEC_SUCCESS;
+    }
+    static int32_t DecodingStream(void* decoder, const uint8_t* data, size_t size, int64_t pts, uint32_t flags, NVIVideoDecode::OnFrame out,
+                                  void* user)
+    {
+        if (decoder == nullptr || (data == nullptr && size > 0))
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        FFVideoDecoder::Output output;
+        if (out)
+        {
+            output = [out, user](const NVIVideoImageFrame* frame) -> int32_t
+            {
+                return out(frame, user);
+            };
+        }
+        return reinterpret_cast<FFVideoDecoder*>(decoder)->DecodingStream(data, size, pts, (flags & FF_STREAM_END_OF_AU) != 0, output)
+                   ? DEC_SUCCESS
+                   : DEC_ERROR_DECODING;
+    }
+    static int32_t Snapshot(void* decoder, uint32_t max_width, uint32_t max_height, int32_t quality,
+                            void (*on_jpeg)(const uint8_t* jpeg, size_t size, int64_t pts, void* user), void* user)
+    {
+        if (decoder == nullptr || on_jpeg == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        std::shared_ptr<const std::vector<uint8_t>> pJpeg;
+        int64_t nPts = 0;
+        if (!reinterpret_cast<FFVideoDecoder*>(decoder)->TakeSnapshot(max_width, max_height, quality, pJpeg, nPts))
+        {
+            return DEC_ERROR_NOT_SUPPORT;
+        }
+        on_jpeg(pJpeg->data(), pJpeg->size(), nPts, user);
+        return DEC_SUCCESS;
+    }
+    static int32_t SharedRing(void* decoder, int32_t* fd, uint64_t* size)
+    {
+        if (decoder == nullptr || fd == nullptr || size == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        auto pRing = reinterpret_cast<FFVideoDecoder*>(decoder)->SharedFrameRing();
+        if (pRing == nullptr)
+        {
+            return DEC_ERROR_NOT_SUPPORT;
+        }
+        *fd = pRing->Fd();
+        *size = pRing->Size();
+        return DEC_SUCCESS;
+    }
+    static int32_t GetStat(void* decoder, const char* name, double* value)
+    {
+        if (decoder && name && value)
+        {
+            auto pDecoder = reinterpret_cast<FFVideoDecoder*>(decoder);
+            return pDecoder->GetStat(name, *value) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+};
+
+class FFmpegAudioDecodeDelegate final
+{
+public:
+    static FFAudioDecoder* Alloc(uint32_t codec)
+    {
+        if (!ffmpeg::MemoryBudget::Instance().Admit())
+        {
+            LOG_WARNING("AudioDecodeAlloc refused, memory pressure.");
+            return nullptr;
+        }
+        if (codec == NVICodec_AAC || codec == NVICodec_OPUS || codec == FF_CODEC_PCMA || codec == FF_CODEC_PCMU || codec == FF_CODEC_PCM_S16LE)
+        {
+            return new FFAudioDecoder();
+        }
+        return nullptr;
+    }
+    static int32_t Config(void* decoder, const NVIAudioCodecParam* param)
+    {
+        if (decoder && param)
+        {
+            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
+            return pDecoder->Config(*param) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t Decoding(void* decoder, const NVIAudioEncodedPacket* in, NVIAudioDecode::OnFrame out, void* user)
+    {
+        if (decoder && in)
+        {
+            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
+            if (out == nullptr)
+            {
+                return pDecoder->Decoding(*in, FFAudioDecoder::Output(nullptr)) ? DEC_SUCCESS : DEC_ERROR_DECODING;
+            }
+            else
+            {
+                // 只捕获两个指针，在std::function的小对象缓冲内，不产生堆分配
+                return pDecoder->Decoding(*in,
+                                          [out, user](const NVIAudioWaveFrame* frame) -> int32_t
+                                          {
+                                              return out(frame, user);
+                                          })
+                           ? DEC_SUCCESS
+                           : DEC_ERROR_DECODING;
+            }
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t SetOption(void* decoder, const char* name, int64_t value)
+    {
+        if (decoder && name)
+        {
+            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
+            return pDecoder->SetOption(name, value) ? DEC_SUCCESS : DEC_ERROR_NOT_SUPPORT;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t Release(void* decoder)
+    {
+        if (decoder)
+        {
+            auto pDecoder = reinterpret_cast<FFAudioDecoder*>(decoder);
+            delete pDecoder;
+            return DEC_SUCCESS;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t AllocStats(void* decoder, FFAllocStats* stats)
+    {
+        if (decoder && stats)
+        {
+            return GetAllocStats(reinterpret_cast<FFAudioDecoder*>(decoder), stats);
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+};
+
+class FFmpegBatchDecodeDelegate final
+{
+public:
+    template <typename Input>
+    static int32_t Decoding(uint32_t codec, const Input* in, size_t count, const FFBatchOptions* options, NVIVideoDecode::OnFrame out, void* user)
+    {
+        if (in == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        FFBatchDecoder::Options opts;
+        if (options)
+        {
+            opts.workers = options->workers;
+            opts.max_segments = options->max_segments;
+            opts.max_frames = options->max_frames;
+            opts.threads = options->threads;
+        }
+        FFBatchDecoder decoder;
+        if (!decoder.Config(codec, opts))
+        {
+            return DEC_ERROR_NOT_SUPPORT;
+        }
+        FFBatchDecoder::Output output(nullptr);
+        if (out)
+        {
+            output = [out, user](const NVIVideoImageFrame* frame) -> int32_t
+            {
+                return out(frame, user);
+            };
+        }
+        return decoder.Decoding(in, count, output) ? DEC_SUCCESS : DEC_ERROR_DECODING;
+    }
+};
+
+class FFmpegGopCacheDelegate final
+{
+public:
+    static FFGopCache* Alloc(uint32_t codec, const FFGopCacheOptions* options)
+    {
+        FFGopCache::Options opts;
+        if (options)
+        {
+            if (options->max_packet_bytes > 0)
+            {
+                opts.max_packet_bytes = options->max_packet_bytes;
+            }
+            if (options->max_frame_bytes > 0)
+            {
+                opts.max_frame_bytes = options->max_frame_bytes;
+            }
+            opts.prefetch = options->prefetch;
+            opts.threads = options->threads;
+        }
+        auto pCache = new FFGopCache();
+        if (!pCache->Config(codec, opts))
+        {
+            delete pCache;
+            return nullptr;
+        }
+        return pCache;
+    }
+    static int32_t Push(void* cache, const NVIVideoEncodedPacket* packet)
+    {
+        if (cache && packet)
+        {
+            return reinterpret_cast<FFGopCache*>(cache)->Push(*packet) ? DEC_SUCCESS : DEC_ERROR_DECODING;
+        }
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    static int32_t Seek(void* cache, int64_t pts, int32_t delta, bool step, NVIVideoDecode::OnFrame out, void* user)
+    {
+        if (cache == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        auto pCache = reinterpret_cast<FFGopCache*>(cache);
+        FFGopCache::Output output(nullptr);
+        if (out)
+        {
+            output = [out, user](const NVIVideoImageFrame* frame) -> int32_t
+            {
+                return out(frame, user);
+            };
+        }
+        return (step ? pCache->Step(delta, output) : pCache->Seek(pts, output)) ? DEC_SUCCESS : DEC_ERROR_DECODING;
+    }
+    static int32_t GetStats(void* cache, FFGopCacheStats* stats)
+    {
+        if (cache == nullptr || stats == nullptr)
+        {
+            return DEC_ERROR_INVALID_ARGS;
+        }
+        const FFGopCache::Stats sStats = reinterpret_cast<FFGopCache*>(cache)->GetStats();
+        stats->hits = sStats.hits;
+        stats->misses = sStats.misses;
+        stats->prefetched = sStats.prefetched;
+        stats->evicted = sStats.evicted;
+        stats->packet_bytes = sStats.packet_bytes;
+        stats->frame_bytes = sStats.frame_bytes;
+        stats->gops = sStats.gops;
+        return DEC_SUCCESS;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+NVIVideoDecode VideoDecodeAlloc(uint32_t codec)
+{
+    NVIVideoDecode vd{};
+    vd.decoder = FFmpegVideoDecodeDelegate::Alloc(codec);
+    if (vd.decoder)
+    {
+        vd.Config = &FFmpegVideoDecodeDelegate::Config;
+        vd.Decoding = &FFmpegVideoDecodeDelegate::Decoding;
+        vd.Release = &FFmpegVideoDecodeDelegate::Release;
+    }
+    return vd;
+}
+
+NVIAudioDecode AudioDecodeAlloc(uint32_t codec)
+{
+    NVIAudioDecode ad{};
+    ad.decoder = FFmpegAudioDecodeDelegate::Alloc(codec);
+    if (ad.decoder)
+    {
+        ad.Config = &FFmpegAudioDecodeDelegate::Config;
+        ad.Decoding = &FFmpegAudioDecodeDelegate::Decoding;
+        ad.Release = &FFmpegAudioDecodeDelegate::Release;
+    }
+    return ad;
+}
+
+void SetLogging(void (*logging)(int level, const char* message, unsigned int length))
+{
+    SetLoggingFunc(logging);
+}
+
+void SetLoggingLevel(int level)
+{
+    ffmpeg::SetLogLevel(static_cast<LogLevel>(level));
+}
+
+uint64_t GetLoggingDropped()
+{
+    return LoggingDroppedCount();
+}
+
+void SetTracing(uint32_t capacity)
+{
+    tracing::Enable(capacity);
+}
+
+int32_t DumpTracing(const char* path)
+{
+    int32_t nEvents = tracing::Dump(path);
+    return nEvents >= 0 ? nEvents : DEC_ERROR_INVALID_ARGS;
+}
+
+void PluginShutdown()
+{
+    FFVideoDecoder::ShutdownIdleReaper();
+    // 日志最后停止，休眠检查线程退出前的日志也能输出
+    ShutdownLogging();
+}
+
+void SetAllocStats(int32_t enable)
+{
+    ffmpeg::AllocStats::Enable(enable != 0);
+}
+
+int32_t VideoDecodeAllocStats(void* decoder, FFAllocStats* stats)
+{
+    return FFmpegVideoDecodeDelegate::AllocStats(decoder, stats);
+}
+
+int32_t AudioDecodeAllocStats(void* decoder, FFAllocStats* stats)
+{
+    return FFmpegAudioDecodeDelegate::AllocStats(decoder, stats);
+}
+
+int32_t VideoBatchDecoding(uint32_t codec, const NVIVideoEncodedPacket* packets, uint32_t count, const FFBatchOptions* options,
+                           NVIVideoDecode::OnFrame out, void* user)
+{
+    return FFmpegBatchDecodeDelegate::Decoding(codec, packets, count, options, out, user);
+}
+
+int32_t VideoBatchDecodingStream(uint32_t codec, const uint8_t* stream, size_t size, const FFBatchOptions* options,
+                                 NVIVideoDecode::OnFrame out, void* user)
+{
+    return FFmpegBatchDecodeDelegate::Decoding(codec, stream, size, options, out, user);
+}
+
+int32_t VideoDecodeSetOption(void* decoder, const char* name, int64_t value)
+{
+    return FFmpegVideoDecodeDelegate::SetOption(decoder, name, value);
+}
+
+int32_t VideoDecodeGetStat(void* decoder, const char* name, double* value)
+{
+    return FFmpegVideoDecodeDelegate::GetStat(decoder, name, value);
+}
+
+int32_t VideoDecodingDeadline(void* decoder, const NVIVideoEncodedPacket* in, int64_t budget_us, NVIVideoDecode::OnFrame out, void* user)
+{
+    return FFmpegVideoDecodeDelegate::Decoding(decoder, in, budget_us, out, user);
+}
+
+void SetQoSSlots(uint32_t slots)
+{
+    ffmpeg::Scheduler::Instance().SetSlots(slots);
+}
+
+int32_t GetQoSStats(int32_t qos, FFQoSStats* stats)
+{
+    if (stats == nullptr || qos < ffmpeg::QoS_Realtime || qos >= ffmpeg::QoS_Count)
+    {
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    ffmpeg::Scheduler::Stats sStats{};
+    ffmpeg::Scheduler::Instance().GetStats(static_cast<ffmpeg::QoSClass>(qos), sStats);
+    stats->decodes = sStats.decodes;
+    stats->wait_us = sStats.wait_us;
+    stats->wait_us_max = sStats.wait_us_max;
+    stats->decode_us = sStats.decode_us;
+    stats->decode_us_max = sStats.decode_us_max;
+    return DEC_SUCCESS;
+}
+
+void SetMemoryBudget(uint64_t soft_bytes, uint64_t hard_bytes)
+{
+    ffmpeg::MemoryBudget::Instance().SetLimits(soft_bytes, hard_bytes);
+}
+
+int32_t GetMemoryBudget(FFMemoryBudget* budget)
+{
+    if (budget == nullptr)
+    {
+        return DEC_ERROR_INVALID_ARGS;
+    }
+    auto& rBudget = ffmpeg::MemoryBudget::Instance();
+    budget->used_bytes = rBudget.Used();
+    budget->soft_bytes = rBudget.Soft();
+    budget->hard_bytes = rBudget.Hard();
+    budget->evicted_bytes = rBudget.evicted.load(std::memory_order_relaxed);
+    budget->refused = rBudget.refused.load(std::memory_order_relaxed);
+    budget->pressure = rBudget.Level();
+    return DEC_SUCCESS;
+}
+
+void SetHugePages(int32_t mode)
+{
+    if (mode >= ffmpeg::FramePool::HugePages_None && mode <= ffmpeg::FramePool::HugePages_HugeTLB)
+    {
+        ffmpeg::FramePool::SetHugePages(static_cast<ffmpeg::FramePool::HugePages>(mode));
+    }
+}
+
+int32_t VideoDecodeSetAllocator(void* decoder, const FFFrameAllocator* allocator)
+{
+    return FFmpegVideoDecodeDelegate::SetAllocator(decoder, allocator);
+}
+
+int32_t VideoDecodeSharedRing(void* decoder, int32_t* fd, uint64_t* size)
+{
+    return FFmpegVideoDecodeDelegate::SharedRing(decoder, fd, size);
+}
+
+int32_t VideoDecodeSetMotionOutput(void* decoder, void (*on_motion)(const FFMotionVectors* motion, void* user), void* user)
+{
+    return FFmpegVideoDecodeDelegate::SetMotionOutput(decoder, on_motion, user);
+}
+
+int32_t VideoDecodeSetAnalyticsOutput(void* decoder, void (*on_analytics)(const FFFrameAnalytics* analytics, void* user), void* user)
+{
+    return FFmpegVideoDecodeDelegate::SetAnalyticsOutput(decoder, on_analytics, user);
+}
+
+int32_t VideoDecodeSnapshot(void* decoder, uint32_t max_width, uint32_t max_height, int32_t quality,
+                            void (*on_jpeg)(const uint8_t* jpeg, size_t size, int64_t pts, void* user), void* user)
+{
+    return FFmpegVideoDecodeDelegate::Snapshot(decoder, max_width, max_height, quality, on_jpeg, user);
+}
+
+void* VideoGopCacheAlloc(uint32_t codec, const FFGopCacheOptions* options)
+{
+    return FFmpegGopCacheDelegate::Alloc(codec, options);
+}
+
+int32_t VideoGopCachePush(void* cache, const NVIVideoEncodedPacket* packet)
+{
+    return FFmpegGopCacheDelegate::Push(cache, packet);
+}
+
+int32_t VideoGopCacheSeek(void* cache, int64_t pts, NVIVideoDecode::OnFrame out, void* user)
+{
+    return FFmpegGopCacheDelegate::Seek(cache, pts, 0, false, out, user);
+}
+
+int32_t VideoGopCacheStep(void* cache, int32_t delta, NVIVideoDecode::OnFrame out, void* user)
+{
+    return FFmpegGopCacheDelegate::Seek(cache, 0, delta, true, out, user);
+}
+
+int32_t VideoGopCacheGetStats(void* cache, FFGopCacheStats* stats)
+{
+    return FFmpegGopCacheDelegate::GetStats(cache, stats);
+}
+
+void VideoGopCacheRelease(void* cache)
+{
+    delete reinterpret_cast<FFGopCache*>(cache);
+}
+
+int32_t VideoDecodeSetBandOutput(void* decoder, void (*on_band)(const FFFrameBand* band, void* user), void* user)
+{
+    return FFmpegVideoDecodeDelegate::SetBandOutput(decoder, on_band, user);
+}
+
+int32_t VideoDecodingStream(void* decoder, const uint8_t* data, size_t size, int64_t pts, uint32_t flags, NVIVideoDecode::OnFrame out, void* user)
+{
+    return FFmpegVideoDecodeDelegate::DecodingStream(decoder, data, size, pts, flags, out, user);
+}
+
+int32_t VideoDecodeSetExtradata(void* decoder, const uint8_t* extradata, size_t size)
+{
+    return FFmpegVideoDecodeDelegate::SetExtradata(decoder, extradata, size);
+}
+
+int32_t AudioDecodeSetOption(void* decoder, const char* name, int64_t value)
+{
+    return FFmpegAudioDecodeDelegate::SetOption(decoder, name, value);
+}
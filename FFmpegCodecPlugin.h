@@ -1,17 +1,305 @@
-﻿#pragma once
-
-#include <NVI/Codec.h>
-
-#define EXTERN_C extern "C"
-
-#ifdef _MSC_VER
-#define API EXTERN_C __declspec(dllexport)  // 只使用动态加载，不需要import
-#else
-#define API EXTERN_C __attribute((visibility("default")))
-#endif
-
-API NVIVideoDecode VideoDecodeAlloc(uint32_t codec);
-
-API NVIAudioDecode AudioDecodeAlloc(uint32_t codec);
-
-API void SetLogging(void (*logging)(int level, const char* message, unsigned int length));
+#pragma once
+
+#include <NVI/Codec.h>
+
+#define EXTERN_C extern "C"
+
+#ifdef _MSC_VER
+#define API EXTERN_C __declspec(dllexport)  // 只使用动态加载，不需要import
+#else
+#define API EXTERN_C __attribute((visibility("default")))
+#endif
+
+API NVIVideoDecode VideoDecodeAlloc(uint32_t codec);
+
+// NVICodec之外由插件解码的视频编码，用于VideoDecodeAlloc，只做软件解码
+// 软件解码的10位4:2:0（VP9 Profile 2、AV1 10位、HEVC Main10）转换为NVIPixel_P010LE输出
+typedef enum FFVideoCodec
+{
+    FF_CODEC_MJPEG = 0x4680,  // 帧间无依赖，"threads"不为1时按帧并行解码；4:2:2和4:4:4在各种线程配置下都转换为I420输出
+    FF_CODEC_VP9,             // libavcodec的vp9，帧并行和分块并行
+    FF_CODEC_AV1,             // 编译了libdav1d时优先使用，否则为默认的AV1解码器
+} FFVideoCodec;
+
+// NVICodec之外由插件解码的音频编码，用于AudioDecodeAlloc
+// 不经过libavcodec直接查表展开为交错的16位PCM；采样率和声道数见AudioDecodeSetOption
+typedef enum FFAudioCodec
+{
+    FF_CODEC_PCMA = 0x4600,  // G.711 A-law
+    FF_CODEC_PCMU,           // G.711 µ-law
+    FF_CODEC_PCM_S16LE,      // 16位小端交错PCM，输出直接引用包数据
+} FFAudioCodec;
+
+API NVIAudioDecode AudioDecodeAlloc(uint32_t codec);
+
+API void SetLogging(void (*logging)(int level, const char* message, unsigned int length));
+
+// level取值同LogLevel，高于该级别的日志在格式化前丢弃
+API void SetLoggingLevel(int level);
+
+// 日志队列溢出而丢弃的日志条数
+API uint64_t GetLoggingDropped();
+
+// 开启解码流水线时间线记录，capacity为保留的最近事件数，0表示关闭
+API void SetTracing(uint32_t capacity);
+
+// 以Chrome trace JSON格式输出时间线，可在Perfetto中加载；返回事件数，失败返回负值
+API int32_t DumpTracing(const char* path);
+
+// 在卸载插件（FreeLibrary/dlclose）之前调用：停止并等待日志和休眠检查的后台线程，输出剩余的日志
+// 插件的静态析构不再等待线程，Windows上静态析构在加载器锁内执行，等待线程会死锁
+// 之后的日志丢弃，直到再次SetLogging；休眠检查在之后Config开启休眠的解码器时重新启动
+API void PluginShutdown();
+
+typedef struct FFAllocStats
+{
+    uint64_t allocs;      // 堆分配次数
+    uint64_t frees;       // 释放次数
+    uint64_t live_bytes;  // 当前占用字节数
+    uint64_t peak_bytes;  // 峰值占用字节数
+} FFAllocStats;
+
+// 开启后新Config的解码器统计插件侧分配（包、帧、音频缓冲）及libavcodec软件帧缓冲
+API void SetAllocStats(int32_t enable);
+
+// decoder为NVIVideoDecode::decoder
+API int32_t VideoDecodeAllocStats(void* decoder, FFAllocStats* stats);
+
+// decoder为NVIAudioDecode::decoder
+API int32_t AudioDecodeAllocStats(void* decoder, FFAllocStats* stats);
+
+typedef struct FFBatchOptions
+{
+    uint32_t workers;       // 并行解码的段数，0为CPU核数
+    uint32_t max_segments;  // 同时在途的段数上限，0为workers的两倍；小于workers时并行段数按它
+    uint32_t max_frames;    // 非队首段最多缓存的解码帧数
+    uint32_t threads;       // 每个解码上下文的线程数
+} FFBatchOptions;
+
+// 离线批量解码：在IDR处切分，各段并行解码，按显示顺序同步回调；options可为空
+API int32_t VideoBatchDecoding(uint32_t codec, const NVIVideoEncodedPacket* packets, uint32_t count, const FFBatchOptions* options,
+                               NVIVideoDecode::OnFrame out, void* user);
+
+// 同上，输入为完整的Annex-B裸流，输出帧的tick为显示顺序的序号
+API int32_t VideoBatchDecodingStream(uint32_t codec, const uint8_t* stream, size_t size, const FFBatchOptions* options,
+                                     NVIVideoDecode::OnFrame out, void* user);
+
+// 设置视频解码器选项，在Config之前调用，decoder为NVIVideoDecode::decoder
+//  "threads"            解码线程数，0由FFmpeg自动选择；FF_CODEC_MJPEG为并行解码的帧数，0按CPU核数；VP9/AV1未设置时按0
+//  "threading"          0默认，1片并行，2帧并行，3混合：首个GOP用低延迟片并行，之后在IDR处切换为帧并行
+//  "adaptive_threads"   自适应线程数上限，0关闭；按解码CPU时间与帧间隔之比在关键帧处增减线程，两次调整至少间隔4个GOP，只用于软件解码的H264/HEVC/VP9/AV1
+//  "frame_interval_us"  自适应使用的帧间隔，0按包到达间隔估计
+//  "deadline_us"        默认的包处理时限，0不限；超时的帧不输出，持续超时逐级跳过非参考帧、B帧、非关键帧
+//  "priority"           过载时的优先级0~3，越大越晚丢帧，高优先级流落后时低优先级流先丢非参考帧；默认按qos
+//  "qos"                0实时，1交互（默认），2后台；后台流默认单线程，见SetQoSSlots
+//  "hibernate_ms"       软件解码空闲超过该时间后释放解码上下文和缓冲，下一个关键帧恢复，0不休眠
+//  "shared_ring_bytes"  软件解码帧分配在memfd共享内存中并发布到帧环，0不开启，见FFSharedFrame.h
+//  "shared_ring_frames" 帧环的帧描述个数，默认64
+//  "shared_ring_lease_ms" 帧离开帧环后消费者最多持有的时间，超过后强制回收（消费进程崩溃时不泄漏），默认5000，0不回收
+//  "gray"               只输出亮度平面，色度平面为空；FFmpeg支持时设置AV_CODEC_FLAG_GRAY跳过色度重建
+//  "export_mvs"         导出运动矢量，见VideoDecodeSetMotionOutput；只有软件H264解码器导出
+//  "mv_grid"            运动矢量聚合网格的边长（像素），0不聚合
+//  "motion_only"        开启export_mvs时只回调运动矢量，不下载、转换和回调图像；配合"gray"进一步减少解码开销
+//  "analytics_step"     亮度统计的行列采样间隔，0不统计（默认）；结果见VideoDecodeSetAnalyticsOutput
+//  "snapshot"           保留最近的IDR及参数集，用于VideoDecodeSnapshot
+//  "band_output"        软件解码时按水平带提前回调，见VideoDecodeSetBandOutput；H264强制片并行和低延迟，其余解码器在整帧解出后按16行一带补发
+API int32_t VideoDecodeSetOption(void* decoder, const char* name, int64_t value);
+
+// 获取视频解码器统计
+//  "ttff_us"          Config到首帧输出的时间（微秒），未出帧为-1
+//  "fps"              稳态帧率
+//  "frame_threading"  当前是否为帧并行
+//  "threads"          当前解码线程数
+//  "decode_load"      开启adaptive_threads时每帧解码CPU时间（含工作线程）与帧间隔之比，约为需要的核数
+//  "skip_level"       当前跳帧级别，0不跳
+//  "lag_us"           相对截止时间的平均落后（微秒），负数为提前
+//  "dropped_late"     超时未输出的帧数
+//  "dropped_decode"   解码器丢弃的包数
+//  "hibernated"       当前是否休眠
+//  "hibernations"     休眠次数
+//  "resume_us"        最近一次恢复到首帧输出的时间（微秒），未恢复过为-1
+//  "hibernate_dropped" 休眠中等待关键帧时丢弃的包数
+//  "shared_published" 发布到共享内存帧环的帧数
+//  "shared_dropped"   有平面不在共享内存中而未发布的帧数
+//  "stream_direct_bytes"    VideoDecodingStream中直接从输入送入解码器的访问单元字节数
+//  "stream_copied_bytes"    VideoDecodingStream中跨块拼接到引用计数缓冲的字节数，送入解码器时不再拷贝
+//  "presize_bytes"    Config时按extradata预先分配的帧缓冲字节数
+API int32_t VideoDecodeGetStat(void* decoder, const char* name, double* value);
+
+// 带处理时限的解码，budget_us为该包从调用起的时限（微秒），小于0时使用"deadline_us"选项
+API int32_t VideoDecodingDeadline(void* decoder, const NVIVideoEncodedPacket* in, int64_t budget_us, NVIVideoDecode::OnFrame out, void* user);
+
+// 按QoS等级的解码调度，slots为所有视频解码器同时解码的数量，0不限（默认）
+// 名额空出时先给交互流，再给后台流，排队过久的低等级流优先；实时流从不排队
+API void SetQoSSlots(uint32_t slots);
+
+typedef struct FFQoSStats
+{
+    uint64_t decodes;        // 解码调用次数
+    uint64_t wait_us;        // 累计排队时间
+    uint64_t wait_us_max;    // 最长排队时间
+    uint64_t decode_us;      // 累计解码时间，不含输出回调
+    uint64_t decode_us_max;  // 单个包最长的解码时间，不含输出回调
+} FFQoSStats;
+
+// 获取某个QoS等级的累计统计
+API int32_t GetQoSStats(int32_t qos, FFQoSStats* stats);
+
+// 进程级内存预算，覆盖插件分配的解码帧缓冲、音频缓冲和批量解码的包，0为不限
+// 超过软水位回收空闲帧缓冲，超过硬水位拒绝新的帧缓冲分配（该帧解码失败）和新建解码器（Alloc返回空）
+// 设置后新Config的视频解码器使用插件的帧缓冲池
+API void SetMemoryBudget(uint64_t soft_bytes, uint64_t hard_bytes);
+
+typedef struct FFMemoryBudget
+{
+    uint64_t used_bytes;     // 当前计入预算的字节数
+    uint64_t soft_bytes;     // 软水位
+    uint64_t hard_bytes;     // 硬水位
+    uint64_t evicted_bytes;  // 累计回收的空闲缓冲字节数
+    uint64_t refused;        // 累计拒绝的分配和新建解码器次数
+    int32_t pressure;        // 0正常，1超过软水位，2超过硬水位
+} FFMemoryBudget;
+
+API int32_t GetMemoryBudget(FFMemoryBudget* budget);
+
+// 解码帧缓冲使用2MB大页以减少dTLB缺失，0关闭（默认），1透明大页，2 hugetlbfs预留大页（不足时退回透明大页）
+// 只影响之后Config的软件视频解码器中不小于2MB、按2MB取整浪费不超过1/8的缓冲，内存预算按取整后的长度计算；只在Linux上有效
+API void SetHugePages(int32_t mode);
+
+// 宿主提供的解码帧缓冲分配，libavcodec直接解码到宿主内存，输出帧的平面即指向这些缓冲
+typedef struct FFFrameAllocator
+{
+    void* user;
+    // 分配size字节、至少64字节对齐的缓冲（每个平面一次），opaque由宿主填写并在free时传回
+    // 返回空或未对齐时该平面退回插件分配
+    uint8_t* (*alloc)(void* user, size_t size, void** opaque);
+    // 解码器（含参考帧）不再引用该缓冲时调用，可能在任意解码线程上；解码器释放后仍可能被调用
+    void (*free)(void* user, uint8_t* data, void* opaque);
+} FFFrameAllocator;
+
+// 在Config之前设置，只对软件解码生效，allocator为空时取消
+API int32_t VideoDecodeSetAllocator(void* decoder, const FFFrameAllocator* allocator);
+
+// 获取共享内存帧环的memfd和大小，通过SCM_RIGHTS传给消费进程后按FFSharedFrame.h映射读取
+// fd归解码器所有，不要关闭；未开启"shared_ring_bytes"或Config失败时返回DEC_ERROR_NOT_SUPPORT
+API int32_t VideoDecodeSharedRing(void* decoder, int32_t* fd, uint64_t* size);
+
+// 一帧的运动矢量，各数组长度为count，只在回调期间有效
+typedef struct FFMotionVectors
+{
+    int64_t pts;
+    int32_t width;
+    int32_t height;
+    uint32_t count;
+    const int16_t* x;       // 块中心在当前帧中的坐标
+    const int16_t* y;
+    const int16_t* dx;      // 1/4像素精度，参考块中心为(x + dx / 4, y + dy / 4)
+    const int16_t* dy;
+    const uint8_t* w;       // 块大小
+    const uint8_t* h;
+    const int8_t* source;   // 小于0参考之前的帧，大于0参考之后的帧
+    int32_t grid;           // 聚合网格的边长，0未聚合
+    int32_t cols;
+    int32_t rows;
+    const int16_t* grid_dx; // cols*rows，按行排列，每格内按块面积加权的平均矢量，1/4像素精度
+    const int16_t* grid_dy;
+} FFMotionVectors;
+
+// 在Config之前设置，开启"export_mvs"后每个输出帧在图像回调之前同步回调，帧内编码帧的count为0；on_motion为空时取消
+API int32_t VideoDecodeSetMotionOutput(void* decoder, void (*on_motion)(const FFMotionVectors* motion, void* user), void* user);
+
+// 一帧的亮度统计，pts与随后回调的图像相同
+typedef struct FFFrameAnalytics
+{
+    int64_t pts;
+    uint32_t samples;         // 参与直方图的采样数
+    double mean;              // 采样点的亮度均值，0~255，10位格式取高8位
+    double scene_score;       // 与上一帧归一化直方图的差异，0~1，Config后首帧为0
+    uint32_t histogram[256];  // 采样的亮度直方图
+} FFFrameAnalytics;
+
+// 在Config之前设置，开启"analytics_step"后每个主机内存输出帧在图像回调之前同步回调；on_analytics为空时取消
+API int32_t VideoDecodeSetAnalyticsOutput(void* decoder, void (*on_analytics)(const FFFrameAnalytics* analytics, void* user), void* user);
+
+// 把最近的IDR解码并编码为JPEG，需要开启"snapshot"；按整数倍缩小到不超过max_width*max_height，0为不限；quality为1~100
+// 解码器和mjpeg编码器在所有流之间池化复用，关键帧未变且参数相同时直接返回上次的结果
+// on_jpeg在本函数返回前调用，pts为关键帧的tick；还没有关键帧或解码、编码失败时返回DEC_ERROR_NOT_SUPPORT
+// 不占用解码锁，可在任意线程调用，包括解码回调中
+API int32_t VideoDecodeSnapshot(void* decoder, uint32_t max_width, uint32_t max_height, int32_t quality,
+                                void (*on_jpeg)(const uint8_t* jpeg, size_t size, int64_t pts, void* user), void* user);
+
+typedef struct FFGopCacheOptions
+{
+    uint64_t max_packet_bytes;  // 保存的包数据上限，超出时丢弃最早的GOP，0为256MB
+    uint64_t max_frame_bytes;   // 解码帧上限，超出时按最近使用时间释放整个GOP的帧，0为512MB
+    uint32_t prefetch;          // 沿访问方向在后台预先解码的GOP数
+    uint32_t threads;           // 每个解码上下文的线程数，0为1
+} FFGopCacheOptions;
+
+typedef struct FFGopCacheStats
+{
+    uint64_t hits;          // 请求的帧已解码
+    uint64_t misses;        // 需要同步解码所在的GOP
+    uint64_t prefetched;    // 后台预先解码的GOP数
+    uint64_t evicted;       // 因超出上限释放解码帧的GOP数
+    uint64_t packet_bytes;  // 当前保存的包数据
+    uint64_t frame_bytes;   // 当前缓存的解码帧
+    uint32_t gops;          // 当前保存的GOP数
+} FFGopCacheStats;
+
+// 倒放和逐帧定位用的GOP缓存，codec为AVC或HEVC；options可为空，此时预取1个GOP；失败返回空
+API void* VideoGopCacheAlloc(uint32_t codec, const FFGopCacheOptions* options);
+
+// 按解码顺序追加包，数据被拷贝；第一个IDR之前的包被忽略
+API int32_t VideoGopCachePush(void* cache, const NVIVideoEncodedPacket* packet);
+
+// 同步回调pts不大于给定值的最后一帧，所在GOP未解码时在调用线程上解码；回调中不要再调用该缓存的接口
+API int32_t VideoGopCacheSeek(void* cache, int64_t pts, NVIVideoDecode::OnFrame out, void* user);
+
+// 从上次输出的帧按显示顺序前进（delta大于0）或后退delta帧并回调，到达两端时停在端点
+API int32_t VideoGopCacheStep(void* cache, int32_t delta, NVIVideoDecode::OnFrame out, void* user);
+
+API int32_t VideoGopCacheGetStats(void* cache, FFGopCacheStats* stats);
+
+API void VideoGopCacheRelease(void* cache);
+
+// 解码中已完成的一个水平带，planes指向带的第一行，只在回调期间有效
+typedef struct FFFrameBand
+{
+    int64_t pts;          // 所属帧的tick
+    uint32_t width;       // 整帧尺寸
+    uint32_t height;
+    uint32_t y;           // 带的起始行（亮度）
+    uint32_t rows;        // 带的行数（亮度）
+    uint32_t format;      // 同NVIImageBuffer::format
+    void* planes[4];
+    uint32_t strides[4];
+} FFFrameBand;
+
+// 在Config之前设置，开启"band_output"后解码过程中自上而下逐带回调，整帧完成后仍回调完整图像
+// 可能在解码器的片线程上调用；on_band为空时取消
+API int32_t VideoDecodeSetBandOutput(void* decoder, void (*on_band)(const FFFrameBand* band, void* user), void* user);
+
+// VideoDecodingStream的flags
+typedef enum FFStreamFlags
+{
+    FF_STREAM_END_OF_AU = 1,  // 这块数据在访问单元边界结束，最后一个访问单元立即解码
+    FF_STREAM_PADDED = 2,     // 保留兼容，已忽略：输入不需要填充
+} FFStreamFlags;
+
+// 解码任意分块的Annex-B字节流（H264/HEVC），如网络或文件读取的原始数据，由插件按访问单元切分后解码
+// 完整落在一块数据中的访问单元直接送入解码器（由libavcodec拷贝一次），跨块的访问单元拼接在带填充的缓冲中由解码器引用，不再拷贝
+// 默认最后一个访问单元等到下一个起始码才解码；连续多块都从访问单元边界开始时按块切分，不带FF_STREAM_END_OF_AU也立即解码
+// pts属于第一个在这块数据中开始的访问单元，其余访问单元的tick为AV_NOPTS_VALUE
+// data为空且flags含FF_STREAM_END_OF_AU时解码缓存的最后一个访问单元；Config时清空缓存
+API int32_t VideoDecodingStream(void* decoder, const uint8_t* data, size_t size, int64_t pts, uint32_t flags, NVIVideoDecode::OnFrame out, void* user);
+
+// 在Config之前设置Annex-B格式的参数集：H264为SPS/PPS，HEVC为VPS/SPS/PPS；extradata为空时清除，之后的Config保持使用
+// Config时解析SPS得到尺寸、位深和DPB大小，设置给解码器并预先分配帧缓冲池（硬件解码下载到主机时为页锁定帧）
+// 首帧不再等待缓冲分配；参数集同时用于IDR不带参数集的流
+API int32_t VideoDecodeSetExtradata(void* decoder, const uint8_t* extradata, size_t size);
+
+// 设置音频解码器选项，在Config之前调用，decoder为NVIAudioDecode::decoder
+//  "sample_rate"  FF_CODEC_PCMA/PCMU/PCM_S16LE的采样率，默认8000
+//  "channels"     FF_CODEC_PCMA/PCMU/PCM_S16LE的交错声道数，1-64，默认1
+API int32_t AudioDecodeSetOption(void* decoder, const char* name, int64_t value);
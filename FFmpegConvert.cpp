@@ -0,0 +1,249 @@
+#include "FFmpegConvert.h"
+#include "FFmpegWrapper.hpp"
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define CONVERT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
+namespace ffmpeg
+{
+namespace
+{
+// 两行逐字节平均，4:2:2的色度行合并为4:2:0
+void AverageRows(const uint8_t* a, const uint8_t* b, uint8_t* dst, int32_t n)
+{
+    int32_t i = 0;
+#if defined(CONVERT_SSE2)
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_avg_epu8(va, vb));
+    }
+#elif defined(CONVERT_NEON)
+    for (; i + 16 <= n; i += 16)
+    {
+        vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        dst[i] = static_cast<uint8_t>((a[i] + b[i] + 1) >> 1);
+    }
+}
+
+// 2x2平均，4:4:4的色度缩小为4:2:0；width为源行宽
+void AverageQuads(const uint8_t* a, const uint8_t* b, uint8_t* dst, int32_t width)
+{
+    int32_t x = 0;
+#if defined(CONVERT_SSE2)
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        // 偶数列与奇数列分别按16位相加，四个像素之和加2后右移
+        const __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(va, mask), _mm_srli_epi16(va, 8)),
+                                          _mm_add_epi16(_mm_and_si128(vb, mask), _mm_srli_epi16(vb, 8)));
+        const __m128i avg = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x / 2), _mm_packus_epi16(avg, avg));
+    }
+#elif defined(CONVERT_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(a + x)), vpaddlq_u8(vld1q_u8(b + x)));
+        vst1_u8(dst + x / 2, vrshrn_n_u16(sum, 2));
+    }
+#endif
+    for (; x + 1 < width; x += 2)
+    {
+        dst[x / 2] = static_cast<uint8_t>((a[x] + a[x + 1] + b[x] + b[x + 1] + 2) >> 2);
+    }
+    if (x < width)
+    {
+        dst[x / 2] = static_cast<uint8_t>((a[x] + b[x] + 1) >> 1);
+    }
+}
+
+// 10位低位对齐转为P010的高位对齐
+void ShiftRow(const uint16_t* src, uint16_t* dst, int32_t n)
+{
+    int32_t i = 0;
+#if defined(CONVERT_SSE2)
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_slli_epi16(v, 6));
+    }
+#elif defined(CONVERT_NEON)
+    for (; i + 8 <= n; i += 8)
+    {
+        vst1q_u16(dst + i, vshlq_n_u16(vld1q_u16(src + i), 6));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        dst[i] = static_cast<uint16_t>(src[i] << 6);
+    }
+}
+
+// U、V两行交错为P010的UV行，n为每个分量的样本数
+void InterleaveRow(const uint16_t* u, const uint16_t* v, uint16_t* dst, int32_t n)
+{
+    int32_t i = 0;
+#if defined(CONVERT_SSE2)
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i vu = _mm_slli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i)), 6);
+        const __m128i vv = _mm_slli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)), 6);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), _mm_unpacklo_epi16(vu, vv));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2 + 8), _mm_unpackhi_epi16(vu, vv));
+    }
+#elif defined(CONVERT_NEON)
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8x2_t uv;
+        uv.val[0] = vshlq_n_u16(vld1q_u16(u + i), 6);
+        uv.val[1] = vshlq_n_u16(vld1q_u16(v + i), 6);
+        vst2q_u16(dst + i * 2, uv);
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        dst[i * 2] = static_cast<uint16_t>(u[i] << 6);
+        dst[i * 2 + 1] = static_cast<uint16_t>(v[i] << 6);
+    }
+}
+
+}  // namespace
+
+FormatConverter::FormatConverter()
+    : m_arrPool{nullptr, nullptr}
+    , m_arrPoolSize{0, 0}
+{
+}
+
+FormatConverter::~FormatConverter()
+{
+    for (AVBufferPool*& pPool : m_arrPool)
+    {
+        av_buffer_pool_uninit(&pPool);
+    }
+}
+
+bool FormatConverter::Convert(const AVFrame* src, AVFrame* dst)
+{
+    switch (src->format)
+    {
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ444P:
+    case AV_PIX_FMT_YUV444P: return ToYUV420(src, dst);
+    case AV_PIX_FMT_YUV420P10LE: return ToP010(src, dst);
+    default: return false;
+    }
+}
+
+AVBufferRef* FormatConverter::GetBuffer(uint32_t index, size_t size)
+{
+    if (m_arrPool[index] == nullptr || m_arrPoolSize[index] != size)
+    {
+        av_buffer_pool_uninit(&m_arrPool[index]);
+        m_arrPool[index] = av_buffer_pool_init(size, nullptr);
+        m_arrPoolSize[index] = size;
+    }
+    return m_arrPool[index] ? av_buffer_pool_get(m_arrPool[index]) : nullptr;
+}
+
+bool FormatConverter::ToYUV420(const AVFrame* src, AVFrame* dst)
+{
+    const bool bHorizontal = src->format == AV_PIX_FMT_YUVJ444P || src->format == AV_PIX_FMT_YUV444P;
+    const bool bFull = src->format == AV_PIX_FMT_YUVJ422P || src->format == AV_PIX_FMT_YUVJ444P;
+    const int32_t nWidth = (src->width + 1) / 2;
+    const int32_t nHeight = (src->height + 1) / 2;
+    const int32_t nStride = FFALIGN(nWidth, 64);
+    const size_t szPlane = static_cast<size_t>(nStride) * static_cast<size_t>(nHeight);
+    AVBufferRef* pLuma = av_frame_get_plane_buffer(const_cast<AVFrame*>(src), 0);
+    if (pLuma == nullptr)
+    {
+        return false;
+    }
+    dst->buf[0] = av_buffer_ref(pLuma);
+    dst->buf[1] = GetBuffer(0, szPlane);
+    dst->buf[2] = GetBuffer(0, szPlane);
+    if (dst->buf[0] == nullptr || dst->buf[1] == nullptr || dst->buf[2] == nullptr)
+    {
+        av_frame_unref(dst);
+        return false;
+    }
+    dst->format = bFull ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->data[0] = src->data[0];
+    dst->linesize[0] = src->linesize[0];
+    for (int i = 1; i < 3; ++i)
+    {
+        dst->data[i] = dst->buf[i]->data;
+        dst->linesize[i] = nStride;
+        for (int32_t y = 0; y < nHeight; ++y)
+        {
+            const uint8_t* pTop = src->data[i] + static_cast<ptrdiff_t>(y * 2) * src->linesize[i];
+            const uint8_t* pBottom = src->data[i] + static_cast<ptrdiff_t>(std::min(y * 2 + 1, src->height - 1)) * src->linesize[i];
+            uint8_t* pDst = dst->data[i] + static_cast<ptrdiff_t>(y) * nStride;
+            if (bHorizontal)
+            {
+                AverageQuads(pTop, pBottom, pDst, src->width);
+            }
+            else
+            {
+                AverageRows(pTop, pBottom, pDst, nWidth);
+            }
+        }
+    }
+    dst->extended_data = dst->data;
+    av_frame_copy_props(dst, src);
+    return true;
+}
+
+bool FormatConverter::ToP010(const AVFrame* src, AVFrame* dst)
+{
+    const int32_t nChromaWidth = (src->width + 1) / 2;
+    const int32_t nChromaHeight = (src->height + 1) / 2;
+    // 亮度和交错的色度行宽相同
+    const int32_t nStride = FFALIGN(nChromaWidth * 4, 64);
+    dst->buf[0] = GetBuffer(0, static_cast<size_t>(nStride) * static_cast<size_t>(src->height));
+    dst->buf[1] = GetBuffer(1, static_cast<size_t>(nStride) * static_cast<size_t>(nChromaHeight));
+    if (dst->buf[0] == nullptr || dst->buf[1] == nullptr)
+    {
+        av_frame_unref(dst);
+        return false;
+    }
+    dst->format = AV_PIX_FMT_P010LE;
+    dst->width = src->width;
+    dst->height = src->height;
+    for (int i = 0; i < 2; ++i)
+    {
+        dst->data[i] = dst->buf[i]->data;
+        dst->linesize[i] = nStride;
+    }
+    for (int32_t y = 0; y < src->height; ++y)
+    {
+        ShiftRow(reinterpret_cast<const uint16_t*>(src->data[0] + static_cast<ptrdiff_t>(y) * src->linesize[0]),
+                 reinterpret_cast<uint16_t*>(dst->data[0] + static_cast<ptrdiff_t>(y) * nStride), src->width);
+    }
+    for (int32_t y = 0; y < nChromaHeight; ++y)
+    {
+        InterleaveRow(reinterpret_cast<const uint16_t*>(src->data[1] + static_cast<ptrdiff_t>(y) * src->linesize[1]),
+                      reinterpret_cast<const uint16_t*>(src->data[2] + static_cast<ptrdiff_t>(y) * src->linesize[2]),
+                      reinterpret_cast<uint16_t*>(dst->data[1] + static_cast<ptrdiff_t>(y) * nStride), nChromaWidth);
+    }
+    dst->extended_data = dst->data;
+    av_frame_copy_props(dst, src);
+    return true;
+}
+}  // namespace ffmpeg
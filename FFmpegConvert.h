@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct AVFrame;
+struct AVBufferRef;
+struct AVBufferPool;
+
+namespace ffmpeg
+{
+// 软件帧转换为插件可以输出的格式，每个解码线程一个，新平面从各自的缓冲池分配
+//  4:2:2和4:4:4下采样为4:2:0，亮度平面引用原帧
+//  10位4:2:0（yuv420p10le，HEVC Main10、VP9 Profile 2、AV1 10位）转为P010LE
+class FormatConverter final
+{
+public:
+    FormatConverter();
+    ~FormatConverter();
+    FormatConverter(const FormatConverter&) = delete;
+    FormatConverter& operator=(const FormatConverter&) = delete;
+
+public:
+    // 不需要或不支持转换时返回false，dst不变
+    bool Convert(const AVFrame* src, AVFrame* dst);
+
+private:
+    bool ToYUV420(const AVFrame* src, AVFrame* dst);
+    bool ToP010(const AVFrame* src, AVFrame* dst);
+    AVBufferRef* GetBuffer(uint32_t index, size_t size);
+
+private:
+    AVBufferPool* m_arrPool[2];
+    size_t m_arrPoolSize[2];
+};
+}  // namespace ffmpeg
@@ -0,0 +1,124 @@
+#include "FFmpegG711.h"
+#include <array>
+// 构建不要求AVX2，按运行时检测的CPU特性选择gather路径
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_AMD64)
+#include <immintrin.h>
+#define G711_AVX2
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define G711_TARGET_AVX2
+#else
+#define G711_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace ffmpeg
+{
+namespace
+{
+// code reference libavcodec/pcm_tablegen.h alaw2linear/ulaw2linear
+constexpr int32_t ALaw(uint8_t value)
+{
+    const int32_t a = value ^ 0x55;
+    const int32_t seg = (a & 0x70) >> 4;
+    int32_t t = a & 0x0F;
+    t = seg ? (t + t + 1 + 32) << (seg + 2) : (t + t + 1) << 3;
+    return (a & 0x80) ? t : -t;
+}
+
+constexpr int32_t MuLaw(uint8_t value)
+{
+    const int32_t u = ~value & 0xFF;
+    const int32_t t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+    return (u & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+// 32位表项供gather使用，标量路径同样按32位读取后截断
+template <int32_t (*F)(uint8_t)>
+constexpr std::array<int32_t, 256> MakeTable()
+{
+    std::array<int32_t, 256> arrTable{};
+    for (size_t i = 0; i < arrTable.size(); ++i)
+    {
+        arrTable[i] = F(static_cast<uint8_t>(i));
+    }
+    return arrTable;
+}
+
+alignas(64) constexpr std::array<int32_t, 256> kALaw = MakeTable<ALaw>();
+alignas(64) constexpr std::array<int32_t, 256> kMuLaw = MakeTable<MuLaw>();
+
+#if defined(G711_AVX2)
+bool HasAVX2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int arrInfo[4];
+    __cpuid(arrInfo, 0);
+    if (arrInfo[0] < 7)
+    {
+        return false;
+    }
+    // 需要CPU支持AVX且操作系统保存YMM寄存器
+    __cpuid(arrInfo, 1);
+    if ((arrInfo[2] & (1 << 27)) == 0 || (arrInfo[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(arrInfo, 7, 0);
+    return (arrInfo[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// 每次16个样本，返回处理到的位置
+G711_TARGET_AVX2 size_t ExpandAVX2(const int32_t* table, const uint8_t* src, size_t count, int16_t* dst)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m256i lo = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(bytes), 4);
+        const __m256i hi = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)), 4);
+        // packs按128位通道交错，再按64位重排回顺序
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    return i;
+}
+#endif
+
+void Expand(const int32_t* table, const uint8_t* src, size_t count, int16_t* dst)
+{
+    size_t i = 0;
+#if defined(G711_AVX2)
+    static const bool s_bAVX2 = HasAVX2();
+    if (s_bAVX2)
+    {
+        i = ExpandAVX2(table, src, count, dst);
+    }
+#endif
+    for (; i + 4 <= count; i += 4)
+    {
+        dst[i] = static_cast<int16_t>(table[src[i]]);
+        dst[i + 1] = static_cast<int16_t>(table[src[i + 1]]);
+        dst[i + 2] = static_cast<int16_t>(table[src[i + 2]]);
+        dst[i + 3] = static_cast<int16_t>(table[src[i + 3]]);
+    }
+    for (; i < count; ++i)
+    {
+        dst[i] = static_cast<int16_t>(table[src[i]]);
+    }
+}
+}  // namespace
+
+void ALawToLinear(const uint8_t* src, size_t count, int16_t* dst)
+{
+    Expand(kALaw.data(), src, count, dst);
+}
+
+void MuLawToLinear(const uint8_t* src, size_t count, int16_t* dst)
+{
+    Expand(kMuLaw.data(), src, count, dst);
+}
+}  // namespace ffmpeg
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ffmpeg
+{
+// G.711查表展开为16位线性PCM，多声道时输入本身交错，输出同样交错
+// 不经过libavcodec，每个包只有一次查表循环
+void ALawToLinear(const uint8_t* src, size_t count, int16_t* dst);
+void MuLawToLinear(const uint8_t* src, size_t count, int16_t* dst);
+}  // namespace ffmpeg
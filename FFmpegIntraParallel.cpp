@@ -0,0 +1,208 @@
+#include "FFmpegIntraParallel.h"
+#include "FFmpegWrapper.hpp"
+#include "adaption/Logging.h"
+#include <algorithm>
+
+namespace ffmpeg
+{
+IntraParallel::IntraParallel()
+    : m_szMaxInFlight(1)
+    , m_bStop(false)
+{
+}
+
+IntraParallel::~IntraParallel()
+{
+    Stop();
+}
+
+bool IntraParallel::Start(const AVCodec* codec, uint32_t workers, const Setup& setup)
+{
+    Stop();
+    m_bStop = false;
+    for (uint32_t i = 0; i < std::max(workers, 1u); ++i)
+    {
+        std::unique_ptr<Worker> pWorker(new Worker{nullptr, {}, {}});
+        pWorker->context = avcodec_alloc_context3(codec);
+        if (pWorker->context == nullptr)
+        {
+            break;
+        }
+        // 并行在帧之间，每个上下文单线程
+        pWorker->context->thread_count = 1;
+        if (setup)
+        {
+            setup(pWorker->context);
+        }
+        int nOpen = avcodec_open2(pWorker->context, nullptr, nullptr);
+        if (nOpen != 0)
+        {
+            LOG_ERROR("IntraParallel avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+            avcodec_free_context(&pWorker->context);
+            break;
+        }
+        pWorker->thread = std::thread(&IntraParallel::Work, this, pWorker.get());
+        m_vecWorkers.push_back(std::move(pWorker));
+    }
+    if (m_vecWorkers.empty())
+    {
+        return false;
+    }
+    // 每个工作线程一个在途的包，再多一个让调用线程输出时工作线程不空闲
+    m_szMaxInFlight = m_vecWorkers.size() + 1;
+    return true;
+}
+
+void IntraParallel::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtxJobs);
+        m_bStop = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& pWorker : m_vecWorkers)
+    {
+        if (pWorker->thread.joinable())
+        {
+            pWorker->thread.join();
+        }
+        avcodec_free_context(&pWorker->context);
+    }
+    m_vecWorkers.clear();
+    for (Job* pJob : m_deqJobs)
+    {
+        FreeJob(pJob);
+    }
+    m_deqJobs.clear();
+    for (Job* pJob : m_vecFree)
+    {
+        FreeJob(pJob);
+    }
+    m_vecFree.clear();
+}
+
+bool IntraParallel::Submit(const AVPacket* packet, const Output& output)
+{
+    if (m_vecWorkers.empty())
+    {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(m_mtxJobs);
+    Job* pJob = nullptr;
+    if (!m_vecFree.empty())
+    {
+        pJob = m_vecFree.back();
+        m_vecFree.pop_back();
+    }
+    lock.unlock();
+    if (pJob == nullptr)
+    {
+        pJob = new Job{av_packet_alloc(), av_frame_alloc(), 0, false, false};
+    }
+    // 未引用计数的包数据在这里拷贝，调用返回后包数据即可释放
+    if (pJob->packet == nullptr || pJob->frame == nullptr || av_packet_ref(pJob->packet, packet) < 0)
+    {
+        FreeJob(pJob);
+        return false;
+    }
+    pJob->result = 0;
+    pJob->taken = false;
+    pJob->done = false;
+    lock.lock();
+    m_deqJobs.push_back(pJob);
+    m_cvWork.notify_one();
+    Flush(lock, false, output);
+    return true;
+}
+
+void IntraParallel::Drain(const Output& output)
+{
+    std::unique_lock<std::mutex> lock(m_mtxJobs);
+    Flush(lock, true, output);
+}
+
+void IntraParallel::Flush(std::unique_lock<std::mutex>& lock, bool wait, const Output& output)
+{
+    while (!m_deqJobs.empty())
+    {
+        Job* pJob = m_deqJobs.front();
+        if (!pJob->done)
+        {
+            if (!wait && m_deqJobs.size() < m_szMaxInFlight)
+            {
+                break;
+            }
+            m_cvDone.wait(lock, [pJob]() { return pJob->done; });
+        }
+        m_deqJobs.pop_front();
+        lock.unlock();
+        if (pJob->result >= 0)
+        {
+            if (output)
+            {
+                output(pJob->frame);
+            }
+        }
+        else if (pJob->result != AVERROR(EAGAIN))
+        {
+            LOG_WARNING("IntraParallel decode pts {} failed {}, {}.", pJob->packet->pts, pJob->result, av_errstr(pJob->result));
+        }
+        av_packet_unref(pJob->packet);
+        av_frame_unref(pJob->frame);
+        lock.lock();
+        // 在途的包不超过m_szMaxInFlight，空闲列表最多也只有这么多
+        if (m_vecFree.size() < m_szMaxInFlight)
+        {
+            m_vecFree.push_back(pJob);
+        }
+        else
+        {
+            FreeJob(pJob);
+        }
+    }
+}
+
+void IntraParallel::Work(Worker* worker)
+{
+    auto pConverted = AllocAVFrame();
+    std::unique_lock<std::mutex> lock(m_mtxJobs);
+    while (true)
+    {
+        Job* pJob = nullptr;
+        m_cvWork.wait(lock,
+                      [this, &pJob]()
+                      {
+                          auto it = std::find_if(m_deqJobs.begin(), m_deqJobs.end(), [](const Job* job) { return !job->taken; });
+                          pJob = it != m_deqJobs.end() ? *it : nullptr;
+                          return m_bStop || pJob != nullptr;
+                      });
+        if (m_bStop)
+        {
+            return;
+        }
+        pJob->taken = true;
+        lock.unlock();
+        int nResult = avcodec_send_packet(worker->context, pJob->packet);
+        if (nResult >= 0)
+        {
+            nResult = avcodec_receive_frame(worker->context, pJob->frame);
+        }
+        if (nResult >= 0 && pConverted && worker->converter.Convert(pJob->frame, pConverted.get()))
+        {
+            av_frame_unref(pJob->frame);
+            av_frame_move_ref(pJob->frame, pConverted.get());
+        }
+        lock.lock();
+        pJob->result = nResult;
+        pJob->done = true;
+        m_cvDone.notify_all();
+    }
+}
+
+void IntraParallel::FreeJob(Job* job)
+{
+    av_packet_free(&job->packet);
+    av_frame_free(&job->frame);
+    delete job;
+}
+}  // namespace ffmpeg
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "FFmpegConvert.h"
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+struct AVCodec;
+struct AVCodecContext;
+struct AVPacket;
+struct AVFrame;
+
+namespace ffmpeg
+{
+// 帧间无依赖的编码（MJPEG）的帧并行解码：每个工作线程一个单线程解码上下文，包轮流分给空闲线程
+// 帧在提交顺序上输出，4:2:2和4:4:4在工作线程上下采样为4:2:0，调用线程只做输出
+class IntraParallel final
+{
+public:
+    // 在打开每个工作线程的解码上下文之前调用
+    typedef std::function<void(AVCodecContext* ctx)> Setup;
+    // frame只在回调期间有效，可以move_ref取走
+    typedef std::function<void(AVFrame* frame)> Output;
+
+public:
+    IntraParallel();
+    ~IntraParallel();
+    IntraParallel(const IntraParallel&) = delete;
+    IntraParallel& operator=(const IntraParallel&) = delete;
+
+public:
+    bool Start(const AVCodec* codec, uint32_t workers, const Setup& setup);
+    void Stop();
+    // 引用或拷贝包后交给工作线程，输出之前已完成的帧；在途的包达到上限时等待最早的一个
+    bool Submit(const AVPacket* packet, const Output& output);
+    // 等待并输出所有在途的帧
+    void Drain(const Output& output);
+    uint32_t Workers() const
+    {
+        return static_cast<uint32_t>(m_vecWorkers.size());
+    }
+
+private:
+    struct Job
+    {
+        AVPacket* packet;
+        AVFrame* frame;
+        int result;
+        bool taken;
+        bool done;
+    };
+    struct Worker
+    {
+        AVCodecContext* context;
+        FormatConverter converter;
+        std::thread thread;
+    };
+
+    void Work(Worker* worker);
+    // 按提交顺序输出已完成的帧，wait为true时等待直到队列为空
+    void Flush(std::unique_lock<std::mutex>& lock, bool wait, const Output& output);
+    static void FreeJob(Job* job);
+
+private:
+    std::mutex m_mtxJobs;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    std::deque<Job*> m_deqJobs;
+    // 输出后回收的Job，包和帧已解除引用，下次提交时复用
+    std::vector<Job*> m_vecFree;
+    std::vector<std::unique_ptr<Worker>> m_vecWorkers;
+    size_t m_szMaxInFlight;
+    bool m_bStop;
+};
+}  // namespace ffmpeg
@@ -0,0 +1,652 @@
+#include "FFmpegMemory.h"
+#include "FFmpegWrapper.hpp"
+#include "adaption/Logging.h"
+#include <chrono>
+#include <algorithm>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+extern "C"
+{
+#include <libavutil/pixdesc.h>
+}
+
+namespace ffmpeg
+{
+namespace
+{
+std::atomic<bool> s_bAllocStats(false);
+thread_local AllocStats* t_pAllocStats = nullptr;
+
+// 缓冲区前部保留的块头，记录块大小，同时保持数据的对齐
+constexpr size_t kBlockHeader = 64;
+// 与libavcodec的STRIDE_ALIGN一致，兼容AVX512
+constexpr size_t kStrideAlign = 64;
+// 每个池保留的最多空闲块
+constexpr size_t kMaxFreeBlocks = 32;
+// 块头中记录的分配方式，位于块大小之后
+enum BlockKind : uint32_t
+{
+    BlockKind_Heap = 0,
+    BlockKind_Mapped = 1,
+};
+constexpr size_t kHugePageSize = 2 << 20;
+
+std::atomic<int32_t> s_nHugePages(FramePool::HugePages_None);
+
+inline size_t BlockSize(const uint8_t* block)
+{
+    return *reinterpret_cast<const size_t*>(block);
+}
+
+inline uint32_t& BlockKindOf(uint8_t* block)
+{
+    return *reinterpret_cast<uint32_t*>(block + sizeof(size_t));
+}
+
+inline size_t HugeRound(size_t bytes)
+{
+    return (bytes + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+// 按大页取整浪费超过1/8时不用大页
+constexpr size_t kMaxHugeWaste = 8;
+
+// 按当前设置，bytes字节的块是否映射为大页
+inline bool UseHugePages(size_t bytes)
+{
+#if defined(__linux__)
+    return s_nHugePages.load(std::memory_order_relaxed) != FramePool::HugePages_None && bytes >= kHugePageSize &&
+           HugeRound(bytes) - bytes <= bytes / kMaxHugeWaste;
+#else
+    (void)bytes;
+    return false;
+#endif
+}
+
+// bytes字节的块预计占用的内存，预算和统计都按占用计算
+inline size_t Footprint(size_t bytes)
+{
+    return UseHugePages(bytes) ? HugeRound(bytes) : bytes;
+}
+
+// 已分配的块实际占用的内存，大页映射按取整后的长度
+inline size_t Footprint(uint8_t* block)
+{
+    const size_t szBytes = BlockSize(block) + kBlockHeader;
+    return BlockKindOf(block) == BlockKind_Mapped ? HugeRound(szBytes) : szBytes;
+}
+
+#if defined(__linux__)
+// 映射按大页对齐的内存，对齐后透明大页才能整页使用
+uint8_t* MapHugePages(size_t bytes, bool hugetlb)
+{
+    const size_t szLength = HugeRound(bytes);
+    if (hugetlb)
+    {
+        void* pMap = mmap(nullptr, szLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pMap != MAP_FAILED)
+        {
+            return static_cast<uint8_t*>(pMap);
+        }
+    }
+    void* pMap = mmap(nullptr, szLength + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pMap == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    uint8_t* pRaw = static_cast<uint8_t*>(pMap);
+    uint8_t* pAligned = reinterpret_cast<uint8_t*>(HugeRound(reinterpret_cast<uintptr_t>(pRaw)));
+    if (pAligned > pRaw)
+    {
+        munmap(pRaw, static_cast<size_t>(pAligned - pRaw));
+    }
+    const size_t szTail = static_cast<size_t>(pRaw + szLength + kHugePageSize - (pAligned + szLength));
+    if (szTail > 0)
+    {
+        munmap(pAligned + szLength, szTail);
+    }
+    madvise(pAligned, szLength, MADV_HUGEPAGE);
+    return pAligned;
+}
+#endif
+
+inline int64_t NowTick()
+{
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// 软水位以上两次回收的最小间隔，期间的分配不再遍历各池
+const int64_t kEvictInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(50)).count();
+
+// 按libavcodec的对齐要求计算各平面的行宽和池中缓冲的大小，ctx->pix_fmt需为format
+// code reference video_get_buffer/update_frame_pool
+int PlaneSizes(AVCodecContext* ctx, AVPixelFormat format, int width, int height, int linesize[4], size_t sizes[4])
+{
+    int aligns[AV_NUM_DATA_POINTERS]{};
+    avcodec_align_dimensions2(ctx, &width, &height, aligns);
+    bool unaligned = false;
+    do
+    {
+        int nFill = av_image_fill_linesizes(linesize, format, width);
+        if (nFill < 0)
+        {
+            return nFill;
+        }
+        width += width & ~(width - 1);
+        unaligned = false;
+        for (int i = 0; i < 4; ++i)
+        {
+            unaligned |= aligns[i] > 0 && (linesize[i] % aligns[i]) != 0;
+        }
+    } while (unaligned);
+    ptrdiff_t linesizes[4]{};
+    for (int i = 0; i < 4; ++i)
+    {
+        linesizes[i] = linesize[i];
+    }
+    int nFill = av_image_fill_plane_sizes(sizes, format, height, linesizes);
+    if (nFill < 0)
+    {
+        return nFill;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        sizes[i] = sizes[i] > 0 ? sizes[i] + 16 + kStrideAlign - 1 : 0;
+    }
+    return 0;
+}
+}  // namespace
+
+MemoryBudget& MemoryBudget::Instance()
+{
+    static MemoryBudget s_budget;
+    return s_budget;
+}
+
+void MemoryBudget::SetLimits(uint64_t soft, uint64_t hard)
+{
+    if (hard > 0 && (soft == 0 || soft > hard))
+    {
+        soft = hard;
+    }
+    m_uSoft.store(soft, std::memory_order_relaxed);
+    m_uHard.store(hard, std::memory_order_relaxed);
+    if (soft > 0 && Used() > soft)
+    {
+        Evict(soft - soft / 8);
+    }
+    Report();
+}
+
+bool MemoryBudget::Charge(size_t bytes, bool strict)
+{
+    const uint64_t uUsed = m_uUsed.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    const uint64_t uSoft = Soft();
+    const uint64_t uHard = Hard();
+    if (uSoft > 0 && uUsed > uSoft && EvictDue())
+    {
+        // 回收到软水位以下留出一些余量，避免每次分配都触发
+        Evict(uSoft - uSoft / 8);
+    }
+    if (strict && uHard > 0 && Used() > uHard)
+    {
+        // 硬水位不限频，拒绝之前总是先回收
+        Evict(uSoft - uSoft / 8);
+    }
+    if (strict && uHard > 0 && Used() > uHard)
+    {
+        m_uUsed.fetch_sub(bytes, std::memory_order_relaxed);
+        refused.fetch_add(1, std::memory_order_relaxed);
+        Report();
+        return false;
+    }
+    Report();
+    return true;
+}
+
+MemoryBudget::Pressure MemoryBudget::Level() const
+{
+    const uint64_t uUsed = Used();
+    const uint64_t uHard = Hard();
+    const uint64_t uSoft = Soft();
+    if (uHard > 0 && uUsed >= uHard)
+    {
+        return Pressure_Hard;
+    }
+    if (uSoft > 0 && uUsed >= uSoft)
+    {
+        return Pressure_Soft;
+    }
+    return Pressure_Normal;
+}
+
+bool MemoryBudget::Admit()
+{
+    if (Level() == Pressure_Hard)
+    {
+        // 先尝试回收，再决定是否拒绝
+        Evict(Soft() - Soft() / 8);
+        if (Level() == Pressure_Hard)
+        {
+            refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    return true;
+}
+
+void MemoryBudget::Register(FramePool* pool)
+{
+    std::lock_guard<std::mutex> lock(m_mtxPools);
+    m_vecPools.push_back(pool);
+}
+
+void MemoryBudget::Unregister(FramePool* pool)
+{
+    std::lock_guard<std::mutex> lock(m_mtxPools);
+    m_vecPools.erase(std::remove(m_vecPools.begin(), m_vecPools.end(), pool), m_vecPools.end());
+}
+
+bool MemoryBudget::EvictDue()
+{
+    const int64_t nNow = NowTick();
+    int64_t nNext = m_nNextEvict.load(std::memory_order_relaxed);
+    return nNow >= nNext && m_nNextEvict.compare_exchange_strong(nNext, nNow + kEvictInterval, std::memory_order_relaxed);
+}
+
+void MemoryBudget::Evict(uint64_t target)
+{
+    // 已经有线程在回收时不再重复
+    std::unique_lock<std::mutex> lock(m_mtxPools, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;
+    }
+    std::sort(m_vecPools.begin(), m_vecPools.end(), [](const FramePool* a, const FramePool* b) { return a->LastUse() < b->LastUse(); });
+    for (FramePool* pPool : m_vecPools)
+    {
+        if (Used() <= target)
+        {
+            break;
+        }
+        evicted.fetch_add(pPool->Trim(), std::memory_order_relaxed);
+    }
+}
+
+void MemoryBudget::Report()
+{
+    const int32_t nLevel = Level();
+    const int32_t nReported = m_nReported.exchange(nLevel, std::memory_order_relaxed);
+    if (nLevel > nReported)
+    {
+        LOG_WARNING("MemoryBudget pressure {}, used {} bytes, soft {}, hard {}.", nLevel, Used(), Soft(), Hard());
+    }
+    else if (nLevel < nReported)
+    {
+        LOG_NOTICE("MemoryBudget pressure {}, used {} bytes.", nLevel, Used());
+    }
+}
+
+bool AllocStats::Enabled()
+{
+    return s_bAllocStats.load(std::memory_order_relaxed);
+}
+
+void AllocStats::Enable(bool enable)
+{
+    s_bAllocStats.store(enable, std::memory_order_relaxed);
+}
+
+AllocStats* AllocStats::Current()
+{
+    return t_pAllocStats;
+}
+
+AllocStats::Scope::Scope(AllocStats* stats)
+    : m_pPrevious(t_pAllocStats)
+{
+    t_pAllocStats = stats;
+}
+
+AllocStats::Scope::~Scope()
+{
+    t_pAllocStats = m_pPrevious;
+}
+
+//////////////////////////////////////////////////////////////////////////
+FramePool* FramePool::Create(const std::shared_ptr<AllocStats>& stats)
+{
+    return new FramePool(stats);
+}
+
+FramePool::FramePool(const std::shared_ptr<AllocStats>& stats)
+    : m_uRefs(1)
+    , m_pStats(stats)
+    , m_nLastUse(NowTick())
+    , m_allocator{}
+    , m_szMaxFree(kMaxFreeBlocks)
+{
+    MemoryBudget::Instance().Register(this);
+}
+
+FramePool::~FramePool()
+{
+    MemoryBudget::Instance().Unregister(this);
+    Trim();
+    for (ExternalBuffer* pExternal : m_vecExternal)
+    {
+        delete pExternal;
+    }
+}
+
+void FramePool::AddRef()
+{
+    m_uRefs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FramePool::Release()
+{
+    if (m_uRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete this;
+    }
+}
+
+int FramePool::GetBuffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+{
+    const AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+    if (ctx->hw_frames_ctx || ctx->codec_type != AVMEDIA_TYPE_VIDEO || (ctx->codec->capabilities & AV_CODEC_CAP_DR1) == 0 || desc == nullptr ||
+        (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL)) != 0)
+    {
+        return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+    int linesize[4]{};
+    size_t sizes[4]{};
+    int nFill = PlaneSizes(ctx, format, frame->width, frame->height, linesize, sizes);
+    if (nFill < 0)
+    {
+        return nFill;
+    }
+    for (int i = 0; i < 4 && sizes[i] > 0; ++i)
+    {
+        frame->buf[i] = Acquire(sizes[i]);
+        if (frame->buf[i] == nullptr)
+        {
+            av_frame_unref(frame);
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+AVBufferRef* FramePool::Acquire(size_t size)
+{
+    m_nLastUse.store(NowTick(), std::memory_order_relaxed);
+    if (m_allocator.alloc)
+    {
+        AVBufferRef* pRef = AcquireExternal(size);
+        if (pRef)
+        {
+            return pRef;
+        }
+    }
+    uint8_t* pBlock = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxFree);
+        for (auto it = m_vecFree.begin(); it != m_vecFree.end(); ++it)
+        {
+            if (BlockSize(*it) == size)
+            {
+                pBlock = *it;
+                m_vecFree.erase(it);
+                break;
+            }
+        }
+    }
+    if (pBlock == nullptr)
+    {
+        const size_t szCharge = Footprint(size + kBlockHeader);
+        if (!MemoryBudget::Instance().Charge(szCharge, true))
+        {
+            LOG_ERROR("FramePool alloc {} bytes over memory budget.", size);
+            return nullptr;
+        }
+        pBlock = AllocBlock(size + kBlockHeader);
+        if (pBlock == nullptr)
+        {
+            MemoryBudget::Instance().Uncharge(szCharge);
+            LOG_ERROR("FramePool alloc {} bytes failed.", size);
+            return nullptr;
+        }
+        *reinterpret_cast<size_t*>(pBlock) = size;
+        Recharge(pBlock, szCharge);
+    }
+    AVBufferRef* pRef = av_buffer_create(pBlock + kBlockHeader, size, &FramePool::ReturnBuffer, this, 0);
+    if (pRef == nullptr)
+    {
+        FreeBlock(pBlock);
+        return nullptr;
+    }
+    AddRef();
+    return pRef;
+}
+
+size_t FramePool::Reserve(AVCodecContext* ctx, int32_t format, int32_t width, int32_t height, uint32_t frames)
+{
+    if (m_allocator.alloc)
+    {
+        // 宿主分配时池不缓存
+        return 0;
+    }
+    int linesize[4]{};
+    size_t sizes[4]{};
+    const AVPixelFormat eFormat = ctx->pix_fmt;
+    ctx->pix_fmt = static_cast<AVPixelFormat>(format);
+    const int nFill = PlaneSizes(ctx, static_cast<AVPixelFormat>(format), width, height, linesize, sizes);
+    ctx->pix_fmt = eFormat;
+    if (nFill < 0)
+    {
+        return 0;
+    }
+    MemoryBudget& budget = MemoryBudget::Instance();
+    std::vector<uint8_t*> vecBlocks;
+    size_t szBytes = 0;
+    for (uint32_t n = 0; n < frames; ++n)
+    {
+        for (int i = 0; i < 4 && sizes[i] > 0; ++i)
+        {
+            // 预分配不挤占其他解码器，会超过软水位时停止
+            const size_t szCharge = Footprint(sizes[i] + kBlockHeader);
+            if (budget.Soft() > 0 && budget.Used() + szCharge > budget.Soft())
+            {
+                n = frames;
+                break;
+            }
+            budget.Charge(szCharge, false);
+            uint8_t* pBlock = AllocBlock(sizes[i] + kBlockHeader);
+            if (pBlock == nullptr)
+            {
+                budget.Uncharge(szCharge);
+                n = frames;
+                break;
+            }
+            *reinterpret_cast<size_t*>(pBlock) = sizes[i];
+            Recharge(pBlock, szCharge);
+            vecBlocks.push_back(pBlock);
+            szBytes += Footprint(pBlock);
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_mtxFree);
+    m_vecFree.insert(m_vecFree.end(), vecBlocks.begin(), vecBlocks.end());
+    m_szMaxFree = std::max(m_szMaxFree, m_vecFree.size());
+    return szBytes;
+}
+
+void FramePool::SetHugePages(HugePages mode)
+{
+    s_nHugePages.store(mode, std::memory_order_relaxed);
+}
+
+FramePool::HugePages FramePool::GetHugePages()
+{
+    return static_cast<HugePages>(s_nHugePages.load(std::memory_order_relaxed));
+}
+
+uint8_t* FramePool::AllocBlock(size_t bytes)
+{
+    uint8_t* pBlock = nullptr;
+#if defined(__linux__)
+    // 小于一个大页的缓冲（低分辨率的色度平面等）和取整浪费太多的缓冲不用大页
+    if (UseHugePages(bytes))
+    {
+        pBlock = MapHugePages(bytes, s_nHugePages.load(std::memory_order_relaxed) == HugePages_HugeTLB);
+        if (pBlock)
+        {
+            BlockKindOf(pBlock) = BlockKind_Mapped;
+            return pBlock;
+        }
+        LOG_WARNING("FramePool map {} bytes huge pages failed, fallback.", bytes);
+    }
+#endif
+    pBlock = static_cast<uint8_t*>(av_malloc(bytes));
+    if (pBlock)
+    {
+        BlockKindOf(pBlock) = BlockKind_Heap;
+    }
+    return pBlock;
+}
+
+AVBufferRef* FramePool::AcquireExternal(size_t size)
+{
+    void* pOpaque = nullptr;
+    uint8_t* pData = m_allocator.alloc(m_allocator.user, size, &pOpaque);
+    if (pData == nullptr)
+    {
+        return nullptr;
+    }
+    if ((reinterpret_cast<uintptr_t>(pData) & (kStrideAlign - 1)) != 0)
+    {
+        LOG_WARNING("FramePool host buffer {} not aligned to {}, fallback.", static_cast<void*>(pData), kStrideAlign);
+        m_allocator.free(m_allocator.user, pData, pOpaque);
+        return nullptr;
+    }
+    ExternalBuffer* pExternal = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxFree);
+        if (!m_vecExternal.empty())
+        {
+            pExternal = m_vecExternal.back();
+            m_vecExternal.pop_back();
+        }
+    }
+    if (pExternal == nullptr)
+    {
+        pExternal = new ExternalBuffer;
+    }
+    pExternal->pool = this;
+    pExternal->opaque = pOpaque;
+    AVBufferRef* pRef = av_buffer_create(pData, size, &FramePool::ReturnExternal, pExternal, 0);
+    if (pRef == nullptr)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtxFree);
+            m_vecExternal.push_back(pExternal);
+        }
+        m_allocator.free(m_allocator.user, pData, pOpaque);
+        return nullptr;
+    }
+    AddRef();
+    return pRef;
+}
+
+void FramePool::ReturnExternal(void* opaque, uint8_t* data)
+{
+    ExternalBuffer* pExternal = reinterpret_cast<ExternalBuffer*>(opaque);
+    FramePool* pPool = pExternal->pool;
+    pPool->m_allocator.free(pPool->m_allocator.user, data, pExternal->opaque);
+    {
+        std::lock_guard<std::mutex> lock(pPool->m_mtxFree);
+        pPool->m_vecExternal.push_back(pExternal);
+    }
+    pPool->Release();
+}
+
+size_t FramePool::Trim()
+{
+    std::vector<uint8_t*> vecFree;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxFree);
+        vecFree.swap(m_vecFree);
+    }
+    size_t szBytes = 0;
+    for (uint8_t* pBlock : vecFree)
+    {
+        szBytes += Footprint(pBlock);
+        FreeBlock(pBlock);
+    }
+    return szBytes;
+}
+
+void FramePool::ReturnBuffer(void* opaque, uint8_t* data)
+{
+    FramePool* pPool = reinterpret_cast<FramePool*>(opaque);
+    uint8_t* pBlock = data - kBlockHeader;
+    bool bCached = false;
+    // 软水位以上照常缓存，由回收按最近使用时间释放；硬水位以上不再缓存
+    if (MemoryBudget::Instance().Level() != MemoryBudget::Pressure_Hard)
+    {
+        std::lock_guard<std::mutex> lock(pPool->m_mtxFree);
+        if (pPool->m_vecFree.size() < pPool->m_szMaxFree)
+        {
+            pPool->m_vecFree.push_back(pBlock);
+            bCached = true;
+        }
+    }
+    if (!bCached)
+    {
+        pPool->FreeBlock(pBlock);
+    }
+    pPool->Release();
+}
+
+void FramePool::Recharge(uint8_t* block, size_t charged)
+{
+    // 大页映射失败退回堆、或者分配期间大页设置改变时，按实际占用修正
+    const size_t szFootprint = Footprint(block);
+    if (szFootprint > charged)
+    {
+        MemoryBudget::Instance().Charge(szFootprint - charged, false);
+    }
+    else if (szFootprint < charged)
+    {
+        MemoryBudget::Instance().Uncharge(charged - szFootprint);
+    }
+    if (m_pStats)
+    {
+        m_pStats->Alloc(szFootprint);
+    }
+}
+
+void FramePool::FreeBlock(uint8_t* block)
+{
+    const size_t szFootprint = Footprint(block);
+    if (m_pStats)
+    {
+        m_pStats->Free(szFootprint);
+    }
+    MemoryBudget::Instance().Uncharge(szFootprint);
+#if defined(__linux__)
+    if (BlockKindOf(block) == BlockKind_Mapped)
+    {
+        munmap(block, HugeRound(BlockSize(block) + kBlockHeader));
+        return;
+    }
+#endif
+    av_free(block);
+}
+}  // namespace ffmpeg
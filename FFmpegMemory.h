@@ -0,0 +1,218 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVBufferRef;
+
+namespace ffmpeg
+{
+// 单个解码器的堆分配统计，只在开启统计模式后创建
+class AllocStats final
+{
+public:
+    static bool Enabled();
+    static void Enable(bool enable);
+    // 当前线程正在服务的解码器，未开启统计时为空
+    static AllocStats* Current();
+
+    void Alloc(size_t bytes)
+    {
+        allocs.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t uLive = live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        uint64_t uPeak = peak.load(std::memory_order_relaxed);
+        while (uLive > uPeak && !peak.compare_exchange_weak(uPeak, uLive, std::memory_order_relaxed))
+        {
+        }
+    }
+    void Free(size_t bytes)
+    {
+        frees.fetch_add(1, std::memory_order_relaxed);
+        live.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+public:
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> live{0};
+    std::atomic<uint64_t> peak{0};
+
+public:
+    // 在解码器入口处声明，期间本线程的插件侧分配都记到该解码器上
+    class Scope final
+    {
+    public:
+        explicit Scope(AllocStats* stats);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        AllocStats* m_pPrevious;
+    };
+};
+
+class FramePool;
+
+// 进程级内存预算，统计帧缓冲池、音频缓冲和批量解码的包拷贝
+// 超过软水位时限频（50ms一次）按最近使用时间回收各池的空闲缓冲，池照常缓存归还的缓冲
+// 超过硬水位时先回收，池不再缓存归还的缓冲，仍超过则拒绝新的池分配和新建解码器
+class MemoryBudget final
+{
+public:
+    enum Pressure : int32_t
+    {
+        Pressure_Normal = 0,
+        Pressure_Soft = 1,
+        Pressure_Hard = 2,
+    };
+
+public:
+    static MemoryBudget& Instance();
+    // 水位为0表示不限
+    void SetLimits(uint64_t soft, uint64_t hard);
+    bool Limited() const
+    {
+        return m_uSoft.load(std::memory_order_relaxed) > 0 || m_uHard.load(std::memory_order_relaxed) > 0;
+    }
+    // strict时超过硬水位先回收，仍超过则失败
+    bool Charge(size_t bytes, bool strict);
+    void Uncharge(size_t bytes)
+    {
+        m_uUsed.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+    Pressure Level() const;
+    // 新建解码器前检查，硬水位以上拒绝
+    bool Admit();
+
+    void Register(FramePool* pool);
+    void Unregister(FramePool* pool);
+
+public:
+    std::atomic<uint64_t> evicted{0};
+    std::atomic<uint64_t> refused{0};
+    uint64_t Used() const
+    {
+        return m_uUsed.load(std::memory_order_relaxed);
+    }
+    uint64_t Soft() const
+    {
+        return m_uSoft.load(std::memory_order_relaxed);
+    }
+    uint64_t Hard() const
+    {
+        return m_uHard.load(std::memory_order_relaxed);
+    }
+
+private:
+    MemoryBudget() = default;
+    // 距上次软水位回收已超过间隔时返回true，多个线程同时到期只有一个返回true
+    bool EvictDue();
+    void Evict(uint64_t target);
+    void Report();
+
+private:
+    std::atomic<uint64_t> m_uUsed{0};
+    std::atomic<uint64_t> m_uSoft{0};
+    std::atomic<uint64_t> m_uHard{0};
+    std::atomic<int32_t> m_nReported{Pressure_Normal};
+    std::atomic<int64_t> m_nNextEvict{0};
+    std::mutex m_mtxPools;
+    std::vector<FramePool*> m_vecPools;
+};
+
+// 解码帧缓冲池，通过get_buffer2接管libavcodec的软件帧分配
+// 缓冲区持有池的引用，解码器释放后池在最后一个缓冲区归还时销毁
+class FramePool final
+{
+public:
+    enum HugePages : int32_t
+    {
+        HugePages_None = 0,
+        HugePages_Transparent = 1,  // mmap后madvise(MADV_HUGEPAGE)
+        HugePages_HugeTLB = 2,      // MAP_HUGETLB，需要预留大页，失败时退回透明大页
+    };
+    // 之后分配的不小于一个大页、取整浪费不超过1/8的缓冲使用大页，预算按取整后的长度计算；只在Linux上有效
+    static void SetHugePages(HugePages mode);
+    static HugePages GetHugePages();
+
+    // 宿主提供的缓冲分配，设置后帧直接解码到宿主内存，不经过池的缓存和内存预算
+    struct Allocator
+    {
+        void* user;
+        // 返回至少64字节对齐、size字节的缓冲，opaque由宿主填写并在释放时传回；返回空时退回池分配
+        uint8_t* (*alloc)(void* user, size_t size, void** opaque);
+        // libavcodec和插件都不再引用该缓冲时调用，可能在任意解码线程上
+        void (*free)(void* user, uint8_t* data, void* opaque);
+    };
+
+public:
+    static FramePool* Create(const std::shared_ptr<AllocStats>& stats);
+    void SetAllocator(const Allocator& allocator)
+    {
+        m_allocator = allocator;
+    }
+    void AddRef();
+    void Release();
+
+    // 对应AVCodecContext::get_buffer2，硬件帧或不支持的格式交给默认实现
+    int GetBuffer(AVCodecContext* ctx, AVFrame* frame, int flags);
+    AVBufferRef* Acquire(size_t size);
+    // 按解码器将要分配的格式和尺寸预先放入frames帧的空闲缓冲，返回分配的字节数
+    size_t Reserve(AVCodecContext* ctx, int32_t format, int32_t width, int32_t height, uint32_t frames);
+    // 释放所有空闲缓冲区，返回释放的字节数
+    size_t Trim();
+    // 最近一次分配的时间，用于内存预算的回收顺序
+    int64_t LastUse() const
+    {
+        return m_nLastUse.load(std::memory_order_relaxed);
+    }
+
+private:
+    // 宿主缓冲的释放信息，随AVBufferRef传递
+    struct ExternalBuffer
+    {
+        FramePool* pool;
+        void* opaque;
+    };
+
+private:
+    explicit FramePool(const std::shared_ptr<AllocStats>& stats);
+    ~FramePool();
+    static void ReturnBuffer(void* opaque, uint8_t* data);
+    static void ReturnExternal(void* opaque, uint8_t* data);
+    AVBufferRef* AcquireExternal(size_t size);
+    static uint8_t* AllocBlock(size_t bytes);
+    // 按块的实际占用修正分配前计入预算的charged字节，并计入统计
+    void Recharge(uint8_t* block, size_t charged);
+    void FreeBlock(uint8_t* block);
+
+private:
+    std::atomic<uint32_t> m_uRefs;
+    std::shared_ptr<AllocStats> m_pStats;
+    std::atomic<int64_t> m_nLastUse;
+    Allocator m_allocator;
+    std::mutex m_mtxFree;
+    std::vector<uint8_t*> m_vecFree;
+    // 归还的宿主缓冲描述，复用以免每个平面都new一次，个数不超过同时在用的宿主缓冲数
+    std::vector<ExternalBuffer*> m_vecExternal;
+    // 保留的空闲块上限，预分配超过默认值时放宽到预分配的数量
+    size_t m_szMaxFree;
+};
+
+inline void ReleaseFramePool(FramePool* pPool)
+{
+    if (pPool)
+    {
+        pPool->Release();
+    }
+}
+
+typedef std::unique_ptr<FramePool, void (*)(FramePool*)> FramePoolPtr;
+}  // namespace ffmpeg
@@ -0,0 +1,85 @@
+#include "FFmpegMotion.h"
+#include "FFmpegWrapper.hpp"
+#include <algorithm>
+extern "C"
+{
+#include <libavutil/motion_vector.h>
+}
+
+namespace ffmpeg
+{
+MotionField::MotionField()
+    : pts(AV_NOPTS_VALUE)
+    , width(0)
+    , height(0)
+    , grid(0)
+    , cols(0)
+    , rows(0)
+{
+}
+
+MotionField::~MotionField()
+{
+}
+
+void MotionField::Extract(const AVFrame* frame, int32_t cell)
+{
+    pts = frame->pts;
+    width = frame->width;
+    height = frame->height;
+    const AVFrameSideData* pSide = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+    const AVMotionVector* pMVs = pSide ? reinterpret_cast<const AVMotionVector*>(pSide->data) : nullptr;
+    const size_t szCount = pSide ? pSide->size / sizeof(AVMotionVector) : 0;
+    x.resize(szCount);
+    y.resize(szCount);
+    dx.resize(szCount);
+    dy.resize(szCount);
+    w.resize(szCount);
+    h.resize(szCount);
+    source.resize(szCount);
+    for (size_t i = 0; i < szCount; ++i)
+    {
+        const AVMotionVector& mv = pMVs[i];
+        const int32_t nScale = mv.motion_scale > 0 ? mv.motion_scale : 1;
+        x[i] = mv.dst_x;
+        y[i] = mv.dst_y;
+        dx[i] = static_cast<int16_t>(mv.motion_x * 4 / nScale);
+        dy[i] = static_cast<int16_t>(mv.motion_y * 4 / nScale);
+        w[i] = mv.w;
+        h[i] = mv.h;
+        source[i] = static_cast<int8_t>(mv.source < 0 ? -1 : 1);
+    }
+
+    grid = cell > 0 ? cell : 0;
+    cols = grid > 0 ? (width + grid - 1) / grid : 0;
+    rows = grid > 0 ? (height + grid - 1) / grid : 0;
+    const size_t szCells = static_cast<size_t>(cols) * static_cast<size_t>(rows);
+    grid_dx.assign(szCells, 0);
+    grid_dy.assign(szCells, 0);
+    if (szCells == 0 || szCount == 0)
+    {
+        return;
+    }
+    // 每格三项累加：dx*面积、dy*面积、面积；块按中心落入的格计算
+    m_vecSum.assign(szCells * 3, 0);
+    for (size_t i = 0; i < szCount; ++i)
+    {
+        const int32_t nCol = std::min(std::max(static_cast<int32_t>(x[i]), 0) / grid, cols - 1);
+        const int32_t nRow = std::min(std::max(static_cast<int32_t>(y[i]), 0) / grid, rows - 1);
+        const int64_t nArea = static_cast<int64_t>(w[i]) * h[i];
+        int64_t* pSum = m_vecSum.data() + (static_cast<size_t>(nRow) * static_cast<size_t>(cols) + static_cast<size_t>(nCol)) * 3;
+        pSum[0] += dx[i] * nArea;
+        pSum[1] += dy[i] * nArea;
+        pSum[2] += nArea;
+    }
+    for (size_t i = 0; i < szCells; ++i)
+    {
+        const int64_t* pSum = m_vecSum.data() + i * 3;
+        if (pSum[2] > 0)
+        {
+            grid_dx[i] = static_cast<int16_t>(pSum[0] / pSum[2]);
+            grid_dy[i] = static_cast<int16_t>(pSum[1] / pSum[2]);
+        }
+    }
+}
+}  // namespace ffmpeg
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct AVFrame;
+
+namespace ffmpeg
+{
+// 解码器导出的运动矢量（AV_CODEC_FLAG2_EXPORT_MVS），按字段分开存放便于逐列向量化处理
+// 缓冲在帧之间复用，稳态下不再分配
+class MotionField final
+{
+public:
+    MotionField();
+    ~MotionField();
+    MotionField(const MotionField&) = delete;
+    MotionField& operator=(const MotionField&) = delete;
+
+public:
+    // 提取帧的运动矢量，没有时（帧内编码、硬件解码）数量为0；grid为聚合网格的边长（像素），0不聚合
+    void Extract(const AVFrame* frame, int32_t grid);
+    size_t Count() const
+    {
+        return x.size();
+    }
+
+public:
+    int64_t pts;
+    int32_t width;
+    int32_t height;
+    // 块中心在当前帧中的坐标
+    std::vector<int16_t> x;
+    std::vector<int16_t> y;
+    // 1/4像素精度，参考块中心为(x + dx / 4, y + dy / 4)
+    std::vector<int16_t> dx;
+    std::vector<int16_t> dy;
+    std::vector<uint8_t> w;
+    std::vector<uint8_t> h;
+    // 小于0参考之前的帧，大于0参考之后的帧
+    std::vector<int8_t> source;
+
+    int32_t grid;
+    int32_t cols;
+    int32_t rows;
+    // 每格内按块面积加权的平均矢量，1/4像素精度，没有块的格为0
+    std::vector<int16_t> grid_dx;
+    std::vector<int16_t> grid_dy;
+
+private:
+    std::vector<int64_t> m_vecSum;
+};
+}  // namespace ffmpeg
@@ -0,0 +1,185 @@
+#include "FFmpegOverload.h"
+#include "FFmpegWrapper.hpp"
+#include "adaption/Logging.h"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+namespace ffmpeg
+{
+namespace
+{
+// 各优先级正在落后的流数
+std::atomic<uint32_t> s_arrBehind[Overload::kMaxPriority + 1];
+
+// 逐级丢弃：非参考帧、B帧、非关键帧
+constexpr int32_t kDiscards[] = {AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_BIDIR, AVDISCARD_NONKEY};
+constexpr int32_t kMaxLevel = static_cast<int32_t>(sizeof(kDiscards) / sizeof(kDiscards[0])) - 1;
+// 持续这么久没有迟到帧后降低一级；按时间而不是帧数，高级别时只有关键帧解码也能按时恢复
+constexpr int64_t kRecoverUs = 1000000;
+
+inline int64_t NowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+}  // namespace
+
+Overload::Overload()
+    : m_arrEntries{}
+    , m_szHead(0)
+    , m_uId(0)
+    , m_nPriority(0)
+    , m_nLevel(0)
+    , m_uLate(0)
+    , m_nSteadySince(0)
+    , m_bBehind(false)
+    , m_fLagUs(0.0)
+    , m_uDroppedLate(0)
+    , m_uDroppedDecode(0)
+{
+}
+
+Overload::~Overload()
+{
+    SetBehind(false);
+}
+
+void Overload::Reset(uint32_t id, int32_t priority)
+{
+    SetBehind(false);
+    m_uId = id;
+    m_arrEntries.fill(Entry{});
+    m_szHead = 0;
+    m_nPriority = std::min(std::max(priority, 0), kMaxPriority);
+    m_nLevel = 0;
+    m_uLate = 0;
+    m_nSteadySince = 0;
+    m_fLagUs = 0.0;
+}
+
+void Overload::Submit(int64_t pts, int64_t budget)
+{
+    if (budget <= 0)
+    {
+        return;
+    }
+    Entry& entry = m_arrEntries[m_szHead];
+    if (entry.pending)
+    {
+        // 被覆盖时仍未出帧，认为被解码器丢弃
+        ++m_uDroppedDecode;
+    }
+    const int64_t nNow = NowUs();
+    entry = Entry{pts, nNow + budget, true};
+    m_szHead = (m_szHead + 1) % m_arrEntries.size();
+    // 高级别时大部分包不出帧，提交时也检查是否可以恢复
+    Recover(nNow);
+}
+
+bool Overload::Complete(int64_t pts)
+{
+    // 从最早提交的开始找，pts重复时按提交顺序对应；没有pts的帧对应最早的待出帧
+    Entry* pMatch = nullptr;
+    for (size_t i = 0; i < m_arrEntries.size() && pMatch == nullptr; ++i)
+    {
+        Entry& entry = m_arrEntries[(m_szHead + i) % m_arrEntries.size()];
+        if (entry.pending && entry.pts == pts)
+        {
+            pMatch = &entry;
+        }
+    }
+    for (size_t i = 0; i < m_arrEntries.size() && pMatch == nullptr && pts == AV_NOPTS_VALUE; ++i)
+    {
+        Entry& entry = m_arrEntries[(m_szHead + i) % m_arrEntries.size()];
+        if (entry.pending)
+        {
+            pMatch = &entry;
+        }
+    }
+    if (pMatch == nullptr)
+    {
+        return false;
+    }
+    pMatch->pending = false;
+    const int64_t nNow = NowUs();
+    const int64_t nLag = nNow - pMatch->deadline;
+    m_fLagUs += (static_cast<double>(nLag) - m_fLagUs) / 8.0;
+    const bool bLate = nLag > 0;
+    Update(bLate, nNow);
+    if (bLate)
+    {
+        ++m_uDroppedLate;
+    }
+    return bLate;
+}
+
+int32_t Overload::Discard() const
+{
+    int32_t nLevel = m_nLevel;
+    // 更高优先级的流落后时，本流至少丢弃非参考帧让出CPU
+    for (int32_t i = m_nPriority + 1; i <= kMaxPriority && nLevel == 0; ++i)
+    {
+        if (s_arrBehind[i].load(std::memory_order_relaxed) > 0)
+        {
+            nLevel = 1;
+        }
+    }
+    return kDiscards[nLevel];
+}
+
+void Overload::Update(bool late, int64_t now)
+{
+    if (late)
+    {
+        m_nSteadySince = now;
+        // 优先级越低，越少的迟到帧就开始升级
+        if (++m_uLate >= (4u << m_nPriority) && m_nLevel < kMaxLevel)
+        {
+            ++m_nLevel;
+            m_uLate = 0;
+            LOG_WARNING("Overload#{} lag {:.0f}us, skip level {}.", m_uId, m_fLagUs, m_nLevel);
+        }
+    }
+    else
+    {
+        m_uLate = 0;
+        Recover(now);
+    }
+    SetBehind(m_nLevel > 0 || m_uLate > 0);
+}
+
+void Overload::Recover(int64_t now)
+{
+    if (m_nLevel == 0 || m_uLate > 0)
+    {
+        return;
+    }
+    if (m_nSteadySince == 0)
+    {
+        m_nSteadySince = now;
+    }
+    else if (now - m_nSteadySince >= kRecoverUs)
+    {
+        --m_nLevel;
+        m_nSteadySince = now;
+        LOG_INFO("Overload#{} recover, skip level {}.", m_uId, m_nLevel);
+        SetBehind(m_nLevel > 0);
+    }
+}
+
+void Overload::SetBehind(bool behind)
+{
+    if (behind != m_bBehind)
+    {
+        m_bBehind = behind;
+        if (behind)
+        {
+            s_arrBehind[m_nPriority].fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            s_arrBehind[m_nPriority].fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+}
+}  // namespace ffmpeg
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace ffmpeg
+{
+// 过载保护：按包的截止时间统计解码落后程度，逐级提高skip_frame，追上后逐级恢复
+// 优先级高的流落后时，优先级低的流先丢弃非参考帧
+class Overload final
+{
+public:
+    // 优先级0~3，数值越大越晚丢帧
+    static constexpr int32_t kMaxPriority = 3;
+
+public:
+    Overload();
+    ~Overload();
+    Overload(const Overload&) = delete;
+    Overload& operator=(const Overload&) = delete;
+
+public:
+    void Reset(uint32_t id, int32_t priority);
+    // 提交一个包，budget为从现在起的处理时限（微秒），不大于0为无时限
+    void Submit(int64_t pts, int64_t budget);
+    // 解码出一帧，按pts从最早提交的包开始对应，返回该帧是否已超过截止时间
+    bool Complete(int64_t pts);
+    // 当前应设置的AVCodecContext::skip_frame
+    int32_t Discard() const;
+    int32_t Level() const
+    {
+        return m_nLevel;
+    }
+    double LagUs() const
+    {
+        return m_fLagUs;
+    }
+    uint64_t DroppedLate() const
+    {
+        return m_uDroppedLate;
+    }
+    uint64_t DroppedDecode() const
+    {
+        return m_uDroppedDecode;
+    }
+
+private:
+    void Update(bool late, int64_t now);
+    // 最近一次迟到或调整级别之后持续准时足够久时降低一级
+    void Recover(int64_t now);
+    void SetBehind(bool behind);
+
+private:
+    struct Entry
+    {
+        int64_t pts;
+        int64_t deadline;
+        bool pending;
+    };
+    std::array<Entry, 64> m_arrEntries;
+    size_t m_szHead;
+    uint32_t m_uId;
+    int32_t m_nPriority;
+    int32_t m_nLevel;
+    uint32_t m_uLate;
+    // 最近一次迟到或调整级别的时间（微秒），0为未开始计时
+    int64_t m_nSteadySince;
+    bool m_bBehind;
+    double m_fLagUs;
+    uint64_t m_uDroppedLate;
+    uint64_t m_uDroppedDecode;
+};
+}  // namespace ffmpeg
@@ -0,0 +1,208 @@
+#include "FFmpegScheduler.h"
+
+namespace ffmpeg
+{
+namespace
+{
+// 各等级排队超过该时间后不再让位给更高等级
+constexpr std::chrono::milliseconds kStarvation[QoS_Count] = {std::chrono::milliseconds(0), std::chrono::milliseconds(50),
+                                                                std::chrono::milliseconds(200)};
+
+inline void UpdateMax(std::atomic<uint64_t>& max, uint64_t value)
+{
+    uint64_t uMax = max.load(std::memory_order_relaxed);
+    while (value > uMax && !max.compare_exchange_weak(uMax, value, std::memory_order_relaxed))
+    {
+    }
+}
+}  // namespace
+
+Scheduler::Ticket::Ticket(QoSClass qos)
+    : m_eQoS(qos)
+    , m_bSlot(false)
+    , m_bFinished(false)
+    , m_tpBegin(std::chrono::steady_clock::now())
+{
+    m_bSlot = Instance().Acquire(qos);
+    const auto tpNow = std::chrono::steady_clock::now();
+    const uint64_t uWait = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(tpNow - m_tpBegin).count());
+    m_tpBegin = tpNow;
+    Instance().m_arrCounters[m_eQoS].wait_us.fetch_add(uWait, std::memory_order_relaxed);
+    UpdateMax(Instance().m_arrCounters[m_eQoS].wait_us_max, uWait);
+}
+
+Scheduler::Ticket::~Ticket()
+{
+    Finish();
+}
+
+void Scheduler::Ticket::Finish()
+{
+    if (m_bFinished)
+    {
+        return;
+    }
+    m_bFinished = true;
+    if (m_bSlot)
+    {
+        Instance().Release();
+    }
+    const uint64_t uDecode =
+        static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_tpBegin).count());
+    Counter& counter = Instance().m_arrCounters[m_eQoS];
+    counter.decodes.fetch_add(1, std::memory_order_relaxed);
+    counter.decode_us.fetch_add(uDecode, std::memory_order_relaxed);
+    UpdateMax(counter.decode_us_max, uDecode);
+}
+
+Scheduler& Scheduler::Instance()
+{
+    static Scheduler s_scheduler;
+    return s_scheduler;
+}
+
+Scheduler::Scheduler()
+    : m_uSlots(0)
+    , m_uBusy(0)
+    , m_uWaiting(0)
+{
+}
+
+void Scheduler::SetSlots(uint32_t slots)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtxQueue);
+        m_uSlots.store(slots);
+        if (slots == 0)
+        {
+            // 关闭排队时放行所有等待者
+            for (auto& queue : m_arrQueues)
+            {
+                for (Waiter* pWaiter : queue)
+                {
+                    pWaiter->granted = true;
+                    m_uBusy.fetch_add(1);
+                    m_uWaiting.fetch_sub(1);
+                }
+                queue.clear();
+            }
+        }
+        else
+        {
+            Dispatch();
+        }
+    }
+    m_cvQueue.notify_all();
+}
+
+void Scheduler::GetStats(QoSClass qos, Stats& stats) const
+{
+    const Counter& counter = m_arrCounters[qos];
+    stats.decodes = counter.decodes.load(std::memory_order_relaxed);
+    stats.wait_us = counter.wait_us.load(std::memory_order_relaxed);
+    stats.wait_us_max = counter.wait_us_max.load(std::memory_order_relaxed);
+    stats.decode_us = counter.decode_us.load(std::memory_order_relaxed);
+    stats.decode_us_max = counter.decode_us_max.load(std::memory_order_relaxed);
+}
+
+bool Scheduler::Acquire(QoSClass qos)
+{
+    const uint32_t uSlots = m_uSlots.load();
+    if (uSlots == 0)
+    {
+        return false;
+    }
+    // 实时流从不排队，可以暂时超出名额，后续名额先补足它
+    if (qos == QoS_Realtime)
+    {
+        m_uBusy.fetch_add(1);
+        return true;
+    }
+    if (m_uWaiting.load() == 0 && TryTake(uSlots))
+    {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(m_mtxQueue);
+    if (m_uSlots.load() == 0)
+    {
+        // 加锁前名额已关闭
+        return false;
+    }
+    Waiter waiter{std::chrono::steady_clock::now(), false};
+    m_arrQueues[qos].push_back(&waiter);
+    // 先登记排队再检查占用数，与Release的先归还再检查排队者配对，不会漏掉同时归还的名额
+    m_uWaiting.fetch_add(1);
+    if (Dispatch())
+    {
+        m_cvQueue.notify_all();
+    }
+    m_cvQueue.wait(lock, [&waiter]() { return waiter.granted; });
+    return true;
+}
+
+void Scheduler::Release()
+{
+    m_uBusy.fetch_sub(1);
+    if (m_uWaiting.load() == 0)
+    {
+        return;
+    }
+    bool bGranted = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxQueue);
+        bGranted = Dispatch();
+    }
+    if (bGranted)
+    {
+        m_cvQueue.notify_all();
+    }
+}
+
+bool Scheduler::TryTake(uint32_t slots)
+{
+    uint32_t uBusy = m_uBusy.load();
+    while (uBusy < slots)
+    {
+        if (m_uBusy.compare_exchange_weak(uBusy, uBusy + 1))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::Dispatch()
+{
+    const auto tpNow = std::chrono::steady_clock::now();
+    const uint32_t uSlots = m_uSlots.load();
+    bool bGranted = false;
+    while (true)
+    {
+        // 先找排队超时的低等级，再按等级从高到低
+        int32_t nPick = -1;
+        for (int32_t i = QoS_Count - 1; i > 0 && nPick < 0; --i)
+        {
+            if (!m_arrQueues[i].empty() && tpNow - m_arrQueues[i].front()->enqueue >= kStarvation[i])
+            {
+                nPick = i;
+            }
+        }
+        for (int32_t i = 0; i < QoS_Count && nPick < 0; ++i)
+        {
+            if (!m_arrQueues[i].empty())
+            {
+                nPick = i;
+            }
+        }
+        if (nPick < 0 || !TryTake(uSlots))
+        {
+            break;
+        }
+        m_arrQueues[nPick].front()->granted = true;
+        m_arrQueues[nPick].pop_front();
+        m_uWaiting.fetch_sub(1);
+        bGranted = true;
+    }
+    return bGranted;
+}
+}  // namespace ffmpeg
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+namespace ffmpeg
+{
+enum QoSClass : int32_t
+{
+    QoS_Realtime = 0,     // 主画面，不排队
+    QoS_Interactive = 1,  // 交互画面，优先于后台
+    QoS_Background = 2,   // 后台预览，尽力而为
+    QoS_Count = 3,
+};
+
+// 跨解码器的解码调度：限制同时解码的数量，空出的名额按QoS等级分配
+// 低等级排队超过时限后提升到队首，避免饿死；未设置名额时不排队、不加锁，只统计
+// 名额和占用数为原子量，无人排队时占用和归还名额都不经过队列锁
+class Scheduler final
+{
+public:
+    struct Stats
+    {
+        uint64_t decodes;
+        uint64_t wait_us;        // 排队总时间
+        uint64_t wait_us_max;
+        uint64_t decode_us;      // 解码总时间（不含输出回调）
+        uint64_t decode_us_max;
+    };
+
+    // 一次解码的调度凭证，构造时排队，Finish或析构时归还名额并记录耗时
+    class Ticket final
+    {
+    public:
+        explicit Ticket(QoSClass qos);
+        ~Ticket();
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+        // 提前归还名额，在调用宿主的输出回调之前调用；重复调用无效
+        void Finish();
+
+    private:
+        QoSClass m_eQoS;
+        bool m_bSlot;
+        bool m_bFinished;
+        std::chrono::steady_clock::time_point m_tpBegin;
+    };
+
+public:
+    static Scheduler& Instance();
+    // 同时解码的数量，0关闭排队
+    void SetSlots(uint32_t slots);
+    void GetStats(QoSClass qos, Stats& stats) const;
+
+private:
+    struct Waiter
+    {
+        std::chrono::steady_clock::time_point enqueue;
+        bool granted;
+    };
+    struct Counter
+    {
+        std::atomic<uint64_t> decodes{0};
+        std::atomic<uint64_t> wait_us{0};
+        std::atomic<uint64_t> wait_us_max{0};
+        std::atomic<uint64_t> decode_us{0};
+        std::atomic<uint64_t> decode_us_max{0};
+    };
+
+    Scheduler();
+    bool Acquire(QoSClass qos);
+    void Release();
+    // 占用数小于slots时占用一个名额
+    bool TryTake(uint32_t slots);
+    // 在队列锁内按等级放行排队者，返回是否放行了
+    bool Dispatch();
+
+private:
+    mutable std::mutex m_mtxQueue;
+    std::condition_variable m_cvQueue;
+    std::atomic<uint32_t> m_uSlots;
+    std::atomic<uint32_t> m_uBusy;
+    std::atomic<uint32_t> m_uWaiting;  // 排队者数，非0时归还名额才加锁调度
+    std::array<std::deque<Waiter*>, QoS_Count> m_arrQueues;
+    std::array<Counter, QoS_Count> m_arrCounters;
+};
+}  // namespace ffmpeg
@@ -0,0 +1,305 @@
+#include "FFmpegSharedRing.h"
+#include "FFSharedFrame.h"
+#include "FFmpegWrapper.hpp"
+#include "adaption/Logging.h"
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ffmpeg
+{
+namespace
+{
+constexpr uint32_t kBlockSize = 64 << 10;
+constexpr uint32_t kFreeBlock = UINT32_MAX;
+
+inline uint64_t AlignUp(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+// 段内与消费者共享的计数是普通整数，按同样布局的无锁std::atomic访问
+template <typename T>
+inline std::atomic<T>* SharedAtomic(T* value)
+{
+    static_assert(sizeof(std::atomic<T>) == sizeof(T) && std::atomic<T>::is_always_lock_free, "shared counter must be lock-free");
+    return reinterpret_cast<std::atomic<T>*>(value);
+}
+}  // namespace
+
+SharedRing* SharedRing::Create(uint32_t id, uint64_t bytes, uint32_t frames, uint32_t lease_ms)
+{
+#if defined(__linux__)
+    if (bytes < kBlockSize || frames == 0)
+    {
+        return nullptr;
+    }
+    Layout sLayout{};
+    const uint64_t uBlocks = bytes / kBlockSize;
+    sLayout.capacity = frames;
+    sLayout.blocks = static_cast<uint32_t>(uBlocks);
+    sLayout.ring_offset = AlignUp(sizeof(FFSharedFrameHeader), 64);
+    sLayout.refs_offset = AlignUp(sLayout.ring_offset + sizeof(FFSharedFrame) * frames, 64);
+    sLayout.gens_offset = AlignUp(sLayout.refs_offset + sizeof(uint32_t) * uBlocks, 64);
+    sLayout.data_offset = AlignUp(sLayout.gens_offset + sizeof(uint32_t) * uBlocks, kBlockSize);
+    const uint64_t uSize = sLayout.data_offset + uBlocks * kBlockSize;
+    char szName[32]{};
+    snprintf(szName, sizeof(szName), "ffmpeg_codec_%u", id);
+    int nFd = memfd_create(szName, MFD_CLOEXEC);
+    if (nFd < 0)
+    {
+        LOG_ERROR("SharedRing memfd_create failed {}.", errno);
+        return nullptr;
+    }
+    if (ftruncate(nFd, static_cast<off_t>(uSize)) != 0)
+    {
+        LOG_ERROR("SharedRing ftruncate {} bytes failed {}.", uSize, errno);
+        close(nFd);
+        return nullptr;
+    }
+    void* pMap = mmap(nullptr, uSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0);
+    if (pMap == MAP_FAILED)
+    {
+        LOG_ERROR("SharedRing mmap {} bytes failed {}.", uSize, errno);
+        close(nFd);
+        return nullptr;
+    }
+    // 新的memfd内容全为0，只需填写头
+    FFSharedFrameHeader* pHeader = static_cast<FFSharedFrameHeader*>(pMap);
+    pHeader->magic = FF_SHARED_FRAME_MAGIC;
+    pHeader->version = FF_SHARED_FRAME_VERSION;
+    pHeader->size = uSize;
+    pHeader->ring_capacity = frames;
+    pHeader->block_size = kBlockSize;
+    pHeader->block_count = sLayout.blocks;
+    pHeader->lease_ms = lease_ms;
+    pHeader->ring_offset = sLayout.ring_offset;
+    pHeader->refs_offset = sLayout.refs_offset;
+    pHeader->data_offset = sLayout.data_offset;
+    pHeader->gens_offset = sLayout.gens_offset;
+    return new SharedRing(id, nFd, static_cast<uint8_t*>(pMap), uSize, sLayout, lease_ms);
+#else
+    return nullptr;
+#endif
+}
+
+SharedRing::SharedRing(uint32_t id, int fd, uint8_t* base, uint64_t size, const Layout& layout, uint32_t lease_ms)
+    : m_uRefs(1)
+    , m_uId(id)
+    , m_nFd(fd)
+    , m_pBase(base)
+    , m_uSize(size)
+    , m_layout(layout)
+    , m_lease(lease_ms)
+    , m_vecOwner(layout.blocks, kFreeBlock)
+    , m_vecHeld(layout.blocks, 0)
+    , m_vecDropped(layout.blocks)
+    , m_vecGen(layout.blocks, 0)
+    , m_vecSlots(layout.capacity, Slot{})
+    , m_uHead(0)
+{
+}
+
+SharedRing::~SharedRing()
+{
+#if defined(__linux__)
+    // 消费者各自映射了该段，解码进程关闭后段仍然有效
+    munmap(m_pBase, m_uSize);
+    close(m_nFd);
+#endif
+}
+
+void SharedRing::AddRef()
+{
+    m_uRefs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SharedRing::Release()
+{
+    if (m_uRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        delete this;
+    }
+}
+
+FramePool::Allocator SharedRing::Allocator()
+{
+    return FramePool::Allocator{this, &SharedRing::AllocBuffer, &SharedRing::FreeBuffer};
+}
+
+uint64_t SharedRing::Published() const
+{
+    return SharedAtomic(&Header()->head)->load(std::memory_order_relaxed);
+}
+
+uint64_t SharedRing::Dropped() const
+{
+    return SharedAtomic(&Header()->dropped)->load(std::memory_order_relaxed);
+}
+
+uint8_t* SharedRing::AllocBuffer(void* user, size_t size, void** opaque)
+{
+    SharedRing* pRing = reinterpret_cast<SharedRing*>(user);
+    uint32_t uBuffer = 0;
+    uint8_t* pData = pRing->Alloc(size, uBuffer);
+    if (pData)
+    {
+        // 缓冲持有环的引用，解码器释放后环在最后一个缓冲归还时销毁
+        pRing->AddRef();
+        *opaque = reinterpret_cast<void*>(static_cast<uintptr_t>(uBuffer));
+    }
+    return pData;
+}
+
+void SharedRing::FreeBuffer(void* user, uint8_t*, void* opaque)
+{
+    SharedRing* pRing = reinterpret_cast<SharedRing*>(user);
+    {
+        std::lock_guard<std::mutex> lock(pRing->m_mtxBlocks);
+        pRing->Drop(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(opaque)), std::chrono::steady_clock::now());
+    }
+    pRing->Release();
+}
+
+uint8_t* SharedRing::Alloc(size_t size, uint32_t& buffer)
+{
+    const uint32_t uNeed = static_cast<uint32_t>((size + kBlockSize - 1) / kBlockSize);
+    std::lock_guard<std::mutex> lock(m_mtxBlocks);
+    for (int nTry = 0; nTry < 2; ++nTry)
+    {
+        // 首次适配，找不到时回收不再持有的缓冲后再试一次
+        uint32_t uRun = 0;
+        for (uint32_t i = 0; i < m_vecOwner.size(); ++i)
+        {
+            uRun = m_vecOwner[i] == kFreeBlock ? uRun + 1 : 0;
+            if (uRun == uNeed)
+            {
+                buffer = i + 1 - uNeed;
+                std::fill(m_vecOwner.begin() + buffer, m_vecOwner.begin() + i + 1, buffer);
+                m_vecLive.push_back(buffer);
+                m_vecHeld[buffer] = 1;
+                return m_pBase + m_layout.data_offset + static_cast<uint64_t>(buffer) * kBlockSize;
+            }
+        }
+        if (nTry == 0)
+        {
+            Reclaim();
+        }
+    }
+    return nullptr;
+}
+
+void SharedRing::Drop(uint32_t buffer, std::chrono::steady_clock::time_point now)
+{
+    if (buffer < m_vecHeld.size() && m_vecHeld[buffer] > 0 && --m_vecHeld[buffer] == 0)
+    {
+        m_vecDropped[buffer] = now;
+    }
+}
+
+void SharedRing::Reclaim()
+{
+    const auto tpNow = std::chrono::steady_clock::now();
+    auto it = std::remove_if(m_vecLive.begin(), m_vecLive.end(),
+                             [this, tpNow](uint32_t uBuffer) -> bool
+                             {
+                                 if (m_vecHeld[uBuffer] != 0)
+                                 {
+                                     return false;
+                                 }
+                                 // 消费者的引用数可能被改写或因迟到的释放成为负数，按有符号数判断
+                                 const int32_t nRefs = static_cast<int32_t>(SharedAtomic(Refs(uBuffer))->load(std::memory_order_acquire));
+                                 if (nRefs > 0)
+                                 {
+                                     if (m_lease.count() == 0 || tpNow - m_vecDropped[uBuffer] < m_lease)
+                                     {
+                                         return false;
+                                     }
+                                     // 消费者超时未释放（通常是消费进程已退出），强制回收
+                                     SharedAtomic(Refs(uBuffer))->store(0, std::memory_order_release);
+                                     SharedAtomic(&Header()->reclaimed)->fetch_add(1, std::memory_order_relaxed);
+                                     LOG_WARNING("SharedRing#{} reclaim buffer {} held by consumers {} refs.", m_uId, uBuffer, nRefs);
+                                 }
+                                 // 代数加1后，仍持有该缓冲的消费者能发现数据已失效
+                                 SharedAtomic(Gens(uBuffer))->store(++m_vecGen[uBuffer], std::memory_order_release);
+                                 for (uint32_t i = uBuffer; i < m_vecOwner.size() && m_vecOwner[i] == uBuffer; ++i)
+                                 {
+                                     m_vecOwner[i] = kFreeBlock;
+                                 }
+                                 return true;
+                             });
+    m_vecLive.erase(it, m_vecLive.end());
+}
+
+bool SharedRing::Publish(const AVFrame* frame, const NVIVideoImageFrame& image)
+{
+    FFSharedFrameHeader* pHeader = Header();
+    const uint8_t* pData = m_pBase + m_layout.data_offset;
+    const uint8_t* pEnd = m_pBase + m_uSize;
+    FFSharedFrame sFrame{};
+    Slot sSlot{};
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && i < 4 && image.buffer.planes[i]; ++i)
+    {
+        const uint8_t* pPlane = static_cast<const uint8_t*>(image.buffer.planes[i]);
+        const uint8_t* pBuffer = frame->buf[i] ? frame->buf[i]->data : nullptr;
+        if (pPlane < pData || pPlane >= pEnd || pBuffer < pData || pBuffer >= pEnd)
+        {
+            // 退回了插件分配的平面，不能跨进程访问
+            SharedAtomic(&pHeader->dropped)->fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        sFrame.buffer[i] = static_cast<uint32_t>((pBuffer - pData) / kBlockSize);
+        sFrame.offset[i] = static_cast<uint64_t>(pPlane - m_pBase);
+        sFrame.stride[i] = image.buffer.strides[i];
+        sFrame.planes = static_cast<uint32_t>(i + 1);
+        sSlot.buffer[i] = sFrame.buffer[i];
+        sSlot.planes = sFrame.planes;
+    }
+    if (sFrame.planes == 0)
+    {
+        return false;
+    }
+    sFrame.pts = image.info.tick.value;
+    sFrame.width = image.info.width;
+    sFrame.height = image.info.height;
+    sFrame.format = image.buffer.format;
+    sFrame.primary = image.info.colorspace.primary;
+    sFrame.transfer = image.info.colorspace.transfer;
+    sFrame.matrix = image.info.colorspace.matrix;
+    sFrame.range = image.info.colorspace.range;
+    std::lock_guard<std::mutex> lock(m_mtxPublish);
+    const uint64_t uIndex = m_uHead;
+    const size_t szSlot = static_cast<size_t>(uIndex % m_layout.capacity);
+    FFSharedFrame* pSlot = Ring() + szSlot;
+    // 先作废再改写，消费者据seq判断拷贝是否完整
+    SharedAtomic(&pSlot->seq)->store(0, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+        std::lock_guard<std::mutex> lockBlocks(m_mtxBlocks);
+        const auto tpNow = std::chrono::steady_clock::now();
+        // 覆盖最旧的帧描述，释放它持有的缓冲；缓冲号取自进程内的记录
+        const Slot& sOld = m_vecSlots[szSlot];
+        for (uint32_t i = 0; i < sOld.planes; ++i)
+        {
+            Drop(sOld.buffer[i], tpNow);
+        }
+        // 帧描述在环中期间持有各平面缓冲
+        for (uint32_t i = 0; i < sSlot.planes; ++i)
+        {
+            ++m_vecHeld[sSlot.buffer[i]];
+            sFrame.gen[i] = m_vecGen[sSlot.buffer[i]];
+        }
+    }
+    m_vecSlots[szSlot] = sSlot;
+    sFrame.seq = 0;
+    *pSlot = sFrame;
+    SharedAtomic(&pSlot->seq)->store(uIndex + 1, std::memory_order_release);
+    m_uHead = uIndex + 1;
+    SharedAtomic(&pHeader->head)->store(m_uHead, std::memory_order_release);
+    return true;
+}
+}  // namespace ffmpeg
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "FFmpegMemory.h"
+#include <NVI/Codec.h>
+#include <chrono>
+
+struct AVFrame;
+struct FFSharedFrameHeader;
+struct FFSharedFrame;
+
+namespace ffmpeg
+{
+// 解码进程一侧的共享内存帧环，布局见FFSharedFrame.h
+// 作为FramePool的宿主分配器，软件解码帧直接分配在memfd段中，输出时发布帧描述
+// 消费者可以改写整个段，解码进程只信任自己记录的布局、帧环和引用，从段内读回的只有消费者引用数
+class SharedRing final
+{
+public:
+    // bytes为数据区大小，frames为帧描述个数，lease_ms见FFSharedFrameHeader，失败返回空（非Linux总是失败）
+    static SharedRing* Create(uint32_t id, uint64_t bytes, uint32_t frames, uint32_t lease_ms);
+    void AddRef();
+    void Release();
+
+    FramePool::Allocator Allocator();
+    // 发布一帧，各平面都在段内时返回true
+    bool Publish(const AVFrame* frame, const NVIVideoImageFrame& image);
+    int Fd() const
+    {
+        return m_nFd;
+    }
+    uint64_t Size() const
+    {
+        return m_uSize;
+    }
+    uint64_t Published() const;
+    uint64_t Dropped() const;
+
+private:
+    // 创建时确定的布局，不从段内读回
+    struct Layout
+    {
+        uint32_t capacity;
+        uint32_t blocks;
+        uint64_t ring_offset;
+        uint64_t refs_offset;
+        uint64_t gens_offset;
+        uint64_t data_offset;
+    };
+    // 帧环各位置引用的缓冲，覆盖时据此释放
+    struct Slot
+    {
+        uint32_t planes;
+        uint32_t buffer[4];
+    };
+
+    SharedRing(uint32_t id, int fd, uint8_t* base, uint64_t size, const Layout& layout, uint32_t lease_ms);
+    ~SharedRing();
+    static uint8_t* AllocBuffer(void* user, size_t size, void** opaque);
+    static void FreeBuffer(void* user, uint8_t* data, void* opaque);
+    uint8_t* Alloc(size_t size, uint32_t& buffer);
+    // 在m_mtxBlocks内释放解码进程持有的一个引用
+    void Drop(uint32_t buffer, std::chrono::steady_clock::time_point now);
+    void Reclaim();
+    // buffer由调用者保证小于m_layout.blocks
+    uint32_t* Refs(uint32_t buffer) const
+    {
+        return reinterpret_cast<uint32_t*>(m_pBase + m_layout.refs_offset) + buffer;
+    }
+    uint32_t* Gens(uint32_t buffer) const
+    {
+        return reinterpret_cast<uint32_t*>(m_pBase + m_layout.gens_offset) + buffer;
+    }
+    FFSharedFrameHeader* Header() const
+    {
+        return reinterpret_cast<FFSharedFrameHeader*>(m_pBase);
+    }
+    FFSharedFrame* Ring() const
+    {
+        return reinterpret_cast<FFSharedFrame*>(m_pBase + m_layout.ring_offset);
+    }
+
+private:
+    std::atomic<uint32_t> m_uRefs;
+    const uint32_t m_uId;
+    const int m_nFd;
+    uint8_t* const m_pBase;
+    const uint64_t m_uSize;
+    const Layout m_layout;
+    const std::chrono::milliseconds m_lease;
+    std::mutex m_mtxBlocks;
+    // 各块所属缓冲的首块号，空闲为kFreeBlock
+    std::vector<uint32_t> m_vecOwner;
+    // 按首块号：解码器和帧环持有的引用数、引用归零的时间、代数
+    std::vector<uint32_t> m_vecHeld;
+    std::vector<std::chrono::steady_clock::time_point> m_vecDropped;
+    std::vector<uint32_t> m_vecGen;
+    // 已分配的缓冲首块号
+    std::vector<uint32_t> m_vecLive;
+    std::mutex m_mtxPublish;
+    std::vector<Slot> m_vecSlots;
+    uint64_t m_uHead;
+};
+
+inline void ReleaseSharedRing(SharedRing* pRing)
+{
+    if (pRing)
+    {
+        pRing->Release();
+    }
+}
+}  // namespace ffmpeg
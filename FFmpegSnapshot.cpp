@@ -0,0 +1,282 @@
+#include "FFmpegSnapshot.h"
+#include "FFmpegWrapper.hpp"
+#include "adaption/Logging.h"
+#include <algorithm>
+
+namespace ffmpeg
+{
+namespace
+{
+// 每种解码器和全部编码器最多保留的空闲上下文数
+constexpr size_t kMaxIdleDecoders = 4;
+constexpr size_t kMaxIdleEncoders = 16;
+
+// f*f的盒式滤波缩小一个平面，边缘不足f的部分按实际像素数平均
+void BoxPlane(const uint8_t* src, int32_t srcStride, int32_t srcWidth, int32_t srcHeight, uint8_t* dst, int32_t dstStride, int32_t dstWidth,
+              int32_t dstHeight, int32_t f)
+{
+    std::vector<uint32_t> vecSum(static_cast<size_t>(dstWidth));
+    for (int32_t y = 0; y < dstHeight; ++y)
+    {
+        std::fill(vecSum.begin(), vecSum.end(), 0);
+        const int32_t y0 = y * f;
+        const int32_t y1 = std::min(y0 + f, srcHeight);
+        for (int32_t sy = y0; sy < y1; ++sy)
+        {
+            const uint8_t* pRow = src + static_cast<ptrdiff_t>(sy) * srcStride;
+            for (int32_t x = 0; x < dstWidth; ++x)
+            {
+                const int32_t x1 = std::min(x * f + f, srcWidth);
+                uint32_t uSum = 0;
+                for (int32_t sx = x * f; sx < x1; ++sx)
+                {
+                    uSum += pRow[sx];
+                }
+                vecSum[static_cast<size_t>(x)] += uSum;
+            }
+        }
+        uint8_t* pDst = dst + static_cast<ptrdiff_t>(y) * dstStride;
+        for (int32_t x = 0; x < dstWidth; ++x)
+        {
+            const uint32_t uCount = static_cast<uint32_t>((y1 - y0) * (std::min(x * f + f, srcWidth) - x * f));
+            pDst[x] = static_cast<uint8_t>((vecSum[static_cast<size_t>(x)] + uCount / 2) / uCount);
+        }
+    }
+}
+
+bool Downscale(const AVFrame* src, int32_t f, AVFrame* dst)
+{
+    dst->format = src->format;
+    dst->width = std::max(src->width / f, 1);
+    dst->height = std::max(src->height / f, 1);
+    dst->color_range = src->color_range;
+    dst->colorspace = src->colorspace;
+    if (av_frame_get_buffer(dst, 0) < 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        // 4:2:0的色度平面按一半尺寸计算
+        const int32_t nShift = i == 0 ? 0 : 1;
+        BoxPlane(src->data[i], src->linesize[i], (src->width + nShift) >> nShift, (src->height + nShift) >> nShift, dst->data[i], dst->linesize[i],
+                 (dst->width + nShift) >> nShift, (dst->height + nShift) >> nShift, f);
+    }
+    return true;
+}
+}  // namespace
+
+Snapshot& Snapshot::Instance()
+{
+    static Snapshot s_snapshot;
+    return s_snapshot;
+}
+
+Snapshot::~Snapshot()
+{
+    for (auto& decoder : m_vecDecoders)
+    {
+        avcodec_free_context(&decoder.context);
+    }
+    for (auto& encoder : m_vecEncoders)
+    {
+        avcodec_free_context(&encoder.context);
+    }
+}
+
+bool Snapshot::Encode(uint32_t codec, const uint8_t* keyframe, size_t size, uint32_t max_width, uint32_t max_height, int32_t quality,
+                      std::vector<uint8_t>& jpeg)
+{
+    auto pDecoded = AllocAVFrame();
+    if (pDecoded == nullptr || !Decode(codec, keyframe, size, pDecoded.get()))
+    {
+        return false;
+    }
+    if (pDecoded->format != AV_PIX_FMT_YUV420P && pDecoded->format != AV_PIX_FMT_YUVJ420P)
+    {
+        LOG_WARNING("Snapshot not support pixel format {}.", pDecoded->format);
+        return false;
+    }
+    // 整数倍缩小到不超过给定尺寸，缩略图不需要更精细的缩放
+    int32_t nFactor = 1;
+    if (max_width > 0)
+    {
+        nFactor = std::max(nFactor, static_cast<int32_t>((static_cast<uint32_t>(pDecoded->width) + max_width - 1) / max_width));
+    }
+    if (max_height > 0)
+    {
+        nFactor = std::max(nFactor, static_cast<int32_t>((static_cast<uint32_t>(pDecoded->height) + max_height - 1) / max_height));
+    }
+    AVFrame* pInput = pDecoded.get();
+    auto pScaled = AllocAVFrame();
+    if (nFactor > 1)
+    {
+        if (pScaled == nullptr || !Downscale(pDecoded.get(), nFactor, pScaled.get()))
+        {
+            LOG_ERROR("Snapshot downscale {}x{} by {} failed.", pDecoded->width, pDecoded->height, nFactor);
+            return false;
+        }
+        pInput = pScaled.get();
+    }
+    const int32_t nQuality = std::min(std::max(quality, 1), 100);
+    AVCodecContext* pEncoder = AcquireEncoder(pInput, nQuality);
+    if (pEncoder == nullptr)
+    {
+        return false;
+    }
+    pInput->quality = pEncoder->global_quality;
+    pInput->pts = 0;
+    auto pPacket = AllocAVPacket();
+    int nEncode = pPacket ? avcodec_send_frame(pEncoder, pInput) : AVERROR(ENOMEM);
+    if (nEncode >= 0)
+    {
+        nEncode = avcodec_receive_packet(pEncoder, pPacket.get());
+    }
+    if (nEncode < 0)
+    {
+        LOG_ERROR("Snapshot mjpeg encode failed {}, {}.", nEncode, av_errstr(nEncode));
+        avcodec_free_context(&pEncoder);
+        return false;
+    }
+    jpeg.assign(pPacket->data, pPacket->data + pPacket->size);
+    ReturnEncoder(pInput, nQuality, pEncoder);
+    return true;
+}
+
+bool Snapshot::Decode(uint32_t codec, const uint8_t* keyframe, size_t size, AVFrame* frame)
+{
+    AVCodecContext* pDecoder = AcquireDecoder(codec);
+    if (pDecoder == nullptr)
+    {
+        return false;
+    }
+    auto pPacket = AllocAVPacket();
+    if (pPacket == nullptr)
+    {
+        ReturnDecoder(codec, pDecoder);
+        return false;
+    }
+    pPacket->data = const_cast<uint8_t*>(keyframe);
+    pPacket->size = static_cast<int>(size);
+    // 发送后立即排空，单个IDR即可出帧
+    int nDecode = avcodec_send_packet(pDecoder, pPacket.get());
+    if (nDecode >= 0)
+    {
+        nDecode = avcodec_send_packet(pDecoder, nullptr);
+    }
+    if (nDecode >= 0)
+    {
+        nDecode = avcodec_receive_frame(pDecoder, frame);
+    }
+    if (nDecode < 0)
+    {
+        LOG_WARNING("Snapshot decode keyframe failed {}, {}.", nDecode, av_errstr(nDecode));
+    }
+    avcodec_flush_buffers(pDecoder);
+    ReturnDecoder(codec, pDecoder);
+    return nDecode >= 0;
+}
+
+AVCodecContext* Snapshot::AcquireDecoder(uint32_t codec)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtxPool);
+        auto it = std::find_if(m_vecDecoders.begin(), m_vecDecoders.end(), [codec](const Decoder& decoder) { return decoder.codec == codec; });
+        if (it != m_vecDecoders.end())
+        {
+            AVCodecContext* pContext = it->context;
+            m_vecDecoders.erase(it);
+            return pContext;
+        }
+    }
+    AVCodecContext* pContext = avcodec_alloc_context3(avcodec_find_decoder(ToAVCodecID(codec)));
+    if (pContext == nullptr)
+    {
+        return nullptr;
+    }
+    // 请求之间已经并行，每个上下文单线程，避免帧并行的输出延迟
+    pContext->thread_count = 1;
+    pContext->skip_frame = AVDISCARD_NONKEY;
+    int nOpen = avcodec_open2(pContext, nullptr, nullptr);
+    if (nOpen != 0)
+    {
+        LOG_ERROR("Snapshot avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+        avcodec_free_context(&pContext);
+    }
+    return pContext;
+}
+
+void Snapshot::ReturnDecoder(uint32_t codec, AVCodecContext* context)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtxPool);
+        const size_t szIdle = static_cast<size_t>(
+            std::count_if(m_vecDecoders.begin(), m_vecDecoders.end(), [codec](const Decoder& decoder) { return decoder.codec == codec; }));
+        if (szIdle < kMaxIdleDecoders)
+        {
+            m_vecDecoders.push_back({codec, context});
+            return;
+        }
+    }
+    avcodec_free_context(&context);
+}
+
+AVCodecContext* Snapshot::AcquireEncoder(const AVFrame* frame, int32_t quality)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtxPool);
+        auto it = std::find_if(m_vecEncoders.begin(), m_vecEncoders.end(),
+                               [frame, quality](const Encoder& encoder)
+                               {
+                                   return encoder.width == frame->width && encoder.height == frame->height && encoder.format == frame->format &&
+                                          encoder.quality == quality;
+                               });
+        if (it != m_vecEncoders.end())
+        {
+            AVCodecContext* pContext = it->context;
+            m_vecEncoders.erase(it);
+            return pContext;
+        }
+    }
+    AVCodecContext* pContext = avcodec_alloc_context3(avcodec_find_encoder(AV_CODEC_ID_MJPEG));
+    if (pContext == nullptr)
+    {
+        LOG_ERROR("Snapshot mjpeg encoder not found.");
+        return nullptr;
+    }
+    pContext->width = frame->width;
+    pContext->height = frame->height;
+    pContext->pix_fmt = static_cast<AVPixelFormat>(frame->format);
+    pContext->color_range = frame->color_range;
+    pContext->time_base = AVRational{1, 25};
+    // 解码出的YUV420P是有限范围，mjpeg需要放宽标准才接受
+    pContext->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+    // 质量1~100映射到qscale 31~2
+    pContext->flags |= AV_CODEC_FLAG_QSCALE;
+    pContext->global_quality = (2 + (100 - quality) * 29 / 99) * FF_QP2LAMBDA;
+    pContext->thread_count = 1;
+    int nOpen = avcodec_open2(pContext, nullptr, nullptr);
+    if (nOpen != 0)
+    {
+        LOG_ERROR("Snapshot mjpeg avcodec_open2 failed {}, {}.", nOpen, av_errstr(nOpen));
+        avcodec_free_context(&pContext);
+    }
+    return pContext;
+}
+
+void Snapshot::ReturnEncoder(const AVFrame* frame, int32_t quality, AVCodecContext* context)
+{
+    AVCodecContext* pEvicted = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxPool);
+        // 超出时淘汰最早归还的
+        if (m_vecEncoders.size() >= kMaxIdleEncoders)
+        {
+            pEvicted = m_vecEncoders.front().context;
+            m_vecEncoders.erase(m_vecEncoders.begin());
+        }
+        m_vecEncoders.push_back({frame->width, frame->height, frame->format, quality, context});
+    }
+    avcodec_free_context(&pEvicted);
+}
+}  // namespace ffmpeg
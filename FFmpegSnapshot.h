@@ -0,0 +1,53 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct AVCodecContext;
+struct AVFrame;
+
+namespace ffmpeg
+{
+// 关键帧快照：用池化的只解关键帧的解码器解码缓存的IDR，按整数倍缩小后用mjpeg编码
+// 解码器和编码器在所有流和并发请求之间复用，单个请求不再创建和打开上下文
+class Snapshot final
+{
+public:
+    static Snapshot& Instance();
+
+    // keyframe为带参数集的Annex-B访问单元；max_width、max_height为0时不限
+    // quality为1~100，越大质量越好
+    bool Encode(uint32_t codec, const uint8_t* keyframe, size_t size, uint32_t max_width, uint32_t max_height, int32_t quality,
+                std::vector<uint8_t>& jpeg);
+
+private:
+    struct Decoder
+    {
+        uint32_t codec;
+        AVCodecContext* context;
+    };
+    struct Encoder
+    {
+        int32_t width;
+        int32_t height;
+        int32_t format;
+        int32_t quality;
+        AVCodecContext* context;
+    };
+
+    Snapshot() = default;
+    ~Snapshot();
+    bool Decode(uint32_t codec, const uint8_t* keyframe, size_t size, AVFrame* frame);
+    AVCodecContext* AcquireDecoder(uint32_t codec);
+    void ReturnDecoder(uint32_t codec, AVCodecContext* context);
+    AVCodecContext* AcquireEncoder(const AVFrame* frame, int32_t quality);
+    void ReturnEncoder(const AVFrame* frame, int32_t quality, AVCodecContext* context);
+
+private:
+    std::mutex m_mtxPool;
+    std::vector<Decoder> m_vecDecoders;
+    std::vector<Encoder> m_vecEncoders;
+};
+}  // namespace ffmpeg
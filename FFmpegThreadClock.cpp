@@ -0,0 +1,179 @@
+#include "FFmpegThreadClock.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#if defined(__linux__)
+#include <dirent.h>
+#include <time.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <tlhelp32.h>
+#elif defined(__APPLE__)
+#include <time.h>
+#endif
+
+namespace ffmpeg
+{
+namespace
+{
+std::mutex s_mtxOpen;
+
+std::vector<int32_t> ListThreads()
+{
+    std::vector<int32_t> vecThreads;
+#if defined(__linux__)
+    DIR* pDir = opendir("/proc/self/task");
+    if (pDir == nullptr)
+    {
+        return vecThreads;
+    }
+    while (const dirent* pEntry = readdir(pDir))
+    {
+        const int32_t nTid = std::atoi(pEntry->d_name);
+        if (nTid > 0)
+        {
+            vecThreads.push_back(nTid);
+        }
+    }
+    closedir(pDir);
+    std::sort(vecThreads.begin(), vecThreads.end());
+#elif defined(_WIN32)
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+    {
+        return vecThreads;
+    }
+    // 快照包含系统中所有的线程，只取本进程的
+    const DWORD uProcess = GetCurrentProcessId();
+    THREADENTRY32 sEntry{};
+    sEntry.dwSize = sizeof(sEntry);
+    for (BOOL bMore = Thread32First(hSnapshot, &sEntry); bMore; bMore = Thread32Next(hSnapshot, &sEntry))
+    {
+        if (sEntry.th32OwnerProcessID == uProcess)
+        {
+            vecThreads.push_back(static_cast<int32_t>(sEntry.th32ThreadID));
+        }
+    }
+    CloseHandle(hSnapshot);
+    std::sort(vecThreads.begin(), vecThreads.end());
+#endif
+    return vecThreads;
+}
+
+#if defined(_WIN32)
+// GetThreadTimes的内核态和用户态时间之和，单位100纳秒
+int64_t ThreadTimes(HANDLE hThread)
+{
+    FILETIME sCreation{}, sExit{}, sKernel{}, sUser{};
+    if (!GetThreadTimes(hThread, &sCreation, &sExit, &sKernel, &sUser))
+    {
+        return -1;
+    }
+    const uint64_t uKernel = (static_cast<uint64_t>(sKernel.dwHighDateTime) << 32) | sKernel.dwLowDateTime;
+    const uint64_t uUser = (static_cast<uint64_t>(sUser.dwHighDateTime) << 32) | sUser.dwLowDateTime;
+    return static_cast<int64_t>(uKernel + uUser);
+}
+#endif
+
+// schedstat的第一项为线程在CPU上运行的纳秒数，线程已退出时返回-1
+int64_t ThreadCpuNs(int32_t tid)
+{
+#if defined(__linux__)
+    char szPath[64];
+    std::snprintf(szPath, sizeof(szPath), "/proc/self/task/%d/schedstat", tid);
+    FILE* pFile = std::fopen(szPath, "r");
+    if (pFile == nullptr)
+    {
+        return -1;
+    }
+    long long llNs = -1;
+    if (std::fscanf(pFile, "%lld", &llNs) != 1)
+    {
+        llNs = -1;
+    }
+    std::fclose(pFile);
+    return llNs;
+#elif defined(_WIN32)
+    HANDLE hThread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(tid));
+    if (hThread == nullptr)
+    {
+        return -1;
+    }
+    // 线程id在退出后可能被复用，已退出的线程同样视为不可用
+    DWORD uExitCode = 0;
+    const int64_t nTimes = GetExitCodeThread(hThread, &uExitCode) && uExitCode == STILL_ACTIVE ? ThreadTimes(hThread) : -1;
+    CloseHandle(hThread);
+    return nTimes < 0 ? -1 : nTimes * 100;
+#else
+    (void)tid;
+    return -1;
+#endif
+}
+}  // namespace
+
+void ThreadClock::Begin()
+{
+    m_lock = std::unique_lock<std::mutex>(s_mtxOpen);
+    m_vecBefore = ListThreads();
+}
+
+void ThreadClock::End()
+{
+    if (!m_lock.owns_lock())
+    {
+        return;
+    }
+    m_vecThreads.clear();
+    for (int32_t nTid : ListThreads())
+    {
+        if (!std::binary_search(m_vecBefore.begin(), m_vecBefore.end(), nTid))
+        {
+            m_vecThreads.push_back(nTid);
+        }
+    }
+    m_vecBefore.clear();
+    m_lock.unlock();
+}
+
+int64_t ThreadClock::CpuUs() const
+{
+#if defined(__linux__) || defined(_WIN32)
+    int64_t nNs = 0;
+    for (int32_t nTid : m_vecThreads)
+    {
+        const int64_t nThread = ThreadCpuNs(nTid);
+        if (nThread < 0)
+        {
+            // 没有schedstat或线程已随上下文退出，本次不可用
+            return -1;
+        }
+        nNs += nThread;
+    }
+    return nNs / 1000;
+#else
+    return -1;
+#endif
+}
+
+int64_t ThreadClock::CurrentThreadCpuUs()
+{
+#if defined(__linux__) || defined(__APPLE__)
+    timespec sTime{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &sTime) == 0)
+    {
+        return static_cast<int64_t>(sTime.tv_sec) * 1000000 + sTime.tv_nsec / 1000;
+    }
+#elif defined(_WIN32)
+    const int64_t nTimes = ThreadTimes(GetCurrentThread());
+    if (nTimes >= 0)
+    {
+        return nTimes / 10;
+    }
+#endif
+    // 墙上时间含等待和被抢占的时间，不能代替CPU时间
+    return -1;
+}
+}  // namespace ffmpeg
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+namespace ffmpeg
+{
+// 解码上下文工作线程的CPU时间，用于自适应线程数估计负载
+// 在avcodec_open2前后对比进程的线程列表，新出现的线程记为该上下文的工作线程
+// 期间持有进程内的锁，其他解码器不会同时打开；其他模块同时创建的线程也会被计入，只影响估计
+class ThreadClock final
+{
+public:
+    ThreadClock() = default;
+    ThreadClock(const ThreadClock&) = delete;
+    ThreadClock& operator=(const ThreadClock&) = delete;
+
+public:
+    // 在avcodec_open2之前和之后调用，End替换之前记录的线程
+    void Begin();
+    void End();
+    // 记录线程的CPU时间之和（微秒），Linux读schedstat，Windows用GetThreadTimes；线程已退出或不支持的平台返回-1
+    int64_t CpuUs() const;
+    // 调用线程的CPU时间（微秒），不支持的平台返回-1
+    static int64_t CurrentThreadCpuUs();
+
+private:
+    std::unique_lock<std::mutex> m_lock;
+    std::vector<int32_t> m_vecBefore;
+    std::vector<int32_t> m_vecThreads;
+};
+}  // namespace ffmpeg
@@ -1,16 +1,375 @@
-﻿#include "Logging.h"
-
-static logging s_pLogging = nullptr;
-
-void SetLoggingFunc(logging func)
-{
-    s_pLogging = func;
-}
-
-void LoggingOut(LogLevel level, const std::string& message)
-{
-    if (s_pLogging)
-    {
-        s_pLogging(static_cast<int>(level), message.c_str(), static_cast<unsigned int>(message.size()));
-    }
-}
+#include "Logging.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+namespace
+{
+// 每个写日志线程的队列容量
+constexpr size_t kLoggingRingCapacity = 64;
+// 同一线程内相同日志的合并窗口，窗口结束后由后台线程输出重复次数
+constexpr std::chrono::milliseconds kLoggingCollapseWindow(1000);
+// 后台线程的最长等待间隔
+constexpr std::chrono::milliseconds kLoggingDrainInterval(20);
+
+inline int FormatRepeat(std::array<char, 96>& message, uint32_t count)
+{
+    return snprintf(message.data(), message.size(), "#FFmpegCodec last message repeated %u times.", count);
+}
+
+struct LoggingSlot
+{
+    LogLevel level;
+    uint32_t length;
+    std::array<char, LOGGING_MESSAGE_MAX> message;
+};
+
+// 单生产者单消费者的无锁环形队列：生产者是写日志的线程，消费者是后台线程
+class LoggingRing final
+{
+public:
+    bool Push(LogLevel level, const char* message, size_t length)
+    {
+        const size_t uTail = m_uTail.load(std::memory_order_relaxed);
+        if (uTail - m_uHead.load(std::memory_order_acquire) >= kLoggingRingCapacity)
+        {
+            return false;
+        }
+        LoggingSlot& slot = m_slots[uTail % kLoggingRingCapacity];
+        slot.level = level;
+        slot.length = static_cast<uint32_t>(length < slot.message.size() ? length : slot.message.size());
+        memcpy(slot.message.data(), message, slot.length);
+        m_uTail.store(uTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename F>
+    void Drain(F&& func)
+    {
+        size_t uHead = m_uHead.load(std::memory_order_relaxed);
+        const size_t uTail = m_uTail.load(std::memory_order_acquire);
+        while (uHead != uTail)
+        {
+            const LoggingSlot& slot = m_slots[uHead % kLoggingRingCapacity];
+            func(slot.level, slot.message.data(), slot.length);
+            m_uHead.store(++uHead, std::memory_order_release);
+        }
+    }
+
+    bool Empty() const
+    {
+        return m_uHead.load(std::memory_order_acquire) == m_uTail.load(std::memory_order_acquire);
+    }
+
+    // 后台线程在mtxRepeat内先Drain再调用：合并窗口已结束或force时输出累计的重复次数
+    template <typename F>
+    void DrainRepeat(std::chrono::steady_clock::time_point now, bool force, F&& func)
+    {
+        if (repeat.load(std::memory_order_acquire) == 0)
+        {
+            return;
+        }
+        // 计数不为0时写日志线程不会在锁外改动级别和时间
+        const LogLevel eLevel = repeatLevel;
+        if (!force && now - repeatFirst < kLoggingCollapseWindow)
+        {
+            return;
+        }
+        std::array<char, 96> message;
+        const int length = FormatRepeat(message, repeat.exchange(0, std::memory_order_acquire));
+        if (length > 0)
+        {
+            func(eLevel, message.data(), static_cast<uint32_t>(length));
+        }
+    }
+
+public:
+    std::atomic<bool> orphan{false};
+    // 最近一条日志之后被合并的重复次数，写日志线程累加，后台线程或下一条不同的日志清零
+    std::atomic<uint32_t> repeat{0};
+    LogLevel repeatLevel = LogLevel::MAX;
+    std::chrono::steady_clock::time_point repeatFirst;
+    // 保证重复次数排在被重复的日志之后、下一条不同的日志之前
+    std::mutex mtxRepeat;
+
+private:
+    std::array<LoggingSlot, kLoggingRingCapacity> m_slots;
+    alignas(64) std::atomic<size_t> m_uHead{0};
+    alignas(64) std::atomic<size_t> m_uTail{0};
+};
+
+class LoggingDispatcher final
+{
+public:
+    // 不析构：Windows上静态析构在加载器锁内执行，等待后台线程会死锁；线程由Shutdown停止
+    static LoggingDispatcher& Instance()
+    {
+        static LoggingDispatcher* s_pDispatcher = new LoggingDispatcher();
+        return *s_pDispatcher;
+    }
+
+    void SetFunc(logging func)
+    {
+        std::lock_guard<std::mutex> lock(m_mtxThread);
+        if (func == nullptr)
+        {
+            Stop();
+        }
+        m_pLogging.store(func, std::memory_order_release);
+        if (func && !m_thread.joinable())
+        {
+            m_bStop = false;
+            m_thread = std::thread(&LoggingDispatcher::Run, this);
+        }
+    }
+
+    // 停止并等待后台线程，输出剩余的日志；之后的日志丢弃，直到再次SetFunc
+    void Shutdown()
+    {
+        SetFunc(nullptr);
+    }
+
+    bool Enabled(LogLevel eLevel) const
+    {
+        return m_pLogging.load(std::memory_order_relaxed) != nullptr && eLevel <= level.load(std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<LoggingRing> Register()
+    {
+        auto pRing = std::make_shared<LoggingRing>();
+        std::lock_guard<std::mutex> lock(m_mtxRings);
+        m_vecRings.push_back(pRing);
+        return pRing;
+    }
+
+    void Wakeup()
+    {
+        m_cvWakeup.notify_one();
+    }
+
+public:
+    std::atomic<LogLevel> level{LogLevel::INFO};
+    std::atomic<uint64_t> dropped{0};
+
+private:
+    LoggingDispatcher()
+        : m_pLogging(nullptr)
+        , m_bStop(false)
+        , m_uReported(0)
+    {
+    }
+    ~LoggingDispatcher() = delete;
+
+    void Stop()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mtxWakeup);
+                m_bStop = true;
+            }
+            m_cvWakeup.notify_one();
+            m_thread.join();
+        }
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(m_mtxWakeup);
+        while (!m_bStop)
+        {
+            m_cvWakeup.wait_for(lock, kLoggingDrainInterval);
+            lock.unlock();
+            DrainAll(false);
+            lock.lock();
+        }
+        lock.unlock();
+        DrainAll(true);
+    }
+
+    // final为停止前的最后一次，不等合并窗口结束
+    void DrainAll(bool final)
+    {
+        logging pLogging = m_pLogging.load(std::memory_order_acquire);
+        auto func = [pLogging](LogLevel level, const char* message, uint32_t length)
+        {
+            if (pLogging)
+            {
+                pLogging(static_cast<int>(level), message, length);
+            }
+        };
+        {
+            const auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(m_mtxRings);
+            for (auto it = m_vecRings.begin(); it != m_vecRings.end();)
+            {
+                // 线程退出后不会再有重复，直接输出
+                const bool bOrphan = (*it)->orphan.load(std::memory_order_acquire);
+                if ((*it)->repeat.load(std::memory_order_acquire) > 0)
+                {
+                    std::lock_guard<std::mutex> lockRepeat((*it)->mtxRepeat);
+                    (*it)->Drain(func);
+                    (*it)->DrainRepeat(now, final || bOrphan, func);
+                }
+                else
+                {
+                    (*it)->Drain(func);
+                }
+                if (bOrphan && (*it)->Empty())
+                {
+                    it = m_vecRings.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        const uint64_t uDropped = dropped.load(std::memory_order_relaxed);
+        if (uDropped != m_uReported && pLogging)
+        {
+            std::array<char, 128> message;
+            int length = snprintf(message.data(), message.size(), "#FFmpegCodec logging queue overflow, dropped %llu messages.",
+                                  static_cast<unsigned long long>(uDropped - m_uReported));
+            if (length > 0)
+            {
+                pLogging(static_cast<int>(LogLevel::WARN), message.data(), static_cast<unsigned int>(length));
+            }
+            m_uReported = uDropped;
+        }
+    }
+
+private:
+    std::atomic<logging> m_pLogging;
+    std::mutex m_mtxThread;
+    std::thread m_thread;
+    std::mutex m_mtxWakeup;
+    std::condition_variable m_cvWakeup;
+    bool m_bStop;
+    std::mutex m_mtxRings;
+    std::vector<std::shared_ptr<LoggingRing>> m_vecRings;
+    uint64_t m_uReported;
+};
+
+// 写日志线程的本地状态：队列以及最近一条日志，重复计数在队列中供后台线程输出
+struct LoggingThread
+{
+    std::shared_ptr<LoggingRing> ring;
+    uint64_t hash = 0;
+    std::chrono::steady_clock::time_point first;
+
+    ~LoggingThread()
+    {
+        if (ring)
+        {
+            ring->orphan.store(true, std::memory_order_release);
+        }
+    }
+};
+thread_local LoggingThread t_logging;
+
+inline uint64_t HashMessage(LogLevel level, const char* message, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull ^ static_cast<uint64_t>(level);
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<uint8_t>(message[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void PushMessage(LoggingRing& ring, LogLevel level, const char* message, size_t length)
+{
+    auto& dispatcher = LoggingDispatcher::Instance();
+    if (!ring.Push(level, message, length))
+    {
+        dispatcher.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (level <= LogLevel::FAULT)
+    {
+        dispatcher.Wakeup();
+    }
+}
+
+// 写入一条不同的日志，之前未输出的重复次数先写入
+void PushDistinct(LoggingThread& thread, LogLevel level, const char* message, size_t length, std::chrono::steady_clock::time_point now)
+{
+    if (thread.ring == nullptr)
+    {
+        thread.ring = LoggingDispatcher::Instance().Register();
+    }
+    LoggingRing& ring = *thread.ring;
+    std::unique_lock<std::mutex> lock(ring.mtxRepeat, std::defer_lock);
+    if (ring.repeat.load(std::memory_order_acquire) > 0)
+    {
+        // 与后台线程的输出互斥，只有存在未输出的重复时才加锁
+        lock.lock();
+        const uint32_t uRepeat = ring.repeat.exchange(0, std::memory_order_acquire);
+        std::array<char, 96> repeat;
+        const int nLength = uRepeat > 0 ? FormatRepeat(repeat, uRepeat) : 0;
+        if (nLength > 0)
+        {
+            PushMessage(ring, ring.repeatLevel, repeat.data(), static_cast<size_t>(nLength));
+        }
+    }
+    ring.repeatLevel = level;
+    ring.repeatFirst = now;
+    PushMessage(ring, level, message, length);
+}
+}  // namespace
+
+void SetLoggingFunc(logging func)
+{
+    LoggingDispatcher::Instance().SetFunc(func);
+}
+
+void ShutdownLogging()
+{
+    LoggingDispatcher::Instance().Shutdown();
+}
+
+void SetLoggingFilter(LogLevel level)
+{
+    LoggingDispatcher::Instance().level.store(level, std::memory_order_relaxed);
+}
+
+LogLevel GetLoggingFilter()
+{
+    return LoggingDispatcher::Instance().level.load(std::memory_order_relaxed);
+}
+
+bool LoggingEnabled(LogLevel level)
+{
+    return LoggingDispatcher::Instance().Enabled(level);
+}
+
+uint64_t LoggingDroppedCount()
+{
+    return LoggingDispatcher::Instance().dropped.load(std::memory_order_relaxed);
+}
+
+void LoggingOut(LogLevel level, const char* message, size_t length)
+{
+    if (!LoggingEnabled(level) || message == nullptr)
+    {
+        return;
+    }
+    LoggingThread& thread = t_logging;
+    const uint64_t hash = HashMessage(level, message, length);
+    const auto now = std::chrono::steady_clock::now();
+    if (thread.ring && hash == thread.hash && now - thread.first < kLoggingCollapseWindow)
+    {
+        thread.ring->repeat.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    thread.hash = hash;
+    thread.first = now;
+    PushDistinct(thread, level, message, length, now);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Linux USDT静态探针，未附加时只是一条nop指令
+// 探针列表及参数见tools/usdt/decode_latency.bt
+#if defined(_HAS_SDT) && defined(__linux__)
+#include <sys/sdt.h>
+
+#define PROBE0(name) DTRACE_PROBE(ffmpeg_codec, name)
+#define PROBE1(name, a1) DTRACE_PROBE1(ffmpeg_codec, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(ffmpeg_codec, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(ffmpeg_codec, name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(ffmpeg_codec, name, a1, a2, a3, a4)
+#define PROBE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(ffmpeg_codec, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define PROBE0(name)
+#define PROBE1(name, a1)
+#define PROBE2(name, a1, a2)
+#define PROBE3(name, a1, a2, a3)
+#define PROBE4(name, a1, a2, a3, a4)
+#define PROBE5(name, a1, a2, a3, a4, a5)
+
+#endif
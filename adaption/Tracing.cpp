@@ -0,0 +1,176 @@
+#include "Tracing.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+namespace tracing
+{
+std::atomic<bool> g_bEnabled(false);
+
+namespace
+{
+struct TraceEvent
+{
+    // 序号*2+1表示正在写入，序号*2+2表示写入完成
+    std::atomic<uint64_t> seq{0};
+    const char* name = nullptr;
+    uint32_t id = 0;
+    uint32_t tid = 0;
+    int64_t begin = 0;
+    int64_t end = 0;
+    int64_t pts = 0;
+};
+
+// 多生产者覆盖式环形缓冲区，写入只需一次fetch_add，满后覆盖最旧的事件
+struct TraceRing
+{
+    explicit TraceRing(size_t capacity)
+        : mask(capacity - 1)
+        , events(new TraceEvent[capacity])
+    {
+    }
+    const size_t mask;
+    std::unique_ptr<TraceEvent[]> events;
+    std::atomic<uint64_t> next{0};
+};
+
+std::mutex s_mtxRing;
+std::shared_ptr<TraceRing> s_pRing;
+std::atomic<uint64_t> s_uGeneration{0};
+const auto s_tpEpoch = std::chrono::steady_clock::now();
+
+uint32_t ThreadId()
+{
+    thread_local const uint32_t t_uTid = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return t_uTid;
+}
+
+std::shared_ptr<TraceRing> CurrentRing()
+{
+    std::lock_guard<std::mutex> lock(s_mtxRing);
+    return s_pRing;
+}
+}  // namespace
+
+void Enable(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(s_mtxRing);
+    if (capacity == 0)
+    {
+        g_bEnabled.store(false, std::memory_order_relaxed);
+        return;
+    }
+    size_t szCapacity = 1;
+    while (szCapacity < capacity)
+    {
+        szCapacity <<= 1;
+    }
+    if (s_pRing == nullptr || s_pRing->mask + 1 != szCapacity)
+    {
+        s_pRing = std::make_shared<TraceRing>(szCapacity);
+        s_uGeneration.fetch_add(1, std::memory_order_release);
+    }
+    g_bEnabled.store(true, std::memory_order_relaxed);
+}
+
+int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_tpEpoch).count();
+}
+
+void Record(const char* name, uint32_t id, int64_t begin, int64_t end, int64_t pts)
+{
+    // 缓冲区只在Enable时替换，解码线程缓存其引用，代数变化时才加锁重新获取
+    thread_local std::shared_ptr<TraceRing> t_pRing;
+    thread_local uint64_t t_uGeneration = 0;
+    const uint64_t uGeneration = s_uGeneration.load(std::memory_order_acquire);
+    if (t_uGeneration != uGeneration)
+    {
+        t_pRing = CurrentRing();
+        t_uGeneration = uGeneration;
+    }
+    if (t_pRing == nullptr)
+    {
+        return;
+    }
+    const uint64_t uIndex = t_pRing->next.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent& event = t_pRing->events[uIndex & t_pRing->mask];
+    event.seq.store(uIndex * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name = name;
+    event.id = id;
+    event.tid = ThreadId();
+    event.begin = begin;
+    event.end = end;
+    event.pts = pts;
+    event.seq.store(uIndex * 2 + 2, std::memory_order_release);
+}
+
+int32_t Dump(const char* path)
+{
+    auto pRing = CurrentRing();
+    if (pRing == nullptr || path == nullptr)
+    {
+        return -1;
+    }
+    FILE* pFile = fopen(path, "wb");
+    if (pFile == nullptr)
+    {
+        return -1;
+    }
+    struct Snapshot
+    {
+        const char* name;
+        uint32_t id;
+        uint32_t tid;
+        int64_t begin;
+        int64_t end;
+        int64_t pts;
+    };
+    std::vector<Snapshot> vecEvents;
+    const uint64_t uNext = pRing->next.load(std::memory_order_acquire);
+    const uint64_t uCapacity = pRing->mask + 1;
+    vecEvents.reserve(static_cast<size_t>(std::min(uNext, uCapacity)));
+    for (uint64_t i = uNext > uCapacity ? uNext - uCapacity : 0; i < uNext; ++i)
+    {
+        const TraceEvent& event = pRing->events[i & pRing->mask];
+        const uint64_t uSeq = event.seq.load(std::memory_order_acquire);
+        if (uSeq != i * 2 + 2)
+        {
+            continue;
+        }
+        Snapshot snapshot{event.name, event.id, event.tid, event.begin, event.end, event.pts};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.seq.load(std::memory_order_relaxed) == uSeq && snapshot.name)
+        {
+            vecEvents.push_back(snapshot);
+        }
+    }
+    std::vector<uint32_t> vecIds;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", pFile);
+    bool bFirst = true;
+    for (const auto& event : vecEvents)
+    {
+        // 每个解码器作为一个进程轨道，解码线程作为其下的线程轨道
+        if (std::find(vecIds.begin(), vecIds.end(), event.id) == vecIds.end())
+        {
+            vecIds.push_back(event.id);
+            fprintf(pFile, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"decoder#%u\"}}", bFirst ? "" : ",\n",
+                    event.id, event.id);
+            bFirst = false;
+        }
+        fprintf(pFile, "%s{\"name\":\"%s\",\"cat\":\"decode\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%u,\"tid\":%u,\"args\":{\"pts\":%lld}}",
+                bFirst ? "" : ",\n", event.name, static_cast<long long>(event.begin), static_cast<long long>(event.end - event.begin), event.id,
+                event.tid, static_cast<long long>(event.pts));
+        bFirst = false;
+    }
+    fputs("\n]}\n", pFile);
+    fclose(pFile);
+    return static_cast<int32_t>(vecEvents.size());
+}
+}  // namespace tracing
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// 解码流水线的时间线记录，导出为Chrome trace格式，可直接在Perfetto中查看
+namespace tracing
+{
+extern std::atomic<bool> g_bEnabled;
+
+inline bool Enabled()
+{
+    return g_bEnabled.load(std::memory_order_relaxed);
+}
+
+// capacity为环形缓冲区的事件数，向上取整到2的幂；0表示关闭
+void Enable(size_t capacity);
+int64_t Now();
+// name必须是静态字符串
+void Record(const char* name, uint32_t id, int64_t begin, int64_t end, int64_t pts);
+// 输出当前缓冲区中的事件，返回事件个数，失败返回-1
+int32_t Dump(const char* path);
+
+class Scope final
+{
+public:
+    Scope(const char* name, uint32_t id, int64_t pts)
+        : m_name(name)
+        , m_uId(id)
+        , m_nPts(pts)
+        , m_nBegin(Enabled() ? Now() : -1)
+    {
+    }
+    ~Scope()
+    {
+        End();
+    }
+    // 提前结束区间，之后析构不再记录
+    void End()
+    {
+        if (m_nBegin >= 0)
+        {
+            Record(m_name, m_uId, m_nBegin, Now(), m_nPts);
+            m_nBegin = -1;
+        }
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    const char* m_name;
+    uint32_t m_uId;
+    int64_t m_nPts;
+    int64_t m_nBegin;
+};
+}  // namespace tracing
+
+#define TRACE_CONCAT_DETAIL(x, y) x##y
+#define TRACE_CONCAT(x, y) TRACE_CONCAT_DETAIL(x, y)
+#define TRACE_SCOPE(name, id, pts) tracing::Scope TRACE_CONCAT(_trace_scope_, __LINE__)(name, id, pts)
@@ -0,0 +1,53 @@
+# perf script handler for the FFmpegCodecPlugin USDT probes.
+#
+#   perf script -i ffmpeg_codec.perf.data -s tools/usdt/perf_latency.py
+#
+# Prints, per decoder id, log2 histograms in microseconds of:
+#   decode    video_packet_submit -> video_frame_ready
+#   convert   video_convert -> video_callback
+#   callback  video_callback -> video_callback_return
+#   audio     audio_packet_submit -> audio_callback
+from collections import defaultdict
+
+pending = defaultdict(dict)
+histograms = defaultdict(lambda: defaultdict(lambda: defaultdict(int)))
+
+STARTS = {
+    'video_packet_submit': ('decode', 'video_frame_ready'),
+    'video_convert': ('convert', 'video_callback'),
+    'video_callback': ('callback', 'video_callback_return'),
+    'audio_packet_submit': ('audio', 'audio_callback'),
+}
+ENDS = {end: (name, start) for start, (name, end) in STARTS.items()}
+
+
+def bucket(us):
+    b = 0
+    while (1 << (b + 1)) <= us:
+        b += 1
+    return b
+
+
+def trace_unhandled(event_name, context, fields, *args):
+    probe = event_name.split('__')[-1]
+    ns = fields['common_s'] * 1000000000 + fields['common_ns']
+    key = (fields.get('arg1'), fields.get('arg2'))
+    if probe in ENDS:
+        name, start = ENDS[probe]
+        begin = pending[start].pop(key, None)
+        if begin is not None:
+            histograms[name][key[0]][bucket(max(ns - begin, 0) // 1000)] += 1
+    if probe in STARTS:
+        pending[probe][key] = ns
+
+
+def trace_end():
+    for name in ('decode', 'convert', 'callback', 'audio'):
+        for decoder in sorted(histograms[name]):
+            hist = histograms[name][decoder]
+            total = sum(hist.values())
+            peak = max(hist.values())
+            print('\n%s latency, decoder %s (%d samples)' % (name, decoder, total))
+            for b in range(min(hist), max(hist) + 1):
+                count = hist.get(b, 0)
+                print('  [%8d, %8d) us %8d |%-40s|' % (1 << b if b else 0, 1 << (b + 1), count, '@' * (count * 40 // peak)))
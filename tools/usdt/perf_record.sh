@@ -0,0 +1,20 @@
+#!/bin/sh
+# Record the FFmpegCodecPlugin USDT probes with perf and print per-stream
+# latency histograms.
+#
+#   sudo tools/usdt/perf_record.sh /path/to/libFFmpegCodecPlugin.so [seconds]
+set -e
+
+LIB=${1:?usage: $0 <libFFmpegCodecPlugin.so> [seconds]}
+SECONDS_TO_RECORD=${2:-10}
+HERE=$(cd "$(dirname "$0")" && pwd)
+
+perf buildid-cache --add "$LIB"
+for probe in video_packet_submit video_frame_ready video_convert video_callback video_callback_return \
+             audio_packet_submit audio_callback; do
+    perf probe -q -d "sdt_ffmpeg_codec:$probe" 2>/dev/null || true
+    perf probe -q -x "$LIB" "sdt_ffmpeg_codec:$probe"
+done
+
+perf record -q -a -o ffmpeg_codec.perf.data -e 'sdt_ffmpeg_codec:*' -- sleep "$SECONDS_TO_RECORD"
+perf script -i ffmpeg_codec.perf.data -s "$HERE/perf_latency.py"
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Measure dTLB miss rate and decoded fps of a running host process, to compare
+# SetHugePages(0) against SetHugePages(1/2) on the same streams.
+#
+#   sudo tools/usdt/tlb_stat.sh /path/to/libFFmpegCodecPlugin.so <pid> [seconds]
+#
+# Run once per mode with the same input; fps is counted from the
+# video_frame_ready probe, so it covers every decoder in the process.
+set -e
+
+LIB=${1:?usage: $0 <libFFmpegCodecPlugin.so> <pid> [seconds]}
+PID=${2:?usage: $0 <libFFmpegCodecPlugin.so> <pid> [seconds]}
+SECONDS_TO_RECORD=${3:-10}
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+
+perf buildid-cache --add "$LIB"
+perf probe -q -d "sdt_ffmpeg_codec:video_frame_ready" 2>/dev/null || true
+perf probe -q -x "$LIB" "sdt_ffmpeg_codec:video_frame_ready"
+
+perf stat -x, -o "$OUT" -p "$PID" \
+    -e dTLB-loads,dTLB-load-misses,dTLB-stores,dTLB-store-misses,sdt_ffmpeg_codec:video_frame_ready \
+    -- sleep "$SECONDS_TO_RECORD"
+
+awk -F, -v secs="$SECONDS_TO_RECORD" '
+    $3 ~ /^dTLB-loads/             { loads = $1 }
+    $3 ~ /^dTLB-load-misses/       { load_misses = $1 }
+    $3 ~ /^dTLB-stores/            { stores = $1 }
+    $3 ~ /^dTLB-store-misses/      { store_misses = $1 }
+    $3 ~ /video_frame_ready/       { frames = $1 }
+    END {
+        if (loads > 0)  printf "dTLB load miss rate   %.4f%% (%d / %d)\n", 100 * load_misses / loads, load_misses, loads
+        if (stores > 0) printf "dTLB store miss rate  %.4f%% (%d / %d)\n", 100 * store_misses / stores, store_misses, stores
+        printf "frames                %d\n", frames
+        printf "fps                   %.1f\n", frames / secs
+    }' "$OUT"